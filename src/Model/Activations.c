@@ -7,6 +7,7 @@
 
 #include "Model/Matrix.h"
 #include "Model/Activations.h"
+#include "Model/Kernels.h"
 #include "pch.h"
 
 
@@ -18,63 +19,89 @@ inline static float clamp(float x, float lower, float upper){
     return b;
 }
 
+//every activation but softmax works on each value on its own, so they're written for a range of values
+//and split between threads like the kernels (see parallel_unary())
+static void reLu_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        //xvalues[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i] = MAX(values[i], 0.0f);
+    }
+}
+
 void reLu(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        //xmat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i] = MAX(mat->values[i], 0.0f);
+    parallel_unary(reLu_values, mat->values, size(mat));
+}
+
+static void leaky_reLu_values(float* values, size_t n){
+     for (size_t i = 0; i < n; i++){
+        //values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i] *= values[i] < 0.0f ? 0.01f : 1.0f;
     }
 }
 
 void leaky_reLu(Matrix* mat){
-     for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        //mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i] *= mat->values[i] < 0.0f ? 0.01f : 1.0f;
+    parallel_unary(leaky_reLu_values, mat->values, size(mat));
+}
+
+static void sigmoid_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i]  = 1.0f / ( 1.0f + expf(-values[i]) );
     }
 }
 
 void sigmoid(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i]  = 1.0f / ( 1.0f + expf(-mat->values[i]) );
+    parallel_unary(sigmoid_values, mat->values, size(mat));
+}
+
+static void hyperbolic_tangent_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i]  = tanhf(values[i]);
     }
-                                    
 }
 
 void hyperbolic_tangent(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i]  = tanhf(mat->values[i]);
+    parallel_unary(hyperbolic_tangent_values, mat->values, size(mat));
+}
+
+static void soft_plus_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i]  = logf(1.0f + expf(values[i]));
     }
 }
 
 void soft_plus(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i]  = logf(1.0f + expf(mat->values[i]));
-    }
+    parallel_unary(soft_plus_values, mat->values, size(mat));
 }
 
 void softmax(Matrix* mat){
-    mat->values[0] = clamp(mat->values[0], -CLIP_RANGE, CLIP_RANGE);
-
-    float max = mat->values[0];
-    for (size_t i = 1; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        if (mat->values[i] > max)
-            max = mat->values[i];
-    }
+    //every column is its own data point
+    for (size_t c = 0; c < mat->cols; c++){
+        float* col = mat->values + c;
+        size_t stride = mat->cols;
+        
+        col[0] = clamp(col[0], -CLIP_RANGE, CLIP_RANGE);
+        float max = col[0];
+        for (size_t i = 1; i < mat->rows; i++){
+            col[i * stride] = clamp(col[i * stride], -CLIP_RANGE, CLIP_RANGE);
+            if (col[i * stride] > max)
+                max = col[i * stride];
+        }
 
-    float denom = 0.0f;
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        //storing the e^x so we don't have to recalculate it
-        float val = exp(mat->values[i] - max);
-        denom += val;
-        mat->values[i] = val;
-    }
+        float denom = 0.0f;
+        for (size_t i = 0; i < mat->rows; i++){
+            //storing the e^x so we don't have to recalculate it
+            float val = exp(col[i * stride] - max);
+            denom += val;
+            col[i * stride] = val;
+        }
 
-    
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] /= denom;
+        
+        for (size_t i = 0; i < mat->rows; i++){
+            col[i * stride] /= denom;
+        }
     }
 
 }
@@ -94,61 +121,86 @@ uint32_t argmax(Matrix* mat){
 
 //TODO format these the same as loss file
 
+static void reLu_deriv_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = values[i] < 0.0f ? 0.0f : 1.0f;
+    }
+}
+
 void reLu_deriv(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = mat->values[i] < 0.0f ? 0.0f : 1.0f;
+    parallel_unary(reLu_deriv_values, mat->values, size(mat));
+}
+
+static void leaky_reLu_deriv_values(float* values, size_t n){
+     for (size_t i = 0; i < n; i++){
+        values[i] = values[i] < 0.0f ? 0.01f : 1.0f;
     }
 }
 
 void leaky_reLu_deriv(Matrix* mat){
-     for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = mat->values[i] < 0.0f ? 0.01f : 1.0f;
+    parallel_unary(leaky_reLu_deriv_values, mat->values, size(mat));
+}
+
+static void sigmoid_deriv_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i] = ( 1.0f / (1.0f + exp(-values[i])) ) * (1.0f - ( 1.0f / (1.0f + exp(-values[i])) ));
     }
 }
 
 void sigmoid_deriv(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i] = ( 1.0f / (1.0f + exp(-mat->values[i])) ) * (1.0f - ( 1.0f / (1.0f + exp(-mat->values[i])) ));
+    parallel_unary(sigmoid_deriv_values, mat->values, size(mat));
+}
+
+static void hyperbolic_tangent_deriv_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i] = 1.0f - (  ( expf(values[i]) - expf(-values[i]) ) / powf( expf(values[i]) + expf(-values[i]), 2.0f) );
     }
-                                    
 }
 
 void hyperbolic_tangent_deriv(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i] = 1.0f - (  ( expf(mat->values[i]) - expf(-mat->values[i]) ) / powf( expf(mat->values[i]) + expf(-mat->values[i]), 2.0f) );
+    parallel_unary(hyperbolic_tangent_deriv_values, mat->values, size(mat));
+}
+
+static void soft_plus_deriv_values(float* values, size_t n){
+    for (size_t i = 0; i < n; i++){
+        values[i] = clamp(values[i], -CLIP_RANGE, CLIP_RANGE);
+        values[i]  = expf(values[i]) / (1.0f + expf(values[i]));
     }
 }
 
 void soft_plus_deriv(Matrix* mat){
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        mat->values[i] = clamp(mat->values[i], -CLIP_RANGE, CLIP_RANGE);
-        mat->values[i]  = expf(mat->values[i]) / (1.0f + expf(mat->values[i]));
-    }
+    parallel_unary(soft_plus_deriv_values, mat->values, size(mat));
 }
 
 void softmax_deriv(Matrix* mat, Matrix* observ){
     softmax(mat);
     
-    size_t j;
-    for (size_t i = 0; i < observ->rows * observ->cols; i++){
-        if (observ->values[i] == 1.0f){
-            j = i;
-            break;
+    //every column is its own data point, with its own one hot encoded observation
+    for (size_t c = 0; c < mat->cols; c++){
+        size_t stride = mat->cols;
+        
+        size_t j = 0;
+        for (size_t i = 0; i < observ->rows; i++){
+            if (observ->values[i * stride + c] == 1.0f){
+                j = i;
+                break;
+            }
         }
-    }
 
-    float targ = mat->values[j];
+        float targ = mat->values[j * stride + c];
 
-    for (size_t i = 0; i < mat->rows * mat->cols; i++){
-        if (i == j){
-            mat->values[i] = targ * (1.0f - targ);
-            //mat->values[i] = targ - 1;
-        }
-        else{
-            mat->values[i] = -mat->values[i] * targ;
-             //mat->values[i] = mat->values[i];
+        for (size_t i = 0; i < mat->rows; i++){
+            float* val = mat->values + i * stride + c;
+            if (i == j){
+                *val = targ * (1.0f - targ);
+                //*val = targ - 1;
+            }
+            else{
+                *val = -(*val) * targ;
+                 //*val = *val;
+            }
         }
     }
 }
@@ -0,0 +1,255 @@
+//
+//  Allocator.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Allocator.h"
+#include "pch.h"
+#include <stdatomic.h>
+
+//slabs the small pool classes are carved out of
+#define SLAB_SIZE (1 << 18)
+//classes up to this size come from slabs, bigger ones are allocated one at a time
+#define MAX_SLAB_CLASS_SIZE (SLAB_SIZE / 16)
+
+#ifdef DEBUG
+//atomic since any thread can allocate, the training thread, pool workers and the prefetch and checkpoint threads
+static atomic_size_t num_allocations = 0;
+#endif
+
+struct ArenaBlock{
+    ArenaBlock* next;
+};
+
+struct PoolSlab{
+    PoolSlab* next;
+};
+
+//every pool block is preceded by one of these, padded out to the alignment so the block itself stays aligned
+typedef struct PoolHeader{
+    size_t size_class; //POOL_SIZE_CLASSES for blocks too big for any class
+    size_t bytes;
+} PoolHeader;
+
+
+static size_t round_up(size_t bytes){
+    return (bytes + ALLOCATOR_ALIGNMENT - 1) & ~(size_t)(ALLOCATOR_ALIGNMENT - 1);
+}
+
+static void* aligned_or_exit(size_t bytes){
+    //aligned_alloc needs the size to be a multiple of the alignment
+    void* ptr = aligned_alloc(ALLOCATOR_ALIGNMENT, round_up(bytes == 0 ? 1 : bytes));
+    if (ptr == NULL){
+        fprintf(stderr, "ERROR: Could not allocate %zu bytes. Exiting...\n", bytes);
+        exit(-1);
+    }
+    return ptr;
+}
+
+Allocator create_arena(size_t initial_capacity){
+    Allocator allocator;
+    allocator.type = ARENA_ALLOCATOR;
+    allocator.arena.capacity = round_up(initial_capacity);
+    allocator.arena.block = allocator.arena.capacity == 0 ? NULL : (char*) aligned_or_exit(allocator.arena.capacity);
+    allocator.arena.used = 0;
+    allocator.arena.overflow = NULL;
+    allocator.arena.overflow_used = 0;
+    return allocator;
+}
+
+Allocator create_pool(void){
+    Allocator allocator;
+    allocator.type = POOL_ALLOCATOR;
+    for (size_t i = 0; i < POOL_SIZE_CLASSES; i++)
+        allocator.pool.free_lists[i] = NULL;
+    allocator.pool.slabs = NULL;
+    allocator.pool.bytes_in_use = 0;
+    allocator.pool.bytes_reserved = 0;
+    return allocator;
+}
+
+static void free_overflow(Arena* arena){
+    while (arena->overflow != NULL){
+        ArenaBlock* next = arena->overflow->next;
+        free(arena->overflow);
+        arena->overflow = next;
+    }
+    arena->overflow_used = 0;
+}
+
+void delete_allocator(Allocator* allocator){
+    if (allocator->type == ARENA_ALLOCATOR){
+        free_overflow(&allocator->arena);
+        free(allocator->arena.block);
+        allocator->arena.block = NULL;
+        allocator->arena.capacity = 0;
+        allocator->arena.used = 0;
+        return;
+    }
+
+    Pool* pool = &allocator->pool;
+    if (pool->bytes_in_use != 0)
+        fprintf(stderr, "ERROR: Deleting a pool with %zu bytes still in use\n", pool->bytes_in_use);
+
+    //blocks of the bigger classes were allocated one by one, the rest live inside of the slabs
+    for (size_t i = 0; i < POOL_SIZE_CLASSES; i++){
+        if ((size_t)ALLOCATOR_ALIGNMENT << i > MAX_SLAB_CLASS_SIZE){
+            void* block = pool->free_lists[i];
+            while (block != NULL){
+                void* next = *(void**) block;
+                free(block);
+                block = next;
+            }
+        }
+        pool->free_lists[i] = NULL;
+    }
+
+    while (pool->slabs != NULL){
+        PoolSlab* next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    pool->bytes_reserved = 0;
+}
+
+
+
+static void* arena_alloc(Arena* arena, size_t bytes){
+    bytes = round_up(bytes);
+    if (arena->used + bytes <= arena->capacity){
+        void* ptr = arena->block + arena->used;
+        arena->used += bytes;
+        return ptr;
+    }
+
+    //out of room. Keep going in a separate block until the next reset, which resizes the main block
+    ArenaBlock* block = (ArenaBlock*) aligned_or_exit(ALLOCATOR_ALIGNMENT + bytes);
+    block->next = arena->overflow;
+    arena->overflow = block;
+    arena->overflow_used += bytes;
+    return (char*) block + ALLOCATOR_ALIGNMENT;
+}
+
+void arena_reset(Allocator* allocator){
+    Arena* arena = &allocator->arena;
+    if (arena->overflow != NULL){
+        //one block with room for everything that was allocated since the last reset
+        size_t capacity = arena->used + arena->overflow_used;
+        free_overflow(arena);
+        free(arena->block);
+        arena->block = (char*) aligned_or_exit(capacity);
+        arena->capacity = capacity;
+    }
+    arena->used = 0;
+}
+
+
+
+static size_t size_class_of(size_t bytes){
+    size_t size_class = 0;
+    while (size_class < POOL_SIZE_CLASSES && (size_t)ALLOCATOR_ALIGNMENT << size_class < bytes)
+        size_class++;
+    return size_class;
+}
+
+static void* pool_alloc(Pool* pool, size_t bytes){
+    size_t total = round_up(bytes) + ALLOCATOR_ALIGNMENT; //room for the header
+    size_t size_class = size_class_of(total);
+
+    char* block;
+    if (size_class == POOL_SIZE_CLASSES){
+        block = (char*) aligned_or_exit(total);
+        pool->bytes_reserved += total;
+    }
+    else if (pool->free_lists[size_class] != NULL){
+        block = (char*) pool->free_lists[size_class];
+        pool->free_lists[size_class] = *(void**) block;
+    }
+    else{
+        size_t class_size = (size_t)ALLOCATOR_ALIGNMENT << size_class;
+        if (class_size > MAX_SLAB_CLASS_SIZE){
+            block = (char*) aligned_or_exit(class_size);
+            pool->bytes_reserved += class_size;
+        }
+        else{
+            //carve a fresh slab into blocks of this class. The first chunk holds the slab's link, the rest goes on the free list
+            PoolSlab* slab = (PoolSlab*) aligned_or_exit(SLAB_SIZE);
+            slab->next = pool->slabs;
+            pool->slabs = slab;
+            pool->bytes_reserved += SLAB_SIZE;
+
+            char* first = (char*) slab + ALLOCATOR_ALIGNMENT;
+            char* end = (char*) slab + SLAB_SIZE;
+            block = first;
+            for (char* p = first + class_size; p + class_size <= end; p += class_size){
+                *(void**) p = pool->free_lists[size_class];
+                pool->free_lists[size_class] = p;
+            }
+        }
+    }
+
+    PoolHeader* header = (PoolHeader*) block;
+    header->size_class = size_class;
+    header->bytes = size_class == POOL_SIZE_CLASSES ? total : (size_t)ALLOCATOR_ALIGNMENT << size_class;
+    pool->bytes_in_use += header->bytes;
+    return block + ALLOCATOR_ALIGNMENT;
+}
+
+static void pool_free(Pool* pool, void* ptr){
+    char* block = (char*) ptr - ALLOCATOR_ALIGNMENT;
+    PoolHeader* header = (PoolHeader*) block;
+    size_t size_class = header->size_class;
+    pool->bytes_in_use -= header->bytes;
+
+    if (size_class == POOL_SIZE_CLASSES){
+        pool->bytes_reserved -= header->bytes;
+        free(block);
+        return;
+    }
+
+    //the free list link goes where the header was
+    *(void**) block = pool->free_lists[size_class];
+    pool->free_lists[size_class] = block;
+}
+
+
+
+void* allocator_alloc(Allocator* allocator, size_t bytes){
+    count_allocation();
+    void* ptr;
+    if (allocator == NULL)
+        ptr = aligned_or_exit(bytes);
+    else if (allocator->type == ARENA_ALLOCATOR)
+        ptr = arena_alloc(&allocator->arena, bytes);
+    else
+        ptr = pool_alloc(&allocator->pool, bytes);
+
+    memset(ptr, 0, bytes);
+    return ptr;
+}
+
+size_t allocation_count(void){
+#ifdef DEBUG
+    return atomic_load_explicit(&num_allocations, memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+void count_allocation(void){
+#ifdef DEBUG
+    atomic_fetch_add_explicit(&num_allocations, 1, memory_order_relaxed);
+#endif
+}
+
+void allocator_free(Allocator* allocator, void* ptr){
+    if (ptr == NULL)
+        return;
+
+    if (allocator == NULL)
+        free(ptr);
+    else if (allocator->type == POOL_ALLOCATOR)
+        pool_free(&allocator->pool, ptr);
+}
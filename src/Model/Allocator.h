@@ -0,0 +1,83 @@
+//
+//  Allocator.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Allocator_h
+#define Allocator_h
+
+#include "pch.h"
+
+//every block handed out is aligned to a cache line, which is also the widest SIMD register (AVX-512)
+#define ALLOCATOR_ALIGNMENT 64
+
+//number of power of two size classes the pool keeps free lists for, starting at ALLOCATOR_ALIGNMENT bytes.
+//anything bigger than the largest class (64 << 21 = 128MB) goes straight to the heap
+#define POOL_SIZE_CLASSES 22
+
+typedef enum AllocatorType{
+    ARENA_ALLOCATOR = 0,
+    POOL_ALLOCATOR,
+} AllocatorType;
+
+typedef struct ArenaBlock ArenaBlock;
+typedef struct PoolSlab PoolSlab;
+
+//bump allocator for short lived memory. Allocating is a pointer increment, and everything is released at once with arena_reset()
+typedef struct Arena{
+    char* block;
+    size_t capacity;
+    size_t used;
+
+    //blocks allocated when the main block ran out. reset folds them into one main block that's big enough for next time
+    ArenaBlock* overflow;
+    size_t overflow_used;
+} Arena;
+
+//size class allocator for long lived buffers. Freed blocks go on a free list for their class and are reused,
+//they're only given back to the system when the pool is deleted. Small classes are carved out of larger slabs
+typedef struct Pool{
+    void* free_lists[POOL_SIZE_CLASSES];
+    PoolSlab* slabs;
+
+    size_t bytes_in_use;
+    size_t bytes_reserved;
+} Pool;
+
+typedef struct Allocator{
+    AllocatorType type;
+    union {
+        Arena arena;
+        Pool pool;
+    };
+} Allocator;
+
+
+
+//an arena starting out with initial_capacity bytes. It grows by itself, so 0 is fine
+Allocator create_arena(size_t initial_capacity);
+
+Allocator create_pool(void);
+
+//every block of a pool has to be freed before the pool is deleted. An arena's blocks don't
+void delete_allocator(Allocator* allocator);
+
+//zero initialized and ALLOCATOR_ALIGNMENT aligned. A NULL allocator means the regular heap
+void* allocator_alloc(Allocator* allocator, size_t bytes);
+
+//memory from an arena is only released by arena_reset(), so this does nothing for arenas
+void allocator_free(Allocator* allocator, void* ptr);
+
+//releases everything allocated from the arena in one go. O(1) unless the arena had to grow since the last reset
+void arena_reset(Allocator* allocator);
+
+//how many allocations have been made so far, by every thread: each allocator_alloc(), and each heap allocation made
+//elsewhere that was reported with count_allocation(). Only counted in DEBUG builds, always 0 otherwise
+size_t allocation_count(void);
+
+//reports an allocation made straight from the heap, for the code that manages its own buffers
+void count_allocation(void);
+
+#endif /* Allocator_h */
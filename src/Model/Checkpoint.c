@@ -0,0 +1,203 @@
+//
+//  Checkpoint.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Checkpoint.h"
+#include "Model/Allocator.h"
+#include "Model/Checksum.h"
+#include "Model/FileIO.h"
+#include "pch.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void* writer_main(void* arg){
+    Checkpointer* c = (Checkpointer*) arg;
+
+    //the checksum reads the whole snapshot, so it's done here rather than on the training thread
+    ModelHeader* header = (ModelHeader*) c->image;
+    header->checksum = checksum_words(CHECKSUM_SEED, c->image + sizeof(ModelHeader), c->image_bytes - sizeof(ModelHeader));
+
+    int fd = open(c->temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    uint8_t success = fd >= 0 && write_fully(fd, c->image, c->image_bytes) && fsync(fd) == 0;
+    if (fd >= 0)
+        success = close(fd) == 0 && success;
+    //only a complete file ever gets the name
+    success = success && rename(c->temp_path, c->path) == 0;
+    if (success){
+        int directory = open(c->directory, O_RDONLY);
+        if (directory >= 0){
+            fsync(directory);
+            close(directory);
+        }
+    }
+    else{
+        fprintf(stderr, "ERROR: Could not write the checkpoint %s, the one before is still there. Continuing...\n", c->path);
+        unlink(c->temp_path);
+        c->success = 0;
+    }
+    return NULL;
+}
+
+static void wait_for_writer(Checkpointer* c){
+    if (c->writing){
+        pthread_join(c->writer, NULL);
+        c->writing = 0;
+    }
+}
+
+void start_checkpointer(Checkpointer* c, const char* path){
+    memset(c, 0, sizeof(Checkpointer));
+    c->success = 1;
+    c->path = strdup(path);
+    c->temp_path = (char*) malloc(strlen(path) + 5);
+    sprintf(c->temp_path, "%s.tmp", path);
+
+    const char* slash = strrchr(path, '/');
+    if (slash == NULL)
+        c->directory = strdup(".");
+    else{
+        size_t length = slash == path ? 1 : (size_t) (slash - path);
+        c->directory = strndup(path, length);
+    }
+}
+
+void checkpoint_async(Checkpointer* c, Model* m){
+    double begin = seconds_now();
+    wait_for_writer(c);
+    create_optimizer_state(m); //zeros for a model that hasn't been trained yet
+
+    size_t header_bytes = model_header_bytes(m->num_layers);
+    size_t param_bytes = sizeof(float) * m->num_parameters;
+    size_t image_bytes = header_bytes + 3 * param_bytes + sizeof(CheckpointState);
+    if (image_bytes != c->image_bytes){
+        allocator_free(NULL, c->image);
+        c->image = (char*) allocator_alloc(NULL, image_bytes);
+        c->image_bytes = image_bytes;
+    }
+
+    //the parameters and both moments share one layout, so each is a single copy
+    write_model_header(m, CHECKPOINT_MAGIC, CHECKPOINT_VERSION, c->image);
+    char* dest = c->image + header_bytes;
+    memcpy(dest, m->parameters, param_bytes);
+    memcpy(dest + param_bytes, m->moments, param_bytes);
+    memcpy(dest + 2 * param_bytes, m->moments_squared, param_bytes);
+
+    CheckpointState state;
+    memset(&state, 0, sizeof(state));
+    state.progress = m->progress;
+    state.use_tuning = m->use_tuning;
+    state.tuning = m->tuning;
+    memcpy(dest + 3 * param_bytes, &state, sizeof(state));
+
+    if (pthread_create(&c->writer, NULL, writer_main, c) != 0){
+        fprintf(stderr, "ERROR: Could not start the checkpoint thread. Exiting...\n");
+        exit(-1);
+    }
+    c->writing = 1;
+    c->stall_seconds += seconds_now() - begin;
+}
+
+uint8_t stop_checkpointer(Checkpointer* c){
+    wait_for_writer(c);
+    allocator_free(NULL, c->image);
+    free(c->path);
+    free(c->temp_path);
+    free(c->directory);
+    c->image = NULL;
+    c->image_bytes = 0;
+    return c->success;
+}
+
+uint8_t save_checkpoint(Model* m, const char* path){
+    Checkpointer c;
+    start_checkpointer(&c, path);
+    checkpoint_async(&c, m);
+    return stop_checkpointer(&c);
+}
+
+Model* load_checkpoint(const char* path){
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    ModelHeader header;
+    if (fd < 0 || fstat(fd, &info) != 0 || !read_fully(fd, &header, sizeof(header), 0)){
+        fprintf(stderr, "ERROR: Could not open %s. Returning NULL...\n", path);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    //the sizes are compared so that none of them can wrap: the header, then three times the parameters, then the state
+    uint64_t file_size = (uint64_t) info.st_size;
+    uint8_t valid = memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic)) == 0 && header.version == CHECKPOINT_VERSION &&
+                    header.num_layers >= 2 && header.num_layers <= UINT8_MAX && header.header_bytes == model_header_bytes(header.num_layers) &&
+                    file_size >= header.header_bytes + sizeof(CheckpointState) &&
+                    header.param_bytes <= (file_size - header.header_bytes - sizeof(CheckpointState)) / 3 &&
+                    header.header_bytes + 3 * header.param_bytes + sizeof(CheckpointState) == file_size;
+    if (!valid){
+        fprintf(stderr, "ERROR: %s is not a checkpoint of version %d, or it is cut short. Returning NULL...\n", path, CHECKPOINT_VERSION);
+        close(fd);
+        return NULL;
+    }
+
+    char* table = (char*) malloc(header.header_bytes);
+    CheckpointState state;
+    uint64_t state_offset = header.header_bytes + 3 * header.param_bytes;
+    if (!read_fully(fd, table, header.header_bytes, 0) || !read_fully(fd, &state, sizeof(state), state_offset)){
+        fprintf(stderr, "ERROR: Could not read %s. Returning NULL...\n", path);
+        free(table);
+        close(fd);
+        return NULL;
+    }
+    //the layers have to be ones a model can be built from, with exactly the parameters that are in the file
+    const uint32_t* sizes = (const uint32_t*) (table + sizeof(header));
+    if (!check_model_layout(&header, sizes)){
+        fprintf(stderr, "ERROR: The layers of %s can't be built, or don't match its parameters. Returning NULL...\n", path);
+        free(table);
+        close(fd);
+        return NULL;
+    }
+    uint64_t checksum = checksum_words(CHECKSUM_SEED, table + sizeof(header), header.header_bytes - sizeof(header));
+
+    //built like any other model, then filled in
+    ModelParams params;
+    memset(&params, 0, sizeof(params));
+    params.learning_rate = header.learning_rate;
+    params.momentum = header.momentum;
+    params.momentum2 = header.momentum2;
+    params.epsillon = header.epsillon;
+    params.batch_size = header.batch_size;
+    Model* m = create_model(&params, state.use_tuning ? &state.tuning : NULL);
+
+    for (uint32_t i = 0; i < header.num_layers; i++)
+        add_layer(m, (int) sizes[i], i == 0 ? NONE : (Activation) sizes[header.num_layers + i - 1]);
+    set_loss_func(m, (Loss) header.loss_func);
+    free(table);
+    if (!compile_for_inference(m)){
+        fprintf(stderr, "ERROR: Could not build the model of %s. Returning NULL...\n", path);
+        delete_model(m);
+        close(fd);
+        return NULL;
+    }
+    create_optimizer_state(m);
+
+    float* buffers[3] = { m->parameters, m->moments, m->moments_squared };
+    uint8_t success = 1;
+    for (uint32_t i = 0; i < 3 && success; i++){
+        success = read_fully(fd, buffers[i], header.param_bytes, header.header_bytes + i * header.param_bytes);
+        checksum = checksum_words(checksum, buffers[i], header.param_bytes);
+    }
+    checksum = checksum_words(checksum, &state, sizeof(state));
+    close(fd);
+    if (!success || checksum != header.checksum){
+        fprintf(stderr, "ERROR: The checksum of %s doesn't match, the file is corrupted. Returning NULL...\n", path);
+        delete_model(m);
+        return NULL;
+    }
+
+    m->progress = state.progress;
+    return m;
+}
@@ -0,0 +1,63 @@
+//
+//  Checkpoint.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Checkpoint_h
+#define Checkpoint_h
+
+#include "pch.h"
+#include "Model/Model.h"
+#include <pthread.h>
+
+//a checkpoint is a model file (see ModelHeader) with its own magic, followed by Adam's two moments in the same layout as the
+//parameters and then a CheckpointState. The learning rate in the header is the one the tuning has gotten down to
+#define CHECKPOINT_MAGIC "NNCHECKP"
+#define CHECKPOINT_VERSION 1
+
+//everything train() needs to go on that isn't part of a model file
+typedef struct CheckpointState{
+    TrainingProgress progress;
+    uint32_t use_tuning;
+    LearningRateTuning tuning;
+} CheckpointState;
+
+//writes checkpoints on a background thread. The training state is copied into one buffer laid out like the file, which
+//is all the training thread waits for, and the thread writes that to a temporary file next to path, fsyncs it and renames
+//it over path. So path always holds a whole checkpoint, the old one until the new one is safely on disk
+typedef struct Checkpointer{
+    char* path;
+    char* temp_path;
+    char* directory; //fsynced after the rename, so the rename itself is on disk too
+
+    char* image; //the snapshot, reused while the model stays the same size
+    size_t image_bytes;
+
+    pthread_t writer;
+    uint8_t writing; //the writer has been started and not joined yet
+    uint8_t success; //of every checkpoint so far
+
+    //time the training thread spent on snapshots, and waiting for the checkpoint before to be written
+    double stall_seconds;
+} Checkpointer;
+
+void start_checkpointer(Checkpointer* c, const char* path);
+
+//copies the model's parameters, optimizer state and TrainingProgress, and writes them in the background.
+//if the last checkpoint is still being written, it waits for that first
+void checkpoint_async(Checkpointer* c, Model* m);
+
+//waits for the checkpoint being written, if there is one, and frees the snapshot. Returns 0 if any checkpoint failed
+uint8_t stop_checkpointer(Checkpointer* c);
+
+//writes a checkpoint and waits until it's on disk
+uint8_t save_checkpoint(Model* m, const char* path);
+
+//a model that goes on training where the checkpoint left off, with its optimizer state, tuning and shuffles. The rest of
+//its ModelParams (threads, verbosity, checkpointing...) are 0 and can be set before training it. Returns NULL if the file
+//isn't a valid checkpoint
+Model* load_checkpoint(const char* path);
+
+#endif /* Checkpoint_h */
@@ -0,0 +1,19 @@
+//
+//  Checksum.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Checksum.h"
+#include "pch.h"
+
+uint64_t checksum_words(uint64_t hash, const void* bytes, size_t num_bytes){
+    const unsigned char* p = (const unsigned char*) bytes;
+    for (size_t i = 0; i + 4 <= num_bytes; i += 4){
+        uint32_t word;
+        memcpy(&word, p + i, sizeof(word));
+        hash = (hash ^ word) * 0x100000001b3ull;
+    }
+    return hash;
+}
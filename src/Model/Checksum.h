@@ -0,0 +1,20 @@
+//
+//  Checksum.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Checksum_h
+#define Checksum_h
+
+#include "pch.h"
+
+//what a checksum starts from
+#define CHECKSUM_SEED 0xcbf29ce484222325ull
+
+//FNV-1a, a 4 byte word at a time, continuing from hash. Every part of the binary dataset and model files is a whole number of
+//floats, so a trailing partial word never counts
+uint64_t checksum_words(uint64_t hash, const void* bytes, size_t num_bytes);
+
+#endif /* Checksum_h */
@@ -0,0 +1,103 @@
+//
+//  Communicator.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Communicator.h"
+#include "Model/Allocator.h"
+#include "Model/Kernels.h"
+#include "pch.h"
+#include <sys/mman.h>
+
+#define FLOATS_PER_LINE (ALLOCATOR_ALIGNMENT / sizeof(float))
+
+Communicator create_communicator(uint32_t num_ranks, size_t capacity){
+    Communicator comm;
+    comm.num_ranks = num_ranks == 0 ? 1 : num_ranks;
+    comm.capacity = capacity;
+    comm.stride = (capacity + FLOATS_PER_LINE - 1) / FLOATS_PER_LINE * FLOATS_PER_LINE;
+
+    //the barrier gets a cache line to itself at the start, the buffers follow
+    size_t header = (sizeof(pthread_barrier_t) + ALLOCATOR_ALIGNMENT - 1) / ALLOCATOR_ALIGNMENT * ALLOCATOR_ALIGNMENT;
+    comm.shared_bytes = header + sizeof(float) * comm.stride * comm.num_ranks;
+    comm.shared = mmap(NULL, comm.shared_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (comm.shared == MAP_FAILED){
+        fprintf(stderr, "ERROR: Could not map %zu bytes of shared memory. Exiting...\n", comm.shared_bytes);
+        exit(-1);
+    }
+
+    comm.barrier = (pthread_barrier_t*) comm.shared;
+    comm.buffers = (float*) ((char*) comm.shared + header);
+
+    pthread_barrierattr_t attributes;
+    pthread_barrierattr_init(&attributes);
+    pthread_barrierattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_barrier_init(comm.barrier, &attributes, comm.num_ranks);
+    pthread_barrierattr_destroy(&attributes);
+    return comm;
+}
+
+void delete_communicator(Communicator* comm){
+    if (comm->shared == NULL)
+        return;
+    munmap(comm->shared, comm->shared_bytes);
+    comm->shared = NULL;
+    comm->barrier = NULL;
+    comm->buffers = NULL;
+}
+
+float* rank_buffer(Communicator* comm, uint32_t rank){
+    return comm->buffers + comm->stride * rank;
+}
+
+void communicator_barrier(Communicator* comm){
+    pthread_barrier_wait(comm->barrier);
+}
+
+
+
+static size_t chunk_begin(size_t n, uint32_t chunk, uint32_t num_chunks){
+    return n * chunk / num_chunks;
+}
+
+void all_reduce(Communicator* comm, uint32_t rank, size_t n, float scale){
+    uint32_t k = comm->num_ranks;
+    float* own = rank_buffer(comm, rank);
+    if (k == 1){
+        kernels.scale(own, scale, n);
+        return;
+    }
+    const float* left = rank_buffer(comm, (rank + k - 1) % k);
+
+    //everyone has to be done writing their buffer before anyone reads it
+    communicator_barrier(comm);
+
+    //reduce scatter: in step s, add the left neighbour's partial sum of chunk (rank - 1 - s) into ours. Our neighbour to the right
+    //is reading chunk (rank - s) from us at the same time, so nobody reads what someone else is writing.
+    //after k - 1 steps, chunk (rank + 1) holds the sum over every rank, and gets scaled right away
+    for (uint32_t s = 0; s + 1 < k; s++){
+        uint32_t chunk = (rank + 2 * k - 1 - s) % k;
+        size_t begin = chunk_begin(n, chunk, k), end = chunk_begin(n, chunk + 1, k);
+        kernels.add(own + begin, left + begin, end - begin);
+        if (s + 2 == k)
+            kernels.scale(own + begin, scale, end - begin);
+        communicator_barrier(comm);
+    }
+
+    //all gather: pass the finished chunks around the ring, step s copies chunk (rank - s) from the left neighbour
+    for (uint32_t s = 0; s + 1 < k; s++){
+        uint32_t chunk = (rank + k - s) % k;
+        size_t begin = chunk_begin(n, chunk, k), end = chunk_begin(n, chunk + 1, k);
+        memcpy(own + begin, left + begin, sizeof(float) * (end - begin));
+        communicator_barrier(comm);
+    }
+}
+
+void broadcast(Communicator* comm, uint32_t rank, size_t n){
+    communicator_barrier(comm);
+    if (rank != 0)
+        memcpy(rank_buffer(comm, rank), rank_buffer(comm, 0), sizeof(float) * n);
+    communicator_barrier(comm);
+}
@@ -0,0 +1,46 @@
+//
+//  Communicator.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Communicator_h
+#define Communicator_h
+
+#include "pch.h"
+#include <pthread.h>
+
+//lets the processes of train_distributed() exchange floats through shared memory. Every rank has a buffer of its own that
+//the others can read, and every collective is made by all ranks at the same time, like MPI.
+//it has to be created before fork(), so the children inherit the mapping
+typedef struct Communicator{
+    uint32_t num_ranks;
+    size_t capacity; //floats in each rank's buffer
+    size_t stride; //floats from one rank's buffer to the next, padded so two ranks never share a cache line
+
+    void* shared;
+    size_t shared_bytes;
+    pthread_barrier_t* barrier;
+    float* buffers;
+} Communicator;
+
+Communicator create_communicator(uint32_t num_ranks, size_t capacity);
+
+//every process unmaps its own view, the memory is gone once the last one did
+void delete_communicator(Communicator* comm);
+
+float* rank_buffer(Communicator* comm, uint32_t rank);
+
+//waits for every rank to get here
+void communicator_barrier(Communicator* comm);
+
+//ring all reduce of the first n floats of every rank's buffer. Afterwards each of them holds the sum of all of them times scale.
+//the data is split into one chunk per rank, and every rank only ever reads its left neighbour, so each one moves
+//2 * (num_ranks - 1) / num_ranks of the data no matter how many ranks there are
+void all_reduce(Communicator* comm, uint32_t rank, size_t n, float scale);
+
+//copies the first n floats of rank 0's buffer into every other rank's buffer
+void broadcast(Communicator* comm, uint32_t rank, size_t n);
+
+#endif /* Communicator_h */
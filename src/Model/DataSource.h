@@ -0,0 +1,42 @@
+//
+//  DataSource.h
+//  Neural Net
+//
+//
+//
+
+#ifndef DataSource_h
+#define DataSource_h
+
+#include "pch.h"
+
+//data points that are the rows of two contiguous blocks, the way a dataset (see Data Loader.h) holds them. Data point i is
+//row rows[i] of inputs and outputs, or row i if rows is NULL, so a subset or a shuffle of the rows never copies any of them
+typedef struct DataRows{
+    const float* inputs; //num_inputs floats per row
+    const float* outputs; //num_outputs floats per row
+    const uint32_t* rows;
+    uint32_t num_data_points;
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+} DataRows;
+
+//somewhere train_stream() can pull mini batches from, for data that isn't (or can't be) in memory as a Matrix* array.
+//implementations put this first in their own struct, so the functions can cast the pointer back
+typedef struct DataSource DataSource;
+struct DataSource{
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+
+    //starts an epoch over from the beginning of the data
+    void (*begin_epoch)(DataSource* source);
+
+    //writes the next (up to) max_points data points as rows of inputs (max_points x num_inputs) and outputs (max_points x num_outputs).
+    //returns how many there were, 0 once the epoch is over
+    uint32_t (*next_batch)(DataSource* source, float* inputs, float* outputs, uint32_t max_points);
+
+    //frees the source itself as well
+    void (*close)(DataSource* source);
+};
+
+#endif /* DataSource_h */
@@ -0,0 +1,48 @@
+//
+//  FileIO.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/FileIO.h"
+#include "Model/Checksum.h"
+#include "pch.h"
+#include <time.h>
+#include <unistd.h>
+
+double seconds_now(void){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+uint8_t read_fully(int fd, void* dest, size_t num_bytes, uint64_t offset){
+    char* p = (char*) dest;
+    while (num_bytes > 0){
+        ssize_t got = pread(fd, p, num_bytes, (off_t) offset);
+        if (got <= 0)
+            return 0;
+        p += got;
+        num_bytes -= (size_t) got;
+        offset += (uint64_t) got;
+    }
+    return 1;
+}
+
+uint8_t write_fully(int fd, const void* bytes, size_t num_bytes){
+    const char* p = (const char*) bytes;
+    while (num_bytes > 0){
+        ssize_t written = write(fd, p, num_bytes);
+        if (written <= 0)
+            return 0;
+        p += written;
+        num_bytes -= (size_t) written;
+    }
+    return 1;
+}
+
+uint8_t write_checksummed(FILE* f, const void* bytes, size_t num_bytes, uint64_t* checksum){
+    *checksum = checksum_words(*checksum, bytes, num_bytes);
+    return fwrite(bytes, 1, num_bytes, f) == num_bytes;
+}
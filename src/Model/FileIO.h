@@ -0,0 +1,27 @@
+//
+//  FileIO.h
+//  Neural Net
+//
+//
+//
+
+#ifndef FileIO_h
+#define FileIO_h
+
+#include "pch.h"
+
+//the small I/O helpers the dataset, model and checkpoint files and the background threads share
+
+//seconds on a monotonic clock, for measuring how long something took
+double seconds_now(void);
+
+//reads num_bytes at offset, going on after short reads. Returns 0 on an error or if the file ends first
+uint8_t read_fully(int fd, void* dest, size_t num_bytes, uint64_t offset);
+
+//writes num_bytes, going on after short writes. Returns 0 on an error
+uint8_t write_fully(int fd, const void* bytes, size_t num_bytes);
+
+//writes num_bytes and adds them to the file's checksum (see checksum_words()). Returns 0 if they weren't all written
+uint8_t write_checksummed(FILE* f, const void* bytes, size_t num_bytes, uint64_t* checksum);
+
+#endif /* FileIO_h */
@@ -0,0 +1,368 @@
+//
+//  Gemm.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Gemm.h"
+#include "Model/ThreadPool.h"
+#include "Model/Allocator.h"
+#include "pch.h"
+
+//Blocked matrix multiplication in the style of GotoBLAS / BLIS.
+//B is packed into (KC x NC) blocks that live in L3, A is packed into (MC x KC) blocks that live in L2,
+//and a register tiled micro kernel computes an (MR x NR) tile of C while streaming through L1.
+//The packed panels are laid out in exactly the order the micro kernel reads them, so every load is contiguous.
+
+#define MR 4
+#define NR 8
+#define KC 256
+#define MC 128 //multiple of MR
+#define NC 2048 //multiple of NR
+
+//products smaller than this (m * n * k) aren't worth packing for
+#define SMALL_GEMM_SIZE (32 * 32 * 32)
+//or splitting between threads
+#define PARALLEL_GEMM_SIZE (128 * 128 * 128)
+//narrowest column strip a thread gets, when the rows alone don't give every thread a block
+#define MIN_STRIP_COLS (4 * NR)
+
+//GCC vector extension. 16 bytes maps onto a single SSE or NEON register on every target we build for
+typedef float vfloat4 __attribute__((vector_size(16)));
+
+typedef struct PackBuffers{
+    float* a;
+    size_t a_capacity;
+    float* b;
+    size_t b_capacity;
+} PackBuffers;
+
+//packing buffers are reused between calls, and are per thread so kernels can run concurrently.
+//a thread waiting on its own parallel gemm can pick up other work that also packs (another gemm, or a block of one),
+//while other threads are still reading the packed B of the first one. So every gemm and every block gets its own
+//level of buffers, stacked by depth like a call stack
+static _Thread_local PackBuffers* pack_levels = NULL;
+static _Thread_local size_t num_pack_levels = 0;
+static _Thread_local size_t pack_depth = 0;
+
+
+static float* reserve_buffer(float* buffer, size_t* capacity, size_t num_floats){
+    if (num_floats <= *capacity)
+        return buffer;
+
+    free(buffer);
+    //aligned_alloc needs the size to be a multiple of the alignment
+    size_t bytes = (num_floats * sizeof(float) + 63) & ~(size_t)63;
+    buffer = (float*) aligned_alloc(64, bytes);
+    if (buffer == NULL){
+        fprintf(stderr, "ERROR: Could not allocate %zu bytes for gemm packing buffers. Exiting...\n", bytes);
+        exit(-1);
+    }
+    count_allocation();
+
+    *capacity = num_floats;
+    return buffer;
+}
+
+//returns the index of the level rather than a pointer, since a nested push can move the levels around
+static size_t push_pack_level(void){
+    if (pack_depth == num_pack_levels){
+        pack_levels = (PackBuffers*) realloc(pack_levels, sizeof(PackBuffers) * (num_pack_levels + 1));
+        if (pack_levels == NULL){
+            fprintf(stderr, "ERROR: Could not allocate gemm packing buffers. Exiting...\n");
+            exit(-1);
+        }
+        count_allocation();
+        pack_levels[num_pack_levels] = (PackBuffers){ NULL, 0, NULL, 0 };
+        num_pack_levels++;
+    }
+    return pack_depth++;
+}
+
+static void pop_pack_level(void){
+    pack_depth--;
+}
+
+void release_gemm_buffers(void){
+    for (size_t i = 0; i < num_pack_levels; i++){
+        free(pack_levels[i].a);
+        free(pack_levels[i].b);
+    }
+    free(pack_levels);
+    pack_levels = NULL;
+    num_pack_levels = 0;
+}
+
+//element (i, j) of an operand lives at [i * row_stride + j * col_stride], which covers both the transposed
+//and the untransposed layout, so the packing routines are the only place that cares about transposition
+
+//copies an (mc x kc) block of A into panels of MR rows. Each panel is stored column by column,
+//so the micro kernel reads MR consecutive floats per step of k. Rows past mc are zero padded
+static void pack_a(size_t mc, size_t kc, const float* a, size_t row_stride, size_t col_stride, float* dest){
+    for (size_t i = 0; i < mc; i += MR){
+        size_t rows = mc - i < MR ? mc - i : MR;
+        for (size_t p = 0; p < kc; p++){
+            for (size_t r = 0; r < rows; r++)
+                dest[r] = a[(i + r) * row_stride + p * col_stride];
+            for (size_t r = rows; r < MR; r++)
+                dest[r] = 0.0f;
+            dest += MR;
+        }
+    }
+}
+
+//copies a (kc x nc) block of B into panels of NR columns. Each panel is stored row by row,
+//so the micro kernel reads NR consecutive floats per step of k. Columns past nc are zero padded
+static void pack_b(size_t kc, size_t nc, const float* b, size_t row_stride, size_t col_stride, float* dest){
+    for (size_t j = 0; j < nc; j += NR){
+        size_t cols = nc - j < NR ? nc - j : NR;
+        for (size_t p = 0; p < kc; p++){
+            const float* row = b + p * row_stride + j * col_stride;
+            for (size_t c = 0; c < cols; c++)
+                dest[c] = row[c * col_stride];
+            for (size_t c = cols; c < NR; c++)
+                dest[c] = 0.0f;
+            dest += NR;
+        }
+    }
+}
+
+//computes an (MR x NR) tile of A * B entirely in registers, then writes (mr x nr) of it back to C
+static void micro_kernel(size_t kc, float alpha, const float* restrict pa, const float* restrict pb,
+                         float beta, float* c, size_t ldc, size_t mr, size_t nr){
+    vfloat4 acc[MR][2];
+    for (size_t i = 0; i < MR; i++){
+        acc[i][0] = (vfloat4){ 0 };
+        acc[i][1] = (vfloat4){ 0 };
+    }
+
+    for (size_t p = 0; p < kc; p++){
+        //packed B is 64 byte aligned and every row of a panel is NR floats, so these loads are aligned
+        vfloat4 b0 = *(const vfloat4*)(pb + 0);
+        vfloat4 b1 = *(const vfloat4*)(pb + 4);
+        for (size_t i = 0; i < MR; i++){
+            acc[i][0] += pa[i] * b0;
+            acc[i][1] += pa[i] * b1;
+        }
+        pa += MR;
+        pb += NR;
+    }
+
+    float tile[MR * NR];
+    for (size_t i = 0; i < MR; i++){
+        acc[i][0] *= alpha;
+        acc[i][1] *= alpha;
+        memcpy(tile + i * NR, &acc[i][0], sizeof(vfloat4));
+        memcpy(tile + i * NR + 4, &acc[i][1], sizeof(vfloat4));
+    }
+
+    for (size_t i = 0; i < mr; i++){
+        float* c_row = c + i * ldc;
+        if (beta == 0.0f){
+            for (size_t j = 0; j < nr; j++)
+                c_row[j] = tile[i * NR + j];
+        }
+        else{
+            for (size_t j = 0; j < nr; j++)
+                c_row[j] = tile[i * NR + j] + beta * c_row[j];
+        }
+    }
+}
+
+//row and col are the position of this block inside of C, which the epilogue (only passed on the last block along k) needs
+static void macro_kernel(size_t mc, size_t nc, size_t kc, float alpha, const float* pa, const float* pb,
+                         float beta, float* c, size_t ldc, size_t row, size_t col, const GemmEpilogue* epilogue){
+    //the B micro panel stays in L1 while we sweep over every A micro panel of the block
+    for (size_t j = 0; j < nc; j += NR){
+        size_t nr = nc - j < NR ? nc - j : NR;
+        for (size_t i = 0; i < mc; i += MR){
+            size_t mr = mc - i < MR ? mc - i : MR;
+            float* tile = c + i * ldc + j;
+            micro_kernel(kc, alpha, pa + i * kc, pb + j * kc, beta, tile, ldc, mr, nr);
+            if (epilogue != NULL)
+                epilogue->apply(tile, ldc, row + i, col + j, mr, nr, epilogue->ctx);
+        }
+    }
+}
+
+//dot product of two contiguous arrays, with vector accumulators since the compiler won't reorder a float sum on its own
+static float dot_contiguous(const float* x, const float* y, size_t n){
+    vfloat4 acc0 = { 0 };
+    vfloat4 acc1 = { 0 };
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8){
+        vfloat4 x0, x1, y0, y1;
+        memcpy(&x0, x + i, sizeof(vfloat4));
+        memcpy(&x1, x + i + 4, sizeof(vfloat4));
+        memcpy(&y0, y + i, sizeof(vfloat4));
+        memcpy(&y1, y + i + 4, sizeof(vfloat4));
+        acc0 += x0 * y0;
+        acc1 += x1 * y1;
+    }
+    
+    acc0 += acc1;
+    float sum = acc0[0] + acc0[1] + acc0[2] + acc0[3];
+    for (; i < n; i++)
+        sum += x[i] * y[i];
+    return sum;
+}
+
+//matrix-vector product (n == 1)
+static void gemv(size_t m, size_t k, float alpha,
+                 const float* a, size_t a_rs, size_t a_cs,
+                 const float* b, size_t b_rs,
+                 float beta, float* c, size_t ldc){
+    if (a_cs == 1 && b_rs == 1){
+        //rows of op(A) are contiguous, one dot product per row
+        for (size_t i = 0; i < m; i++)
+            c[i * ldc] = alpha * dot_contiguous(a + i * a_rs, b, k) + (beta == 0.0f ? 0.0f : beta * c[i * ldc]);
+        return;
+    }
+    
+    for (size_t i = 0; i < m; i++)
+        c[i * ldc] = beta == 0.0f ? 0.0f : beta * c[i * ldc];
+    
+    //otherwise op(A) is transposed, so its columns are contiguous. Accumulate a scaled column at a time
+    for (size_t p = 0; p < k; p++){
+        float b_p = alpha * b[p * b_rs];
+        const float* a_col = a + p * a_cs;
+        for (size_t i = 0; i < m; i++)
+            c[i * ldc] += a_col[i * a_rs] * b_p;
+    }
+}
+
+//straightforward i-k-j loop for tiny products, where packing costs more than it saves.
+//the innermost loop still walks rows of B and C contiguously when B isn't transposed
+static void gemm_small(size_t m, size_t n, size_t k, float alpha,
+                       const float* a, size_t a_rs, size_t a_cs,
+                       const float* b, size_t b_rs, size_t b_cs,
+                       float beta, float* c, size_t ldc, const GemmEpilogue* epilogue){
+    if (n == 1){
+        gemv(m, k, alpha, a, a_rs, a_cs, b, b_rs, beta, c, ldc);
+        if (epilogue != NULL)
+            epilogue->apply(c, ldc, 0, 0, m, 1, epilogue->ctx);
+        return;
+    }
+    
+    for (size_t i = 0; i < m; i++){
+        float* c_row = c + i * ldc;
+        const float* a_row = a + i * a_rs;
+        
+        for (size_t j = 0; j < n; j++)
+            c_row[j] = beta == 0.0f ? 0.0f : beta * c_row[j];
+        
+        for (size_t p = 0; p < k; p++){
+            float a_ip = alpha * a_row[p * a_cs];
+            const float* b_row = b + p * b_rs;
+            for (size_t j = 0; j < n; j++)
+                c_row[j] += a_ip * b_row[j * b_cs];
+        }
+        
+        //the row is finished, so it's a (1 x n) tile as far as the epilogue is concerned
+        if (epilogue != NULL)
+            epilogue->apply(c_row, ldc, i, 0, 1, n, epilogue->ctx);
+    }
+}
+
+void gemm(Transpose trans_a, Transpose trans_b, size_t m, size_t n, size_t k, float alpha,
+          const float* a, size_t lda,
+          const float* b, size_t ldb,
+          float beta, float* c, size_t ldc){
+    gemm_epilogue(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, NULL);
+}
+
+//one (kc x nc) block of packed B, shared by every thread working on it
+typedef struct GemmBlock{
+    size_t m, kc, nc;
+    size_t jc, pc; //where the block starts along n and k
+    size_t strip_cols; //columns of B each task covers
+    size_t num_strips;
+    float alpha, beta;
+    const float* a;
+    size_t a_rs, a_cs;
+    const float* packed_b;
+    float* c;
+    size_t ldc;
+    const GemmEpilogue* epilogue;
+} GemmBlock;
+
+//one (MC x strip) piece of a GemmBlock. Packs its own rows of A, then runs the macro kernel over its columns
+static void gemm_block_task(size_t index, void* ctx){
+    GemmBlock* block = (GemmBlock*) ctx;
+    size_t ic = (index / block->num_strips) * MC;
+    size_t col = (index % block->num_strips) * block->strip_cols;
+    size_t mc = block->m - ic < MC ? block->m - ic : MC;
+    size_t cols = block->nc - col < block->strip_cols ? block->nc - col : block->strip_cols;
+    
+    size_t level = push_pack_level();
+    PackBuffers* buffers = pack_levels + level;
+    buffers->a = reserve_buffer(buffers->a, &buffers->a_capacity, block->kc * ((mc + MR - 1) / MR) * MR);
+    pack_a(mc, block->kc, block->a + ic * block->a_rs + block->pc * block->a_cs, block->a_rs, block->a_cs, buffers->a);
+    //packed B is stored as panels of NR columns, kc rows each, and strips are a multiple of NR wide
+    macro_kernel(mc, cols, block->kc, block->alpha, buffers->a, block->packed_b + col * block->kc, block->beta,
+                 block->c + ic * block->ldc + block->jc + col, block->ldc, ic, block->jc + col, block->epilogue);
+    pop_pack_level();
+}
+
+void gemm_epilogue(Transpose trans_a, Transpose trans_b, size_t m, size_t n, size_t k, float alpha,
+                   const float* a, size_t lda,
+                   const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc, const GemmEpilogue* epilogue){
+
+    if (m == 0 || n == 0)
+        return;
+
+    //strides of op(A) and op(B)
+    size_t a_rs = trans_a == TRANSPOSE ? 1 : lda;
+    size_t a_cs = trans_a == TRANSPOSE ? lda : 1;
+    size_t b_rs = trans_b == TRANSPOSE ? 1 : ldb;
+    size_t b_cs = trans_b == TRANSPOSE ? ldb : 1;
+
+    if (k == 0 || m * n * k < SMALL_GEMM_SIZE || n < NR / 2){
+        gemm_small(m, n, k, alpha, a, a_rs, a_cs, b, b_rs, b_cs, beta, c, ldc, epilogue);
+        return;
+    }
+    
+    //big enough products are split into (MC x strip) tasks on the shared thread pool
+    size_t num_threads = m * n * k < PARALLEL_GEMM_SIZE ? 1 : max_threads();
+    size_t row_blocks = (m + MC - 1) / MC;
+
+    size_t nc_max = n < NC ? n : NC;
+    size_t kc_max = k < KC ? k : KC;
+    size_t level = push_pack_level();
+    pack_levels[level].b = reserve_buffer(pack_levels[level].b, &pack_levels[level].b_capacity, kc_max * ((nc_max + NR - 1) / NR) * NR);
+
+    for (size_t jc = 0; jc < n; jc += NC){
+        size_t nc = n - jc < NC ? n - jc : NC;
+        
+        //if there aren't enough row blocks for every thread, the columns are cut into strips as well
+        size_t strips_wanted = (num_threads + row_blocks - 1) / row_blocks;
+        size_t strip_cols = (nc + strips_wanted - 1) / strips_wanted;
+        strip_cols = (strip_cols + NR - 1) / NR * NR;
+        strip_cols = strip_cols < MIN_STRIP_COLS ? MIN_STRIP_COLS : strip_cols;
+
+        for (size_t pc = 0; pc < k; pc += KC){
+            size_t kc = k - pc < KC ? k - pc : KC;
+            float* packed_b = pack_levels[level].b;
+            pack_b(kc, nc, b + pc * b_rs + jc * b_cs, b_rs, b_cs, packed_b);
+
+            GemmBlock block = {
+                .m = m, .kc = kc, .nc = nc,
+                .jc = jc, .pc = pc,
+                .strip_cols = num_threads == 1 ? nc : strip_cols,
+                .alpha = alpha,
+                //only the first block along k applies the caller's beta, the rest accumulate onto it
+                .beta = pc == 0 ? beta : 1.0f,
+                .a = a, .a_rs = a_rs, .a_cs = a_cs,
+                .packed_b = packed_b,
+                .c = c, .ldc = ldc,
+                .epilogue = pc + kc == k ? epilogue : NULL,
+            };
+            block.num_strips = (nc + block.strip_cols - 1) / block.strip_cols;
+            parallel_for(row_blocks * block.num_strips, gemm_block_task, &block);
+        }
+    }
+    
+    pop_pack_level();
+}
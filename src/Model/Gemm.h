@@ -0,0 +1,44 @@
+//
+//  Gemm.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Gemm_h
+#define Gemm_h
+
+#include "pch.h"
+
+//BLAS style transposition flags. A transposed operand is read in place, never copied
+typedef enum Transpose{
+    NO_TRANSPOSE = 0,
+    TRANSPOSE,
+} Transpose;
+
+//Extra work done on every finished (rows x cols) tile of C while it's still in cache. row and col are where the tile starts in C.
+//It only ever sees final values, after every block along k has been accumulated
+typedef struct GemmEpilogue{
+    void (*apply)(float* tile, size_t ldc, size_t row, size_t col, size_t rows, size_t cols, void* ctx);
+    void* ctx;
+} GemmEpilogue;
+
+//C = alpha * op(A) * op(B) + beta * C, all matrices row major, where op(X) is X or its transpose
+//op(A) is (m x k), op(B) is (k x n) and C is (m x n). lda, ldb and ldc are the row strides of A, B and C as they are stored
+//when beta is 0, C is never read, so it can hold garbage
+void gemm(Transpose trans_a, Transpose trans_b, size_t m, size_t n, size_t k, float alpha,
+          const float* a, size_t lda,
+          const float* b, size_t ldb,
+          float beta, float* c, size_t ldc);
+
+//same as gemm(), but runs the epilogue over each tile of C as soon as it's done. Passing NULL is the same as calling gemm()
+void gemm_epilogue(Transpose trans_a, Transpose trans_b, size_t m, size_t n, size_t k, float alpha,
+                   const float* a, size_t lda,
+                   const float* b, size_t ldb,
+                   float beta, float* c, size_t ldc, const GemmEpilogue* epilogue);
+
+//frees the packing buffers of the calling thread, which every thread that ran a gemm keeps for the next one.
+//for threads that are about to exit. Can't be called from inside of a gemm
+void release_gemm_buffers(void);
+
+#endif /* Gemm_h */
@@ -0,0 +1,312 @@
+//
+//  Kernels.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Kernels.h"
+#include "Model/ThreadPool.h"
+#include "pch.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #define KERNELS_X86
+    #include <immintrin.h>
+#endif
+
+
+//Portable versions. These are the fallback on non x86 machines (where the compiler is free to
+//auto vectorize them for NEON), and they also handle the tails of the SIMD versions
+
+static void mul_scalar(float* dest, const float* src, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] *= src[i];
+}
+
+static void div_scalar(float* dest, const float* src, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] /= src[i];
+}
+
+static void add_scalar(float* dest, const float* src, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] += src[i];
+}
+
+static void sub_scalar(float* dest, const float* src, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] -= src[i];
+}
+
+static void scale_scalar(float* dest, float scalar, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] *= scalar;
+}
+
+static void shift_scalar(float* dest, float scalar, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] += scalar;
+}
+
+static void square_scalar(float* dest, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] *= dest[i];
+}
+
+static void sqrt_scalar(float* dest, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] = sqrtf(dest[i]);
+}
+
+static void reciprocal_scalar(float* dest, size_t n){
+    for (size_t i = 0; i < n; i++)
+        dest[i] = 1.0f / dest[i];
+}
+
+static float sum_squares_scalar(const float* src, size_t n){
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++)
+        sum += src[i] * src[i];
+    return sum;
+}
+
+static float adam_scalar(float* params, float* moment, float* moment2, const float* grads, size_t n, const AdamStep* step){
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; i++){
+        float g = grads[i];
+        //Mt = B1 * Mt-1 + (1 - B1)Gt
+        float m = step->momentum * moment[i] + (1.0f - step->momentum) * g;
+        //Vt = B2 * Vt-1 + (1 - B2)Gt^2
+        float v = step->momentum2 * moment2[i] + (1.0f - step->momentum2) * g * g;
+        moment[i] = m;
+        moment2[i] = v;
+        
+        //a * Mt / (Sqrt(Vt) + Epsillon), both moments bias corrected
+        float update = step->step_size * (m * step->correction) / (sqrtf(v * step->correction2) + step->epsillon);
+        params[i] -= update;
+        sum += update * update;
+    }
+    return sum;
+}
+
+
+
+#ifdef KERNELS_X86
+
+//Stamps out the whole kernel family for one instruction set. 'pre' is the intrinsic prefix (_mm, _mm256, _mm512)
+//and 'width' the number of floats in a register. Whatever doesn't fill a register is handed to the scalar version
+#define DEFINE_KERNELS(isa, target, width, vtype, pre)                                              \
+                                                                                                    \
+static target void mul_##isa(float* dest, const float* src, size_t n){                              \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_mul_ps(pre##_loadu_ps(dest + i), pre##_loadu_ps(src + i))); \
+    mul_scalar(dest + i, src + i, n - i);                                                           \
+}                                                                                                   \
+                                                                                                    \
+static target void div_##isa(float* dest, const float* src, size_t n){                              \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_div_ps(pre##_loadu_ps(dest + i), pre##_loadu_ps(src + i))); \
+    div_scalar(dest + i, src + i, n - i);                                                           \
+}                                                                                                   \
+                                                                                                    \
+static target void add_##isa(float* dest, const float* src, size_t n){                              \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_add_ps(pre##_loadu_ps(dest + i), pre##_loadu_ps(src + i))); \
+    add_scalar(dest + i, src + i, n - i);                                                           \
+}                                                                                                   \
+                                                                                                    \
+static target void sub_##isa(float* dest, const float* src, size_t n){                              \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_sub_ps(pre##_loadu_ps(dest + i), pre##_loadu_ps(src + i))); \
+    sub_scalar(dest + i, src + i, n - i);                                                           \
+}                                                                                                   \
+                                                                                                    \
+static target void scale_##isa(float* dest, float scalar, size_t n){                                \
+    vtype s = pre##_set1_ps(scalar);                                                                \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_mul_ps(pre##_loadu_ps(dest + i), s));                       \
+    scale_scalar(dest + i, scalar, n - i);                                                          \
+}                                                                                                   \
+                                                                                                    \
+static target void shift_##isa(float* dest, float scalar, size_t n){                                \
+    vtype s = pre##_set1_ps(scalar);                                                                \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_add_ps(pre##_loadu_ps(dest + i), s));                       \
+    shift_scalar(dest + i, scalar, n - i);                                                          \
+}                                                                                                   \
+                                                                                                    \
+static target void square_##isa(float* dest, size_t n){                                             \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width){                                                             \
+        vtype v = pre##_loadu_ps(dest + i);                                                         \
+        pre##_storeu_ps(dest + i, pre##_mul_ps(v, v));                                              \
+    }                                                                                               \
+    square_scalar(dest + i, n - i);                                                                 \
+}                                                                                                   \
+                                                                                                    \
+static target void sqrt_##isa(float* dest, size_t n){                                               \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_sqrt_ps(pre##_loadu_ps(dest + i)));                         \
+    sqrt_scalar(dest + i, n - i);                                                                   \
+}                                                                                                   \
+                                                                                                    \
+static target void reciprocal_##isa(float* dest, size_t n){                                         \
+    vtype one = pre##_set1_ps(1.0f);                                                                \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width)                                                              \
+        pre##_storeu_ps(dest + i, pre##_div_ps(one, pre##_loadu_ps(dest + i)));                     \
+    reciprocal_scalar(dest + i, n - i);                                                             \
+}                                                                                                   \
+                                                                                                    \
+static target float sum_squares_##isa(const float* src, size_t n){                                  \
+    /* two accumulators to hide the latency of the adds */                                          \
+    vtype acc0 = pre##_setzero_ps();                                                                \
+    vtype acc1 = pre##_setzero_ps();                                                                \
+    size_t i = 0;                                                                                   \
+    for (; i + 2 * width <= n; i += 2 * width){                                                     \
+        vtype v0 = pre##_loadu_ps(src + i);                                                         \
+        vtype v1 = pre##_loadu_ps(src + i + width);                                                 \
+        acc0 = pre##_add_ps(acc0, pre##_mul_ps(v0, v0));                                            \
+        acc1 = pre##_add_ps(acc1, pre##_mul_ps(v1, v1));                                            \
+    }                                                                                               \
+    for (; i + width <= n; i += width){                                                             \
+        vtype v0 = pre##_loadu_ps(src + i);                                                         \
+        acc0 = pre##_add_ps(acc0, pre##_mul_ps(v0, v0));                                            \
+    }                                                                                               \
+                                                                                                    \
+    float lanes[width];                                                                             \
+    pre##_storeu_ps(lanes, pre##_add_ps(acc0, acc1));                                               \
+    float sum = sum_squares_scalar(src + i, n - i);                                                 \
+    for (size_t l = 0; l < width; l++)                                                              \
+        sum += lanes[l];                                                                            \
+    return sum;                                                                                     \
+}                                                                                                   \
+                                                                                                    \
+static target float adam_##isa(float* params, float* moment, float* moment2, const float* grads,       \
+                               size_t n, const AdamStep* step){                                     \
+    vtype b1 = pre##_set1_ps(step->momentum);                                                       \
+    vtype one_minus_b1 = pre##_set1_ps(1.0f - step->momentum);                                      \
+    vtype b2 = pre##_set1_ps(step->momentum2);                                                      \
+    vtype one_minus_b2 = pre##_set1_ps(1.0f - step->momentum2);                                     \
+    vtype lr = pre##_set1_ps(step->step_size);                                                      \
+    vtype correction = pre##_set1_ps(step->correction);                                             \
+    vtype correction2 = pre##_set1_ps(step->correction2);                                           \
+    vtype eps = pre##_set1_ps(step->epsillon);                                                      \
+    vtype acc = pre##_setzero_ps();                                                                 \
+    size_t i = 0;                                                                                   \
+    for (; i + width <= n; i += width){                                                             \
+        vtype g = pre##_loadu_ps(grads + i);                                                        \
+        vtype m = pre##_add_ps(pre##_mul_ps(b1, pre##_loadu_ps(moment + i)),                        \
+                               pre##_mul_ps(one_minus_b1, g));                                      \
+        vtype v = pre##_add_ps(pre##_mul_ps(b2, pre##_loadu_ps(moment2 + i)),                       \
+                               pre##_mul_ps(one_minus_b2, pre##_mul_ps(g, g)));                     \
+        pre##_storeu_ps(moment + i, m);                                                             \
+        pre##_storeu_ps(moment2 + i, v);                                                            \
+                                                                                                    \
+        vtype denom = pre##_add_ps(pre##_sqrt_ps(pre##_mul_ps(v, correction2)), eps);               \
+        vtype update = pre##_div_ps(pre##_mul_ps(lr, pre##_mul_ps(m, correction)), denom);          \
+        pre##_storeu_ps(params + i, pre##_sub_ps(pre##_loadu_ps(params + i), update));              \
+        acc = pre##_add_ps(acc, pre##_mul_ps(update, update));                                      \
+    }                                                                                               \
+                                                                                                    \
+    float lanes[width];                                                                             \
+    pre##_storeu_ps(lanes, acc);                                                                    \
+    float sum = adam_scalar(params + i, moment + i, moment2 + i, grads + i, n - i, step);           \
+    for (size_t l = 0; l < width; l++)                                                              \
+        sum += lanes[l];                                                                            \
+    return sum;                                                                                     \
+}                                                                                                   \
+                                                                                                    \
+static const ElementwiseKernels isa##_kernels = {                                                   \
+    #isa, mul_##isa, div_##isa, add_##isa, sub_##isa, scale_##isa, shift_##isa,                     \
+    square_##isa, sqrt_##isa, reciprocal_##isa, sum_squares_##isa, adam_##isa                       \
+};
+
+DEFINE_KERNELS(sse, __attribute__((target("sse2"))), 4, __m128, _mm)
+DEFINE_KERNELS(avx2, __attribute__((target("avx2,fma"))), 8, __m256, _mm256)
+DEFINE_KERNELS(avx512, __attribute__((target("avx512f"))), 16, __m512, _mm512)
+
+#endif
+
+
+
+#define SCALAR_KERNELS {                                                                       \
+    "scalar", mul_scalar, div_scalar, add_scalar, sub_scalar, scale_scalar, shift_scalar,     \
+    square_scalar, sqrt_scalar, reciprocal_scalar, sum_squares_scalar, adam_scalar            \
+}
+
+static const ElementwiseKernels scalar_kernels = SCALAR_KERNELS;
+
+//starts out as the scalar table so it's always safe to call, even before select_kernels() has run
+ElementwiseKernels kernels = SCALAR_KERNELS;
+
+const ElementwiseKernels* find_kernels(const char* name){
+    if (strcmp(name, "scalar") == 0)
+        return &scalar_kernels;
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f"))
+        return &avx512_kernels;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return &avx2_kernels;
+    if (strcmp(name, "sse") == 0 && __builtin_cpu_supports("sse2"))
+        return &sse_kernels;
+#endif
+    return NULL;
+}
+
+//runs before main(), and picks the widest instruction set the cpu supports
+__attribute__((constructor)) static void select_kernels(void){
+    const char* widest_first[] = { "avx512", "avx2", "sse" };
+    for (size_t i = 0; i < sizeof(widest_first) / sizeof(widest_first[0]); i++){
+        const ElementwiseKernels* table = find_kernels(widest_first[i]);
+        if (table != NULL){
+            kernels = *table;
+            return;
+        }
+    }
+}
+
+
+
+//the kernel and its arguments, for running it on one chunk of the array at a time. Only one of the kernels is set
+typedef struct KernelJob{
+    float* dest;
+    const float* src;
+    float scalar;
+    void (*binary)(float* dest, const float* src, size_t n);
+    void (*with_scalar)(float* dest, float scalar, size_t n);
+    void (*unary)(float* dest, size_t n);
+} KernelJob;
+
+static void kernel_range(size_t begin, size_t end, void* ctx){
+    KernelJob* job = (KernelJob*) ctx;
+    if (job->binary != NULL)
+        job->binary(job->dest + begin, job->src + begin, end - begin);
+    else if (job->with_scalar != NULL)
+        job->with_scalar(job->dest + begin, job->scalar, end - begin);
+    else
+        job->unary(job->dest + begin, end - begin);
+}
+
+void parallel_binary(void (*kernel)(float* dest, const float* src, size_t n), float* dest, const float* src, size_t n){
+    KernelJob job = { .dest = dest, .src = src, .binary = kernel };
+    parallel_range(n, PARALLEL_ELEMENTWISE_SIZE, kernel_range, &job);
+}
+
+void parallel_scalar(void (*kernel)(float* dest, float scalar, size_t n), float* dest, float scalar, size_t n){
+    KernelJob job = { .dest = dest, .scalar = scalar, .with_scalar = kernel };
+    parallel_range(n, PARALLEL_ELEMENTWISE_SIZE, kernel_range, &job);
+}
+
+void parallel_unary(void (*kernel)(float* dest, size_t n), float* dest, size_t n){
+    KernelJob job = { .dest = dest, .unary = kernel };
+    parallel_range(n, PARALLEL_ELEMENTWISE_SIZE, kernel_range, &job);
+}
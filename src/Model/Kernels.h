@@ -0,0 +1,68 @@
+//
+//  Kernels.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Kernels_h
+#define Kernels_h
+
+#include "pch.h"
+
+//hyper parameters of a single Adam step. The step size and bias corrections are worked out once per step by the caller
+typedef struct AdamStep{
+    float step_size;
+    float momentum;
+    float momentum2;
+    float epsillon;
+    float correction; //bias correction of the first moment
+    float correction2; //bias correction of the second moment
+} AdamStep;
+
+//Element wise kernels over flat float arrays. Every Matrix routine that touches all of its values goes through these.
+//There is one implementation per instruction set (scalar, SSE, AVX2, AVX-512), and the best one the cpu
+//supports is picked once at startup, so the same binary runs everywhere
+typedef struct ElementwiseKernels{
+    const char* name;
+
+    //dest[i] = dest[i] (op) src[i]
+    void (*mul)(float* dest, const float* src, size_t n);
+    void (*div)(float* dest, const float* src, size_t n);
+    void (*add)(float* dest, const float* src, size_t n);
+    void (*sub)(float* dest, const float* src, size_t n);
+
+    //dest[i] = dest[i] (op) scalar
+    void (*scale)(float* dest, float scalar, size_t n);
+    void (*shift)(float* dest, float scalar, size_t n);
+
+    //dest[i] = f(dest[i])
+    void (*square)(float* dest, size_t n);
+    void (*sqrt)(float* dest, size_t n);
+    void (*reciprocal)(float* dest, size_t n);
+
+    //sum of src[i]^2
+    float (*sum_squares)(const float* src, size_t n);
+
+    //one fused Adam step. Reads each gradient once, updates both moments and the parameters in place,
+    //and returns the sum of the squared updates
+    float (*adam)(float* params, float* moment, float* moment2, const float* grads, size_t n, const AdamStep* step);
+} ElementwiseKernels;
+
+//the kernel table chosen for this machine
+extern ElementwiseKernels kernels;
+
+//the table of one instruction set by name ("scalar", "sse", "avx2" or "avx512"), or NULL if it wasn't built in or the cpu
+//doesn't support it. For comparing them against each other, everything else should go through kernels
+const ElementwiseKernels* find_kernels(const char* name);
+
+//arrays at least this big have their element wise kernels split between threads, the same size as an Adam update
+#define PARALLEL_ELEMENTWISE_SIZE (1 << 16)
+
+//run one of the kernels above on dest, split between the threads of max_threads() once n reaches PARALLEL_ELEMENTWISE_SIZE.
+//every element is computed the same way either way, so the results don't depend on the number of threads
+void parallel_binary(void (*kernel)(float* dest, const float* src, size_t n), float* dest, const float* src, size_t n);
+void parallel_scalar(void (*kernel)(float* dest, float scalar, size_t n), float* dest, float scalar, size_t n);
+void parallel_unary(void (*kernel)(float* dest, size_t n), float* dest, size_t n);
+
+#endif /* Kernels_h */
@@ -0,0 +1,112 @@
+//
+//  Layer.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Layer.h"
+#include "pch.h"
+
+//same clipping as in Activations.c
+#define CLIP_RANGE 15
+
+typedef struct LayerEpilogue{
+    const float* biases;
+    float* pre_activation;
+    size_t ld; //row stride of the pre activation matrix
+} LayerEpilogue;
+
+inline static float clamp(float x, float lower, float upper){
+    float a = x < upper ? x : upper;
+    float b = a > lower ? a : lower;
+    return b;
+}
+
+//one epilogue per activation function. 'x' is the biased output of the layer, 'expr' turns it into the activated output.
+//the pre activation store is hoisted out of the inner loop so both versions of the loop stay vectorizable
+#define DEFINE_LAYER_EPILOGUE(name, expr)                                                                   \
+static void name(float* tile, size_t ldc, size_t row, size_t col, size_t rows, size_t cols, void* ctx){    \
+    LayerEpilogue* layer = (LayerEpilogue*) ctx;                                                            \
+    for (size_t r = 0; r < rows; r++){                                                                      \
+        float bias = layer->biases[row + r];                                                                \
+        float* out = tile + r * ldc;                                                                        \
+        if (layer->pre_activation != NULL){                                                                 \
+            float* pre = layer->pre_activation + (row + r) * layer->ld + col;                               \
+            for (size_t c = 0; c < cols; c++){                                                              \
+                float x = out[c] + bias;                                                                    \
+                pre[c] = x;                                                                                 \
+                out[c] = expr;                                                                              \
+            }                                                                                               \
+        }                                                                                                   \
+        else{                                                                                               \
+            for (size_t c = 0; c < cols; c++){                                                              \
+                float x = out[c] + bias;                                                                    \
+                out[c] = expr;                                                                              \
+            }                                                                                               \
+        }                                                                                                   \
+    }                                                                                                       \
+}
+
+DEFINE_LAYER_EPILOGUE(relu_epilogue, x > 0.0f ? x : 0.0f)
+DEFINE_LAYER_EPILOGUE(leaky_relu_epilogue, x < 0.0f ? 0.01f * x : x)
+DEFINE_LAYER_EPILOGUE(sigmoid_epilogue, 1.0f / (1.0f + expf(-clamp(x, -CLIP_RANGE, CLIP_RANGE))))
+DEFINE_LAYER_EPILOGUE(hyperbolic_tangent_epilogue, tanhf(clamp(x, -CLIP_RANGE, CLIP_RANGE)))
+DEFINE_LAYER_EPILOGUE(soft_plus_epilogue, logf(1.0f + expf(clamp(x, -CLIP_RANGE, CLIP_RANGE))))
+//linear layers and softmax layers only need the bias. Softmax depends on the entire output vector, so it's done after the gemm
+DEFINE_LAYER_EPILOGUE(bias_epilogue, x)
+
+
+void layer_forward(Matrix* weights, Matrix* x, Matrix* biases, Activation act, Matrix* pre_activation, Matrix* out){
+    layer_forward_trans(weights, x, NO_TRANSPOSE, biases, act, pre_activation, out);
+}
+
+void layer_forward_trans(Matrix* weights, Matrix* x, Transpose trans_x, Matrix* biases, Activation act, Matrix* pre_activation, Matrix* out){
+    //dimensions of op(x)
+    size_t x_rows = trans_x == TRANSPOSE ? x->cols : x->rows;
+    size_t x_cols = trans_x == TRANSPOSE ? x->rows : x->cols;
+    if (weights->cols != x_rows || out->rows != weights->rows || out->cols != x_cols){
+        fprintf(stderr, "ERROR: Matrix dimensions unfit for the forward pass of a layer. Exiting...\n");
+        exit(-1);
+    }
+    
+    LayerEpilogue layer = {
+        .biases = biases->values,
+        .pre_activation = pre_activation == NULL ? NULL : pre_activation->values,
+        .ld = out->cols,
+    };
+    
+    GemmEpilogue epilogue = { .ctx = &layer };
+    switch (act){
+        case RELU:
+            epilogue.apply = relu_epilogue;
+            break;
+        case LEAKY_RELU:
+            epilogue.apply = leaky_relu_epilogue;
+            break;
+        case SIGMOID:
+            epilogue.apply = sigmoid_epilogue;
+            break;
+        case HYPERBOLIC_TANGENT:
+            epilogue.apply = hyperbolic_tangent_epilogue;
+            break;
+        case SOFT_PLUS:
+            epilogue.apply = soft_plus_epilogue;
+            break;
+        case SOFT_MAX:
+        case LINEAR:
+            epilogue.apply = bias_epilogue;
+            break;
+        default:
+            fprintf(stderr, "ERROR: Invalid activation function of %d. Exiting...\n", act);
+            exit(-1);
+    }
+    
+    gemm_epilogue(NO_TRANSPOSE, trans_x, weights->rows, x_cols, weights->cols, 1.0f,
+                  weights->values, weights->cols,
+                  x->values, x->cols,
+                  0.0f, out->values, out->cols, &epilogue);
+    
+    if (act == SOFT_MAX)
+        softmax(out);
+}
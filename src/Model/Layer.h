@@ -0,0 +1,23 @@
+//
+//  Layer.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Layer_h
+#define Layer_h
+
+#include "Model/Matrix.h"
+#include "Model/Activations.h"
+
+//fused forward pass of a single layer: out = act(weights * x + biases)
+//weights * x + biases (the raw output before the activation) is also written to pre_activation, unless it's NULL
+//the bias and activation are applied inside the gemm epilogue while each tile is still in cache, so the output is only written once
+//x can hold several column vectors (one per data point), the biases are added to each of them
+void layer_forward(Matrix* weights, Matrix* x, Matrix* biases, Activation act, Matrix* pre_activation, Matrix* out);
+
+//same as layer_forward(), but with op(x) in place of x. A transposed x holds one data point per row, and is read in place
+void layer_forward_trans(Matrix* weights, Matrix* x, Transpose trans_x, Matrix* biases, Activation act, Matrix* pre_activation, Matrix* out);
+
+#endif /* Layer_h */
@@ -13,16 +13,23 @@ float least_squares(Matrix* pred, Matrix* observ){
     for (size_t i = 0; i < pred->rows * pred->cols; i++){
         sum += powf(observ->values[i] - pred->values[i], 2.0f);
     }
-    return sum / (pred->rows * pred->cols);
+    //mean over the outputs of a data point, summed over the data points (columns)
+    return sum / pred->rows;
             
 }
 
 
-Matrix least_squares_deriv(Matrix* pred, Matrix* observ){
-    Matrix m = create_matrix(pred->rows, pred->cols);
+//the *_into versions write the derivative into an existing matrix the size of pred
+
+static void least_squares_deriv_into(Matrix* pred, Matrix* observ, Matrix* m){
     for (size_t i = 0; i < pred->rows * pred->cols; i++){
-        m.values[i] = -2.0f * (observ->values[i] - pred->values[i]);
+        m->values[i] = -2.0f * (observ->values[i] - pred->values[i]);
     }
+}
+
+Matrix least_squares_deriv(Matrix* pred, Matrix* observ){
+    Matrix m = create_matrix(pred->rows, pred->cols);
+    least_squares_deriv_into(pred, observ, &m);
     return m;
 }
 
@@ -34,37 +41,57 @@ float cross_entropy(Matrix* pred, Matrix* observ){
          //have an observed value of 0, cancelling out the log
          sum += observ->values[i] * -log(pred->values[i] + 0.00001f);
     }
-    return sum / (pred->cols * pred->rows);
+    //mean over the outputs of a data point, summed over the data points (columns)
+    return sum / pred->rows;
 }
 
-Matrix cross_entropy_deriv(Matrix* pred, Matrix* observ){
-    Matrix m = create_matrix(pred->rows, pred->cols); //Vector
-
-    for (size_t i = 0; i < pred->rows * pred->cols; i++){
-       if (observ->values[i] == 1.0f){ 
-            set_values_with(&m, - 1.0f / (pred->values[i] + 0.000001f)); 
-            break;
-       }
+static void cross_entropy_deriv_into(Matrix* pred, Matrix* observ, Matrix* m){
+    set_values_with(m, 0.0f);
+
+    //each column is a data point with its own one hot encoded observation
+    for (size_t c = 0; c < pred->cols; c++){
+        for (size_t r = 0; r < pred->rows; r++){
+           size_t i = r * pred->cols + c;
+           if (observ->values[i] == 1.0f){ 
+                float deriv = - 1.0f / (pred->values[i] + 0.000001f);
+                for (size_t j = 0; j < pred->rows; j++)
+                    m->values[j * pred->cols + c] = deriv;
+                break;
+           }
+        }
     }
+}
 
+Matrix cross_entropy_deriv(Matrix* pred, Matrix* observ){
+    Matrix m = create_matrix(pred->rows, pred->cols);
+    cross_entropy_deriv_into(pred, observ, &m);
     return m;
 }
 
 float bin_cross_entropy(Matrix* pred, Matrix* observ){
-    //OBSERV and PRED vector should be size 1
-    float o = observ->values[0];
-    float p = pred->values[0];
+    //OBSERV and PRED should have a single row, one column per data point
     float epsillon = 0.00001f;
-    float loss = o * -log(p + epsillon) + (1.0f - o) * -log(1.0f - p + epsillon);
+    float loss = 0.0f;
+    for (size_t i = 0; i < pred->rows * pred->cols; i++){
+        float o = observ->values[i];
+        float p = pred->values[i];
+        loss += o * -log(p + epsillon) + (1.0f - o) * -log(1.0f - p + epsillon);
+    }
     return loss;
 }
 
-Matrix bin_cross_entropy_deriv(Matrix* pred, Matrix* observ){
-    Matrix m = create_matrix(pred->rows, pred->cols); //Vector
-    float o = observ->values[0];
-    float p = pred->values[0];
+static void bin_cross_entropy_deriv_into(Matrix* pred, Matrix* observ, Matrix* m){
     float epsillon = 0.00001f;
-    m.values[0] = -o / (p + epsillon) + (1.0f - o) / (1.0f - p + epsillon);
+    for (size_t i = 0; i < pred->rows * pred->cols; i++){
+        float o = observ->values[i];
+        float p = pred->values[i];
+        m->values[i] = -o / (p + epsillon) + (1.0f - o) / (1.0f - p + epsillon);
+    }
+}
+
+Matrix bin_cross_entropy_deriv(Matrix* pred, Matrix* observ){
+    Matrix m = create_matrix(pred->rows, pred->cols);
+    bin_cross_entropy_deriv_into(pred, observ, &m);
     return m;
 }
 
@@ -99,4 +126,19 @@ Matrix loss_func_deriv(Matrix* pred, Matrix* observ, Loss loss){
 }
 
 
-
+void loss_func_deriv_into(Matrix* pred, Matrix* observ, Loss loss, Matrix* dest){
+    switch (loss){
+        case LEAST_SQUARES:
+            least_squares_deriv_into(pred, observ, dest);
+            return;
+        case CROSS_ENTROPY:
+            cross_entropy_deriv_into(pred, observ, dest);
+            return;
+        case BINARY_CROSS_ENTROPY:
+            bin_cross_entropy_deriv_into(pred, observ, dest);
+            return;
+        default:
+            fprintf(stderr, "ERROR: Unkown loss function of %d in loss_func_deriv_into() dispatch function. Exiting...\n", loss);
+            exit(-1);
+    }
+}
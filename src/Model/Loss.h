@@ -16,7 +16,7 @@ typedef enum Loss{
     BINARY_CROSS_ENTROPY
 } Loss;
 
-//inputs are column vectors
+//inputs hold one column vector per data point. The loss functions return the loss summed over the data points
 float least_squares(Matrix* pred, Matrix* observ);
 Matrix least_squares_deriv(Matrix* pred, Matrix* observ);
 
@@ -29,5 +29,7 @@ Matrix bin_cross_entropy_deriv(Matrix* pred, Matrix* observ);
 
 float loss_func(Matrix* pred, Matrix* observ, Loss loss);
 Matrix loss_func_deriv(Matrix* pred, Matrix* observ, Loss loss);
+//writes the derivative into dest (same size as pred) instead of allocating a new matrix
+void loss_func_deriv_into(Matrix* pred, Matrix* observ, Loss loss, Matrix* dest);
 
 #endif /* Loss_h */
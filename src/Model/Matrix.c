@@ -6,22 +6,39 @@
 //
 
 #include "Model/Matrix.h"
+#include "Model/Gemm.h"
+#include "Model/Kernels.h"
 #include "pch.h"
 
+//per thread, so a worker scoping its temporaries to an arena doesn't affect anyone else
+static _Thread_local Allocator* current_allocator = NULL;
+
 //returning by value simply copys the address of the pointer, so no memory leak
-Matrix create_matrix(uint16_t rows, uint16_t cols){
+Matrix create_matrix(size_t rows, size_t cols){
+    return create_matrix_with(rows, cols, current_allocator);
+}
+
+Matrix create_matrix_with(size_t rows, size_t cols, Allocator* allocator){
     Matrix mat;
     mat.rows = rows;
     mat.cols = cols;
-    mat.values = (float*) calloc(rows * cols, sizeof(float));
+    mat.values = (float*) allocator_alloc(allocator, rows * cols * sizeof(float));
+    mat.allocator = allocator;
     return mat;
 }
 
-Matrix create_matrix_from_values(uint16_t rows, uint16_t cols, float* values){
+Allocator* use_allocator(Allocator* allocator){
+    Allocator* previous = current_allocator;
+    current_allocator = allocator;
+    return previous;
+}
+
+Matrix create_matrix_from_values(size_t rows, size_t cols, float* values){
     Matrix mat;
     mat.rows = rows;
     mat.cols = cols;
     mat.values = values;
+    mat.allocator = NULL;
     return mat;
 }
 
@@ -32,16 +49,18 @@ void set_values_with(Matrix* mat, float val){
 }
 
 void delete_matrix(Matrix* mat){
-    free(mat->values);
+    allocator_free(mat->allocator, mat->values);
+    mat->values = NULL;
 }
 
 void move_matrix(Matrix* from, Matrix* to){
     if (to->values != NULL)
-        free(to->values);
+        delete_matrix(to);
     
     to->values = from->values;
     to->rows = from->rows;
     to->cols = from->cols;
+    to->allocator = from->allocator;
     from->values = NULL;
 }
 
@@ -57,8 +76,8 @@ Matrix transpose(Matrix* mat){
     
     for (size_t r = 0; r < mat->rows; ++r){
         for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index_1 = r * mat->cols + c;
-            uint16_t index_2 = c * mat->rows + r;
+            size_t index_1 = r * mat->cols + c;
+            size_t index_2 = c * mat->rows + r;
             trans.values[index_2] = mat->values[index_1];
         }
     }
@@ -74,14 +93,8 @@ Matrix dot(Matrix* mat_one, Matrix* mat_two){
         return create_matrix(0, 0);
     }
     
-    Matrix new_mat = create_matrix(mat_one->rows, mat_one->cols);
-    
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            *(new_mat.values + index) = (*(mat_one->values + index)) * (*(mat_two->values + index));
-        }
-    }
+    Matrix new_mat = matrix_copy(mat_one);
+    parallel_binary(kernels.mul, new_mat.values, mat_two->values, size(mat_one));
     return new_mat;
 }
 
@@ -91,40 +104,41 @@ Matrix matrix_div(Matrix* mat_one, Matrix* mat_two){
         return create_matrix(0, 0);
     }
     
-    Matrix new_mat = create_matrix(mat_one->rows, mat_one->cols);
-    
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            new_mat.values[index] = mat_one->values[index] / mat_two->values[index];
-        }
-    }
+    Matrix new_mat = matrix_copy(mat_one);
+    parallel_binary(kernels.div, new_mat.values, mat_two->values, size(mat_one));
     return new_mat;
 }
 
 Matrix mult(Matrix* mat_one, Matrix* mat_two){
-    if (mat_one->cols != mat_two->rows){
-        fprintf(stderr, "ERROR: Matrix dimensions unfit for multiplication. Returning 0-sized matrix...");
-        exit(-1);
-    }
+    return mult_trans(mat_one, NO_TRANSPOSE, mat_two, NO_TRANSPOSE);
+}
+
+Matrix mult_trans(Matrix* mat_one, Transpose trans_one, Matrix* mat_two, Transpose trans_two){
+    size_t rows = trans_one == TRANSPOSE ? mat_one->cols : mat_one->rows;
+    size_t cols = trans_two == TRANSPOSE ? mat_two->rows : mat_two->cols;
     
-    Matrix new_mat = create_matrix(mat_one->rows, mat_two->cols);
-    for (size_t r = 0; r < mat_one->rows; ++r){
-            for (size_t step = 0; step < mat_two->cols; ++step){
-                
-                
-                float sum = 0.0f;
-                for (size_t c = 0; c < mat_one->cols; ++c){
-                    size_t index_first = r * mat_one->cols + c;
-                    size_t index_second = c * mat_two->cols + step;
-                    sum += (*(mat_one->values + index_first)) * (*(mat_two->values + index_second));
-                }
-                size_t index = r * mat_two->cols + step;
-                *(new_mat.values +  index) = sum;
-            }
-    }
+    Matrix new_mat = create_matrix(rows, cols);
+    mult_trans_into(&new_mat, mat_one, trans_one, mat_two, trans_two, 1.0f);
     return new_mat;
+}
+
+void mult_trans_into(Matrix* dest, Matrix* mat_one, Transpose trans_one, Matrix* mat_two, Transpose trans_two, float scalar){
+    //dimensions of op(mat_one) and op(mat_two)
+    size_t rows_one = trans_one == TRANSPOSE ? mat_one->cols : mat_one->rows;
+    size_t cols_one = trans_one == TRANSPOSE ? mat_one->rows : mat_one->cols;
+    size_t rows_two = trans_two == TRANSPOSE ? mat_two->cols : mat_two->rows;
+    size_t cols_two = trans_two == TRANSPOSE ? mat_two->rows : mat_two->cols;
+    
+    if (cols_one != rows_two || dest->rows != rows_one || dest->cols != cols_two){
+        fprintf(stderr, "ERROR: Matrix dimensions unfit for multiplication. Exiting...\n");
+        exit(-1);
+    }
     
+    //blocked and packed multiplication, see Gemm.c
+    gemm(trans_one, trans_two, rows_one, cols_two, cols_one, scalar,
+         mat_one->values, mat_one->cols,
+         mat_two->values, mat_two->cols,
+         0.0f, dest->values, dest->cols);
 }
 
 Matrix add(Matrix* mat_one, Matrix* mat_two){
@@ -133,13 +147,8 @@ Matrix add(Matrix* mat_one, Matrix* mat_two){
         return create_matrix(0, 0);
     }
     
-    Matrix new_mat = create_matrix(mat_one->rows, mat_one->cols);
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            *(new_mat.values + index) = (*(mat_one->values + index)) + (*(mat_two->values + index));
-        }
-    }
+    Matrix new_mat = matrix_copy(mat_one);
+    parallel_binary(kernels.add, new_mat.values, mat_two->values, size(mat_one));
     return new_mat;
 }
 
@@ -149,13 +158,8 @@ Matrix sub(Matrix* mat_one, Matrix* mat_two){
         return create_matrix(0, 0);
     }
     
-    Matrix new_mat = create_matrix(mat_one->rows, mat_one->cols);
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            *(new_mat.values + index) = (*(mat_one->values + index)) - (*(mat_two->values + index));
-        }
-    }
+    Matrix new_mat = matrix_copy(mat_one);
+    parallel_binary(kernels.sub, new_mat.values, mat_two->values, size(mat_one));
     return new_mat;
 }
 
@@ -173,12 +177,7 @@ void dot_in_place(Matrix* mat_one, Matrix* mat_two){
         fprintf(stderr, "ERROR: Matrix dimensions unfit for element wise multiplication (in place). Returning...");
         return;
     };
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            mat_one->values[index] *= mat_two->values[index];
-        }
-    }
+    parallel_binary(kernels.mul, mat_one->values, mat_two->values, size(mat_one));
 }
 
 void div_in_place(Matrix* mat_one, Matrix* mat_two){
@@ -186,12 +185,7 @@ void div_in_place(Matrix* mat_one, Matrix* mat_two){
         fprintf(stderr, "ERROR: Matrix dimensions unfit for element wise multiplication (in place). Returning...");
         return;
     };
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            mat_one->values[index] /= mat_two->values[index];
-        }
-    }
+    parallel_binary(kernels.div, mat_one->values, mat_two->values, size(mat_one));
 }
 
 void add_in_place(Matrix* mat_one, Matrix* mat_two){
@@ -200,12 +194,7 @@ void add_in_place(Matrix* mat_one, Matrix* mat_two){
         return;
     }
     
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            mat_one->values[index] += mat_two->values[index];
-        }
-    }
+    parallel_binary(kernels.add, mat_one->values, mat_two->values, size(mat_one));
 }
 
 void sub_in_place(Matrix* mat_one, Matrix* mat_two){
@@ -214,12 +203,7 @@ void sub_in_place(Matrix* mat_one, Matrix* mat_two){
         return;
     }
     
-    for (size_t r = 0; r < mat_one->rows; ++r){
-        for (size_t c = 0; c < mat_one->cols; ++c){
-            uint16_t index = r * mat_one->cols + c;
-            mat_one->values[index] -= mat_two->values[index];
-        }
-    }
+    parallel_binary(kernels.sub, mat_one->values, mat_two->values, size(mat_one));
 }
 
 
@@ -230,30 +214,15 @@ void sub_in_place(Matrix* mat_one, Matrix* mat_two){
 
 
 void scalar_mult(Matrix* mat, float scalar){
-    for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mat->values[index] *= scalar;
-        }
-    }
+    parallel_scalar(kernels.scale, mat->values, scalar, size(mat));
 }
 
 void scalar_div(Matrix* mat, float scalar){
-    for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mat->values[index] /= scalar;
-        }
-    }
+    parallel_scalar(kernels.scale, mat->values, 1.0f / scalar, size(mat));
 }
 
 void scalar_add(Matrix* mat, float scalar){
-    for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mat->values[index] += scalar;
-        }
-    }
+    parallel_scalar(kernels.shift, mat->values, scalar, size(mat));
 }
 
 
@@ -265,41 +234,33 @@ void scalar_add(Matrix* mat, float scalar){
 
 
 void matrix_square(Matrix* mat){
-    for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mat->values[index] *= mat->values[index];
-        }
-    }
+    parallel_unary(kernels.square, mat->values, size(mat));
 }
 
 void matrix_sqrt(Matrix* mat){
-    for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mat->values[index] = sqrtf(mat->values[index]);
-        }
-    }
+    parallel_unary(kernels.sqrt, mat->values, size(mat));
 }
 
 float magnitude(Matrix* mat){
-    float mag = 0.0f;
+    return kernels.sum_squares(mat->values, size(mat));
+}
+
+void sum_columns(Matrix* mat, Matrix* dest, float scalar){
+    if (dest->rows != mat->rows){
+        fprintf(stderr, "ERROR: Matrix dimensions unfit for summing columns. Returning...");
+        return;
+    }
+    
     for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mag += mat->values[index] * mat->values[index];
-        }
+        float sum = 0.0f;
+        for (size_t c = 0; c < mat->cols; ++c)
+            sum += mat->values[r * mat->cols + c];
+        dest->values[r] = scalar * sum;
     }
-    return mag;
 }
 
 void reciprocal(Matrix* mat){
-    for (size_t r = 0; r < mat->rows; ++r){
-        for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
-            mat->values[index] = 1.0f / mat->values[index];
-        }
-    }
+    parallel_unary(kernels.reciprocal, mat->values, size(mat));
 }
 
 
@@ -314,7 +275,7 @@ void print_matrix(Matrix* mat){
     for (size_t r = 0; r < mat->rows; ++r){
         printf("[");
         for (size_t c = 0; c < mat->cols; ++c){
-            uint16_t index = r * mat->cols + c;
+            size_t index = r * mat->cols + c;
             printf("%.6f", *(mat->values + index));
             
             if (c != mat->cols - 1)
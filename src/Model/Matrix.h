@@ -8,6 +8,9 @@
 #ifndef Matrix_h
 #define Matrix_h
 
+#include "Model/Gemm.h"
+#include "Model/Allocator.h"
+
 
 
 
@@ -15,17 +18,24 @@ typedef struct Matrix{
     size_t rows;
     size_t cols;
     float* values;
+    Allocator* allocator; //where values came from. NULL is the heap
 } Matrix;
 
 
-Matrix create_matrix(uint16_t rows, uint16_t cols);
+//allocates from the allocator set with use_allocator() (the heap by default)
+Matrix create_matrix(size_t rows, size_t cols);
+
+Matrix create_matrix_with(size_t rows, size_t cols, Allocator* allocator);
 
-Matrix create_matrix_from_values(uint16_t rows, uint16_t cols, float* values);
+Matrix create_matrix_from_values(size_t rows, size_t cols, float* values);
 
 void set_values_with(Matrix* mat, float val); //fills matrix with a value
 
 void delete_matrix(Matrix* mat);
 
+//makes create_matrix() allocate from allocator on this thread (NULL for the heap), and returns the previous one so it can be restored
+Allocator* use_allocator(Allocator* allocator);
+
 void move_matrix(Matrix* from, Matrix* to); //like std::move()
 
 Matrix matrix_copy(Matrix* mat);
@@ -39,6 +49,12 @@ Matrix matrix_div(Matrix* mat_one, Matrix* mat_two); //element wise division. Na
 
 Matrix mult(Matrix* mat_one, Matrix* mat_two);
 
+//op(mat_one) * op(mat_two), where op() optionally transposes. The inputs are read in place, nothing is copied
+Matrix mult_trans(Matrix* mat_one, Transpose trans_one, Matrix* mat_two, Transpose trans_two);
+
+//dest = scalar * op(mat_one) * op(mat_two), written into an existing matrix of the right size
+void mult_trans_into(Matrix* dest, Matrix* mat_one, Transpose trans_one, Matrix* mat_two, Transpose trans_two, float scalar);
+
 Matrix add(Matrix* mat_one, Matrix* mat_two);
 
 Matrix sub(Matrix* mat_one, Matrix* mat_two);
@@ -80,6 +96,9 @@ void matrix_sqrt(Matrix* mat);
 
 float magnitude(Matrix* mat);
 
+//dest = scalar * (the sum of the columns of mat), where dest is a column vector
+void sum_columns(Matrix* mat, Matrix* dest, float scalar);
+
 void reciprocal(Matrix* mat);
 
 
@@ -6,10 +6,81 @@
 //
 
 #include "Model/Model.h"
+#include "Model/Layer.h"
+#include "Model/Checksum.h"
+#include "Model/FileIO.h"
 #include "pch.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//a model without any layers or parameters yet. Everything that isn't set here starts out zeroed
+static Model* allocate_model(void){
+    Model* m = (Model*) calloc(1, sizeof(Model));
+    m->pool = create_pool();
+    m->step_arena = create_arena(0);
+    return m;
+}
+
+//floats a parameter matrix of n values takes up in the parameter buffer, padded so the next one starts on a cache line
+static size_t padded_floats(size_t n){
+    size_t floats_per_line = ALLOCATOR_ALIGNMENT / sizeof(float);
+    return (n + floats_per_line - 1) / floats_per_line * floats_per_line;
+}
+
+//floats in the parameter buffer of the model's layers, padding included
+static size_t count_parameters(Model* m){
+    size_t floats = 0;
+    for (size_t i = 0; i + 1 < m->num_layers; i++){
+        size_t rows = get(&m->layer_sizes, i + 1);
+        floats += padded_floats(rows * get(&m->layer_sizes, i)) + padded_floats(rows);
+    }
+    return floats;
+}
+
+//a buffer laid out like the parameters. allocator_alloc() zeroes it, so the padding is zero too
+static float* create_parameter_buffer(Model* m){
+    return (float*) allocator_alloc(&m->pool, sizeof(float) * (m->num_parameters == 0 ? 1 : m->num_parameters));
+}
+
+void view_parameters(Model* m, float* buffer, Matrix* weights, Matrix* biases){
+    for (size_t i = 0; i + 1 < m->num_layers; i++){
+        size_t rows = get(&m->layer_sizes, i + 1), cols = get(&m->layer_sizes, i);
+        weights[i] = (Matrix) { .rows = rows, .cols = cols, .values = buffer, .allocator = NULL };
+        buffer += padded_floats(rows * cols);
+        biases[i] = (Matrix) { .rows = rows, .cols = 1, .values = buffer, .allocator = NULL };
+        buffer += padded_floats(rows);
+    }
+}
+
+//the weights and biases, uninitialized apart from the padding
+static void create_parameters(Model* m){
+    m->num_parameters = count_parameters(m);
+    m->parameters = create_parameter_buffer(m);
+    m->weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    m->biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    view_parameters(m, m->parameters, m->weights, m->biases);
+}
+
+void create_optimizer_state(Model* m){
+    if (m->expwa_weights != NULL)
+        return;
+    
+    m->moments = create_parameter_buffer(m);
+    m->moments_squared = create_parameter_buffer(m);
+    
+    m->expwa_weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    m->expwa_biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    view_parameters(m, m->moments, m->expwa_weights, m->expwa_biases);
+    
+    m->expwa_weights_squared = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    m->expwa_biases_squared = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    view_parameters(m, m->moments_squared, m->expwa_weights_squared, m->expwa_biases_squared);
+}
 
 Model* create_model(ModelParams* params, LearningRateTuning* tuning){
-    Model* m = (Model*) malloc(sizeof(Model));
+    Model* m = allocate_model();
     
     //intialize random seed for parmeter intitialization and training
     srand((unsigned int) time(0)); //cast to get rid of warning
@@ -29,15 +100,9 @@ Model* create_model(ModelParams* params, LearningRateTuning* tuning){
     return m;
 }
 
-Model* load_model(const char* path){
-    FILE* f;
-    f = fopen(path, "r");
-    if (f == NULL){
-        fprintf(stderr, "ERROR: Could not open the path %s in the save_model function. Exiting...\n", path);
-        exit(-1); 
-    }
-    
-    Model* m = (Model*) malloc(sizeof(Model));
+//the text format of export_model_text()
+static Model* load_model_text(FILE* f){
+    Model* m = allocate_model();
     uint32_t offset = 0;
     char* token;
     char line[100];
@@ -76,31 +141,11 @@ Model* load_model(const char* path){
     fgets(line, 100, f);
     
     //allocate the space for the weights and biases...
-    m->weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    m->biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    
-    m->expwa_weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    m->expwa_biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    create_parameters(m);
+    //no optimizer state, train() makes it if the model is ever trained
     
-    m->expwa_weights_squared = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    m->expwa_biases_squared = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    for (uint32_t i = 0; i < m->num_layers - 1; i++){
-        m->weights[i] = create_matrix(get(&m->layer_sizes, i + 1), get(&m->layer_sizes, i));
-        m->biases[i] = create_matrix(get(&m->layer_sizes, i + 1), 1);
-        
-        m->expwa_weights[i] = create_matrix(get(&m->layer_sizes, i + 1), get(&m->layer_sizes, i));
-        set_values_with(m->expwa_weights + i, 0.0f);
-        m->expwa_biases[i] = create_matrix(get(&m->layer_sizes, i + 1), 1);
-        set_values_with(m->expwa_biases + i, 0.0f);
-        
-        m->expwa_weights_squared[i] = create_matrix(get(&m->layer_sizes, i + 1), get(&m->layer_sizes, i));
-        set_values_with(m->expwa_weights_squared + i, 0.0f);
-        m->expwa_biases_squared[i] = create_matrix(get(&m->layer_sizes, i + 1), 1);
-        set_values_with(m->expwa_biases_squared + i, 0.0f);
-    }
-    
-    uint16_t ind = 0;
-    uint16_t mat_index = 0;
+    size_t ind = 0;
+    size_t mat_index = 0;
     fgets(line, 100, f); //get to the "["
     fgets(line, 100, f); //now at the first element of the matrix
     while (strncmp(line, "Biases", 6) != 0){
@@ -116,9 +161,7 @@ Model* load_model(const char* path){
         fgets(line, 100, f); //go to the first element of the new matrix
     }
     
-    //skip the empty line...
-    fgets(line, 100, f);
-    
+    //the weights loop stops on the "Biases:" line, past the empty one
     ind = 0;
     mat_index = 0;
     fgets(line, 100, f); //get to the "["
@@ -139,11 +182,184 @@ Model* load_model(const char* path){
     return m;
 }
 
+size_t model_header_bytes(uint32_t num_layers){
+    size_t bytes = sizeof(ModelHeader) + sizeof(uint32_t) * (2 * (size_t) num_layers - 1);
+    return (bytes + ALLOCATOR_ALIGNMENT - 1) / ALLOCATOR_ALIGNMENT * ALLOCATOR_ALIGNMENT;
+}
+
+uint8_t check_model_layout(const ModelHeader* header, const uint32_t* sizes){
+    if (header->num_layers < 2 || header->num_layers > UINT8_MAX || header->header_bytes != model_header_bytes(header->num_layers) ||
+        header->loss_func > BINARY_CROSS_ENTROPY || header->param_bytes % sizeof(float) != 0)
+        return 0;
+    for (uint32_t i = 0; i < header->num_layers; i++){
+        if (sizes[i] == 0 || sizes[i] > INT32_MAX || (i != 0 && sizes[header->num_layers + i - 1] > NONE))
+            return 0;
+    }
+    
+    //the parameters are counted a layer at a time, and it stops as soon as there are more than the file has,
+    //so absurd layer sizes can't wrap the count around to the right number
+    uint64_t num_floats = header->param_bytes / sizeof(float);
+    uint64_t floats = 0;
+    for (uint32_t i = 0; i + 1 < header->num_layers; i++){
+        uint64_t weights = (uint64_t) sizes[i + 1] * sizes[i];
+        if (weights > num_floats)
+            return 0;
+        floats += padded_floats(weights) + padded_floats(sizes[i + 1]);
+        if (floats > num_floats)
+            return 0;
+    }
+    return floats == num_floats;
+}
+
+Model* load_model(const char* path){
+    FILE* f;
+    f = fopen(path, "r");
+    if (f == NULL){
+        fprintf(stderr, "ERROR: Could not open the path %s in the load_model function. Exiting...\n", path);
+        exit(-1); 
+    }
+    
+    //binary files start with the magic, anything else is the text format
+    char magic[8] = { 0 };
+    size_t read = fread(magic, 1, sizeof(magic), f);
+    if (read == sizeof(magic) && memcmp(magic, MODEL_MAGIC, sizeof(magic)) == 0){
+        fclose(f);
+        Model* m = map_model(path, 1);
+        if (m == NULL){
+            fprintf(stderr, "ERROR: Could not load the model %s. Exiting...\n", path);
+            exit(-1);
+        }
+        return m;
+    }
+    
+    rewind(f);
+    Model* m = load_model_text(f);
+    fclose(f);
+    return m;
+}
+
+Model* map_model(const char* path, uint8_t verify_checksum){
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0){
+        fprintf(stderr, "ERROR: Could not open %s. Returning NULL...\n", path);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+    
+    size_t file_size = (size_t) info.st_size;
+    //private and writable, so the parameters can be trained without writing through to the file
+    void* mapping = file_size < sizeof(ModelHeader) ? MAP_FAILED : mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping stays valid
+    if (mapping == MAP_FAILED){
+        fprintf(stderr, "ERROR: Could not map %s, or it is too small to be a model. Returning NULL...\n", path);
+        return NULL;
+    }
+    
+    const char* file = (const char*) mapping;
+    ModelHeader header;
+    memcpy(&header, file, sizeof(header));
+    uint8_t valid = memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) == 0 && header.version == MODEL_VERSION &&
+                    header.num_layers >= 2 && header.num_layers <= UINT8_MAX && header.header_bytes == model_header_bytes(header.num_layers) &&
+                    header.header_bytes <= file_size && header.param_bytes == file_size - header.header_bytes &&
+                    check_model_layout(&header, (const uint32_t*) (file + sizeof(header)));
+    if (!valid){
+        fprintf(stderr, "ERROR: %s is not a valid model of version %d, or it is cut short. Returning NULL...\n", path, MODEL_VERSION);
+        munmap(mapping, file_size);
+        return NULL;
+    }
+    if (verify_checksum && checksum_words(CHECKSUM_SEED, file + sizeof(header), file_size - sizeof(header)) != header.checksum){
+        fprintf(stderr, "ERROR: The checksum of %s doesn't match, the file is corrupted. Returning NULL...\n", path);
+        munmap(mapping, file_size);
+        return NULL;
+    }
+    
+    Model* m = allocate_model();
+    m->mapping = mapping;
+    m->mapping_bytes = file_size;
+    m->num_layers = (uint8_t) header.num_layers;
+    m->loss_func = (Loss) header.loss_func;
+    m->params.learning_rate = header.learning_rate;
+    m->params.momentum = header.momentum;
+    m->params.momentum2 = header.momentum2;
+    m->params.epsillon = header.epsillon;
+    m->params.batch_size = header.batch_size;
+    
+    const uint32_t* sizes = (const uint32_t*) (file + sizeof(header));
+    m->layer_sizes = create_vector(header.num_layers);
+    m->activations = create_vector(header.num_layers - 1);
+    for (uint32_t i = 0; i < header.num_layers; i++)
+        push(&m->layer_sizes, (int) sizes[i]);
+    for (uint32_t i = 0; i + 1 < header.num_layers; i++)
+        push(&m->activations, (int) sizes[header.num_layers + i]);
+    
+    //the parameter buffer is the mapping. Nothing is copied, the pages are only read in once they're used
+    m->num_parameters = count_parameters(m);
+    m->parameters = (float*) (file + header.header_bytes);
+    m->weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    m->biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    view_parameters(m, m->parameters, m->weights, m->biases);
+    
+    //no optimizer state, train() makes it if the model is ever trained
+    return m;
+}
+
+void write_model_header(Model* m, const char* magic, uint32_t version, char* dest){
+    ModelHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.num_layers = m->num_layers;
+    header.loss_func = (uint32_t) m->loss_func;
+    header.header_bytes = (uint32_t) model_header_bytes(m->num_layers);
+    header.param_bytes = sizeof(float) * m->num_parameters;
+    header.learning_rate = m->params.learning_rate;
+    header.momentum = m->params.momentum;
+    header.momentum2 = m->params.momentum2;
+    header.epsillon = m->params.epsillon;
+    header.batch_size = m->params.batch_size;
+    
+    memset(dest, 0, header.header_bytes);
+    memcpy(dest, &header, sizeof(header));
+    uint32_t* sizes = (uint32_t*) (dest + sizeof(header));
+    for (uint32_t i = 0; i < m->num_layers; i++)
+        sizes[i] = (uint32_t) get(&m->layer_sizes, i);
+    for (uint32_t i = 0; i + 1 < m->num_layers; i++)
+        sizes[m->num_layers + i] = (uint32_t) get(&m->activations, i);
+}
+
 uint8_t save_model(Model* m, const char* path){
+    FILE* f = fopen(path, "wb");
+    if (f == NULL){
+        fprintf(stderr, "ERROR: Could not open the path %s in the save_model function. Returning...\n", path);
+        return 0;
+    }
+    
+    //the checksum goes in the header, which is written last
+    size_t header_bytes = model_header_bytes(m->num_layers);
+    char* header = (char*) malloc(header_bytes);
+    write_model_header(m, MODEL_MAGIC, MODEL_VERSION, header);
+    uint64_t checksum = checksum_words(CHECKSUM_SEED, header + sizeof(ModelHeader), header_bytes - sizeof(ModelHeader));
+    
+    //the buffer is already laid out like the file
+    uint8_t success = fseek(f, header_bytes, SEEK_SET) == 0 &&
+                      write_checksummed(f, m->parameters, sizeof(float) * m->num_parameters, &checksum);
+    
+    ((ModelHeader*) header)->checksum = checksum;
+    success = success && fseek(f, 0, SEEK_SET) == 0 && fwrite(header, 1, header_bytes, f) == header_bytes;
+    success = fclose(f) == 0 && success;
+    free(header);
+    if (!success)
+        fprintf(stderr, "ERROR: Could not write the model to %s. Returning...\n", path);
+    return success;
+}
+
+uint8_t export_model_text(Model* m, const char* path){
     FILE* f;
     f = fopen(path, "w");
     if (f == NULL){
-        fprintf(stderr, "ERROR: Could not open the path %s in the save_model function. Exiting...\n", path);
+        fprintf(stderr, "ERROR: Could not open the path %s in the export_model_text function. Returning...\n", path);
         return 0;
     }
     
@@ -190,19 +406,22 @@ uint8_t save_model(Model* m, const char* path){
         }
     }
     
+    fclose(f);
     return 1;
 }
 
 void delete_model(Model* m){
-    for (size_t i = 0; i < m->num_layers - 1; i++){
-        delete_matrix(m->weights + i);
-        delete_matrix(m->biases + i);
-
-        delete_matrix(m->expwa_weights + i);
-        delete_matrix(m->expwa_biases + i);
-        
-        delete_matrix(m->expwa_weights_squared + i);
-        delete_matrix(m->expwa_biases_squared + i);
+    delete_workspaces(m);
+    delete_inference_plans(m);
+    
+    //the matrices are only views. The parameters of a mapped model are part of the mapping
+    if (m->mapping != NULL)
+        munmap(m->mapping, m->mapping_bytes);
+    else if (m->parameters != NULL)
+        allocator_free(&m->pool, m->parameters);
+    if (m->moments != NULL){
+        allocator_free(&m->pool, m->moments);
+        allocator_free(&m->pool, m->moments_squared);
     }
     
     free(m->weights);
@@ -217,6 +436,10 @@ void delete_model(Model* m){
     delete_vector(&m->layer_sizes);
     delete_vector(&m->activations);
     
+    //everything allocated from these has been deleted by now
+    delete_allocator(&m->pool);
+    delete_allocator(&m->step_arena);
+    
     free(m);
 }
 
@@ -231,7 +454,8 @@ void set_loss_func(Model* m, Loss loss_func_){
     m->loss_func = loss_func_;
 }
 
-uint8_t compile(Model* m){
+//checks the layers and allocates the weights and biases
+static uint8_t compile_layers(Model* m){
     m->num_layers = m->layer_sizes.size;
     if (m->num_layers <= 0){
         fprintf(stderr, "ERROR: Model compilation failed. You must have layers in your model!\n");
@@ -245,31 +469,102 @@ uint8_t compile(Model* m){
         }
     }
     
-    m->weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    m->biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    //long lived, so they come from the model's pool
+    create_parameters(m);
+    return 1;
+}
+
+uint8_t compile(Model* m){
+    if (!compile_layers(m))
+        return 0;
     
-    m->expwa_weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    m->expwa_biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    //allocate everything a training step needs up front, so training itself never has to
+    create_optimizer_state(m);
+    create_workspaces(m, m->params.batch_size, m->params.num_threads);
+    //same for evaluating a single data point
+    inference_plan(m, 1);
     
-    m->expwa_weights_squared = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    m->expwa_biases_squared = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    return 1;
+}
+
+uint8_t compile_for_inference(Model* m){
+    if (!compile_layers(m))
+        return 0;
     
-    for (size_t i = 0; i < m->num_layers - 1; i++){
-        m->weights[i] = create_matrix(get(&m->layer_sizes, i + 1), get(&m->layer_sizes, i));
-        m->biases[i] = create_matrix(get(&m->layer_sizes, i + 1), 1);
-        
-        m->expwa_weights[i] = create_matrix(get(&m->layer_sizes, i + 1), get(&m->layer_sizes, i));
-        set_values_with(m->expwa_weights + i, 0.0f);
-        m->expwa_biases[i] = create_matrix(get(&m->layer_sizes, i + 1), 1);
-        set_values_with(m->expwa_biases + i, 0.0f);
+    inference_plan(m, 1);
+    return 1;
+}
+
+static void create_workspace(Model* m, Workspace* ws, uint32_t batch_size){
+    ws->batch_size = batch_size;
+    
+    ws->activations = (Matrix*) calloc(sizeof(Matrix), m->num_layers);
+    ws->outputs = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    ws->weight_grads = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    ws->bias_grads = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    ws->gradients = create_parameter_buffer(m);
+    view_parameters(m, ws->gradients, ws->weight_grads, ws->bias_grads);
+    
+    size_t widest = 0;
+    for (size_t i = 0; i < m->num_layers; i++){
+        size_t layer_size = get(&m->layer_sizes, i);
+        widest = layer_size > widest ? layer_size : widest;
         
-        m->expwa_weights_squared[i] = create_matrix(get(&m->layer_sizes, i + 1), get(&m->layer_sizes, i));
-        set_values_with(m->expwa_weights_squared + i, 0.0f);
-        m->expwa_biases_squared[i] = create_matrix(get(&m->layer_sizes, i + 1), 1);
-        set_values_with(m->expwa_biases_squared + i, 0.0f);
+        ws->activations[i] = create_matrix(layer_size, batch_size);
+        if (i != 0){
+            ws->outputs[i - 1] = create_matrix(layer_size, batch_size);
+        }
     }
     
-    return 1;
+    ws->observ = create_matrix(get(&m->layer_sizes, m->num_layers - 1), batch_size);
+    ws->deltas[0] = create_matrix(widest, batch_size);
+    ws->deltas[1] = create_matrix(widest, batch_size);
+}
+
+static void delete_workspace(Model* m, Workspace* ws){
+    for (size_t i = 0; i < m->num_layers; i++){
+        delete_matrix(ws->activations + i);
+        if (i != 0){
+            delete_matrix(ws->outputs + i - 1);
+        }
+    }
+    
+    free(ws->activations);
+    free(ws->outputs);
+    free(ws->weight_grads);
+    free(ws->bias_grads);
+    allocator_free(&m->pool, ws->gradients);
+    
+    delete_matrix(&ws->observ);
+    delete_matrix(ws->deltas + 0);
+    delete_matrix(ws->deltas + 1);
+}
+
+void create_workspaces(Model* m, uint32_t batch_size, uint32_t num_threads){
+    delete_workspaces(m);
+    
+    num_threads = num_threads == 0 ? 1 : num_threads;
+    //each thread gets an equal share of the batch, rounded up
+    uint32_t share = (batch_size + num_threads - 1) / num_threads;
+    
+    Allocator* previous = use_allocator(&m->pool);
+    m->workspaces = (Workspace*) malloc(sizeof(Workspace) * num_threads);
+    m->num_workspaces = num_threads;
+    for (uint32_t t = 0; t < num_threads; t++)
+        create_workspace(m, m->workspaces + t, share);
+    use_allocator(previous);
+}
+
+void delete_workspaces(Model* m){
+    if (m->workspaces == NULL)
+        return;
+    
+    for (uint32_t t = 0; t < m->num_workspaces; t++)
+        delete_workspace(m, m->workspaces + t);
+    
+    free(m->workspaces);
+    m->workspaces = NULL;
+    m->num_workspaces = 0;
 }
 
 void init_weights_and_biases(Model* m, float mean, float standard_dev){
@@ -305,46 +600,253 @@ void init_weights_and_biases(Model* m, float mean, float standard_dev){
     }
 }
 
+InferencePlan* inference_plan(Model* m, size_t batch_size){
+    //smallest power of two that fits the batch
+    size_t bucket = 0;
+    while (bucket < NUM_PLAN_BUCKETS - 1 && ((size_t)1 << bucket) < batch_size)
+        bucket++;
+    if (m->plans[bucket] != NULL)
+        return m->plans[bucket];
+    
+    InferencePlan* plan = (InferencePlan*) malloc(sizeof(InferencePlan));
+    plan->max_batch = (size_t)1 << bucket;
+    plan->offsets = (size_t*) malloc(sizeof(size_t) * (m->num_layers - 1));
+    
+    //the input is read where the caller has it, so only the layers with weights need room
+    size_t widest = 0;
+    for (size_t i = 1; i < m->num_layers; i++){
+        size_t layer_size = get(&m->layer_sizes, i);
+        widest = layer_size > widest ? layer_size : widest;
+    }
+    
+    //keep the second half on its own cache line
+    size_t half = (widest * plan->max_batch + 15) & ~(size_t)15;
+    for (size_t i = 0; i < m->num_layers - 1; i++)
+        plan->offsets[i] = (i % 2) * half;
+    
+    plan->bytes = 2 * half * sizeof(float);
+    plan->memory = (float*) allocator_alloc(&m->pool, plan->bytes);
+    
+    m->plans[bucket] = plan;
+    return plan;
+}
+
+size_t inference_memory(Model* m){
+    size_t bytes = 0;
+    for (size_t i = 0; i < NUM_PLAN_BUCKETS; i++){
+        if (m->plans[i] != NULL)
+            bytes += m->plans[i]->bytes + sizeof(InferencePlan) + sizeof(size_t) * (m->num_layers - 1);
+    }
+    return bytes;
+}
+
+void delete_inference_plans(Model* m){
+    for (size_t i = 0; i < NUM_PLAN_BUCKETS; i++){
+        InferencePlan* plan = m->plans[i];
+        if (plan == NULL)
+            continue;
+        
+        allocator_free(&m->pool, plan->memory);
+        free(plan->offsets);
+        free(plan);
+        m->plans[i] = NULL;
+    }
+}
+
+//runs op(x) through every layer but the last one using the plan's buffers, and returns the input of the last layer
+static Matrix* forward_hidden_layers(Model* m, InferencePlan* plan, Matrix* x, Transpose trans, size_t batch_size, Matrix views[2]){
+    Matrix* running = x;
+    for (size_t i = 0; i < m->num_layers - 2; i++){
+        Matrix* next = views + (i % 2);
+        next->rows = m->weights[i].rows;
+        next->cols = batch_size;
+        next->values = plan->memory + plan->offsets[i];
+        next->allocator = NULL;
+        layer_forward_trans(m->weights + i, running, trans, m->biases + i, get(&m->activations, i), NULL, next);
+        
+        running = next;
+        trans = NO_TRANSPOSE;
+    }
+    return running;
+}
+
 Matrix eval(Model* m, Matrix* x){
-    //running matrix will propogate through the layers. Make a copy of x so it isn't deleted
-    Matrix running = matrix_copy(x);
+    Matrix out = create_matrix(get(&m->layer_sizes, m->num_layers - 1), x->cols);
+    eval_into(m, x, &out);
+    return out; //will have to clean up the return value...
+}
+
+//x has to fit in the plan
+static void eval_columns(Model* m, InferencePlan* plan, Matrix* x, Matrix* out){
+    size_t last = m->num_layers - 2;
+    
+    //the intermediate layers ping pong through the plan, and the last one writes straight into out
+    Matrix views[2];
+    Matrix* running = forward_hidden_layers(m, plan, x, NO_TRANSPOSE, x->cols, views);
+    layer_forward(m->weights + last, running, m->biases + last, get(&m->activations, last), NULL, out);
+}
+
+void eval_into(Model* m, Matrix* x, Matrix* out){
+    uint32_t previous_max_threads = set_max_threads(m->params.num_threads);
+    InferencePlan* plan = inference_plan(m, x->cols);
+    if (x->cols <= plan->max_batch){
+        eval_columns(m, plan, x, out);
+        set_max_threads(previous_max_threads);
+        return;
+    }
     
-    for (size_t i = 0; i < m->num_layers - 1; i++){
-        //when we copy a new value to running, the previous value's memory is lost. Be sure to delete it
-        Matrix before = running;
-        running = mult(m->weights + i, &running);
-        delete_matrix(&before);
+    //more columns than the biggest plan holds, so they go through it a plan's worth at a time. The columns of a chunk
+    //aren't next to each other in x or out, so they are copied in and out of matrices of their own
+    Matrix x_chunk = create_matrix_with(x->rows, plan->max_batch, &m->pool);
+    Matrix out_chunk = create_matrix_with(out->rows, plan->max_batch, &m->pool);
+    for (size_t start = 0; start < x->cols; start += plan->max_batch){
+        size_t chunk = x->cols - start < plan->max_batch ? x->cols - start : plan->max_batch;
+        x_chunk.cols = chunk;
+        out_chunk.cols = chunk;
+        for (size_t r = 0; r < x->rows; r++)
+            memcpy(x_chunk.values + r * chunk, x->values + r * x->cols + start, sizeof(float) * chunk);
         
-        //add the biases
-        add_in_place(&running, m->biases + i);
+        eval_columns(m, plan, &x_chunk, &out_chunk);
+        for (size_t r = 0; r < out->rows; r++)
+            memcpy(out->values + r * out->cols + start, out_chunk.values + r * chunk, sizeof(float) * chunk);
+    }
+    
+    delete_matrix(&x_chunk);
+    delete_matrix(&out_chunk);
+    set_max_threads(previous_max_threads);
+}
 
+void eval_batch(Model* m, const float* inputs, size_t n, float* outputs){
+    size_t input_size = get(&m->layer_sizes, 0);
+    size_t output_size = get(&m->layer_sizes, m->num_layers - 1);
+    size_t last = m->num_layers - 2;
+    
+    //the matrix products can use the model's share of the thread pool
+    uint32_t previous_max_threads = set_max_threads(m->params.num_threads);
+    
+    //a chunk of data points at a time keeps the activations in cache
+    InferencePlan* plan = inference_plan(m, n < EVAL_CHUNK_SIZE ? n : EVAL_CHUNK_SIZE);
+    Matrix views[2];
+    
+    for (size_t start = 0; start < n; start += EVAL_CHUNK_SIZE){
+        size_t chunk = n - start < EVAL_CHUNK_SIZE ? n - start : EVAL_CHUNK_SIZE;
+        
+        //(chunk x input_size) view of the caller's rows. The first layer reads it transposed, so nothing is copied
+        Matrix x = create_matrix_from_values(chunk, input_size, (float*) inputs + start * input_size);
+        Matrix* running = forward_hidden_layers(m, plan, &x, TRANSPOSE, chunk, views);
         
-        //apply the activation function
-        act_func(&running, get(&m->activations, i));
+        //the last layer goes to the plan as well, since the caller wants a row per data point instead of a column
+        Matrix result = create_matrix_from_values(output_size, chunk, plan->memory + plan->offsets[last]);
+        layer_forward_trans(m->weights + last, running, last == 0 ? TRANSPOSE : NO_TRANSPOSE,
+                            m->biases + last, get(&m->activations, last), NULL, &result);
         
+        float* out = outputs + start * output_size;
+        for (size_t r = 0; r < output_size; r++){
+            for (size_t c = 0; c < chunk; c++)
+                out[c * output_size + r] = result.values[r * chunk + c];
+        }
     }
-    return running; //will have to clean up the return value...
+    
+    set_max_threads(previous_max_threads);
 }
 
+//data points to evaluate, either the column vectors of x and y or the rows of a block
+typedef struct EvalData{
+    Matrix* x;
+    Matrix* y;
+    const DataRows* rows; //used if x is NULL
+    uint32_t num_data_points;
+} EvalData;
 
-float loss_on_dataset(Model* m, Matrix* x, Matrix* y, uint32_t num_data_points){
+//the data points [start .. start + count) as rows, inputs or outputs. Rows that are already in order are used right where
+//they are, anything else is copied into dest
+static const float* gather_points(const EvalData* data, uint8_t outputs, size_t size, size_t start, size_t count, float* dest){
+    if (data->x == NULL){
+        const float* block = outputs ? data->rows->outputs : data->rows->inputs;
+        if (data->rows->rows == NULL)
+            return block + start * size;
+        for (size_t i = 0; i < count; i++)
+            memcpy(dest + i * size, block + (size_t) data->rows->rows[start + i] * size, size * sizeof(float));
+        return dest;
+    }
+    
+    Matrix* x = outputs ? data->y : data->x;
+    for (size_t i = 0; i < count; i++)
+        memcpy(dest + i * size, x[start + i].values, size * sizeof(float));
+    return dest;
+}
+
+static float loss_of(Model* m, const EvalData* data){
+    size_t input_size = get(&m->layer_sizes, 0);
+    size_t output_size = get(&m->layer_sizes, m->num_layers - 1);
+    
+    Matrix inputs = create_matrix_with(EVAL_CHUNK_SIZE, input_size, &m->pool);
+    Matrix preds = create_matrix_with(EVAL_CHUNK_SIZE, output_size, &m->pool);
+    Matrix observ = create_matrix_with(EVAL_CHUNK_SIZE, output_size, &m->pool);
+    
     float summed_loss = 0.0f;
-    for (size_t i = 0; i < num_data_points; i++){
-        Matrix eval_ = eval(m, x + i);
-        summed_loss += loss_func(&eval_, y + i, m->loss_func);
-        delete_matrix(&eval_);
+    for (size_t start = 0; start < data->num_data_points; start += EVAL_CHUNK_SIZE){
+        size_t chunk = data->num_data_points - start < EVAL_CHUNK_SIZE ? data->num_data_points - start : EVAL_CHUNK_SIZE;
+        eval_batch(m, gather_points(data, 0, input_size, start, chunk, inputs.values), chunk, preds.values);
+        
+        //the loss functions only sum element wise and divide by the number of outputs, so the (chunk x output_size)
+        //rows can be handed to them as if they were (output_size x chunk) columns
+        Matrix pred_view = create_matrix_from_values(output_size, chunk, preds.values);
+        Matrix observ_view = create_matrix_from_values(output_size, chunk, (float*) gather_points(data, 1, output_size, start, chunk, observ.values));
+        summed_loss += loss_func(&pred_view, &observ_view, m->loss_func);
     }
-    return summed_loss / num_data_points;
+    
+    delete_matrix(&inputs);
+    delete_matrix(&preds);
+    delete_matrix(&observ);
+    return summed_loss / data->num_data_points;
 }
 
-float accuracy_on_dataset(Model* m, Matrix* x, Matrix* y, uint32_t num_data_points){
+static float accuracy_of(Model* m, const EvalData* data){
+    size_t input_size = get(&m->layer_sizes, 0);
+    size_t output_size = get(&m->layer_sizes, m->num_layers - 1);
+    
+    Matrix inputs = create_matrix_with(EVAL_CHUNK_SIZE, input_size, &m->pool);
+    Matrix preds = create_matrix_with(EVAL_CHUNK_SIZE, output_size, &m->pool);
+    Matrix observ = create_matrix_with(EVAL_CHUNK_SIZE, output_size, &m->pool);
+    
     float num_correct = 0.0f;
-    for (size_t i = 0; i < num_data_points; i++){
-        Matrix eval_ = eval(m, x + i);
-        num_correct += argmax(&eval_) == argmax(y + i);
-        delete_matrix(&eval_);
+    for (size_t start = 0; start < data->num_data_points; start += EVAL_CHUNK_SIZE){
+        size_t chunk = data->num_data_points - start < EVAL_CHUNK_SIZE ? data->num_data_points - start : EVAL_CHUNK_SIZE;
+        eval_batch(m, gather_points(data, 0, input_size, start, chunk, inputs.values), chunk, preds.values);
+        const float* y = gather_points(data, 1, output_size, start, chunk, observ.values);
+        
+        for (size_t i = 0; i < chunk; i++){
+            Matrix pred = create_matrix_from_values(output_size, 1, preds.values + i * output_size);
+            Matrix truth = create_matrix_from_values(output_size, 1, (float*) y + i * output_size);
+            num_correct += argmax(&pred) == argmax(&truth);
+        }
     }
-    return num_correct / num_data_points;
+    
+    delete_matrix(&inputs);
+    delete_matrix(&preds);
+    delete_matrix(&observ);
+    return num_correct / data->num_data_points;
+}
+
+float loss_on_dataset(Model* m, Matrix* x, Matrix* y, uint32_t num_data_points){
+    EvalData data = { .x = x, .y = y, .num_data_points = num_data_points };
+    return loss_of(m, &data);
+}
+
+float accuracy_on_dataset(Model* m, Matrix* x, Matrix* y, uint32_t num_data_points){
+    EvalData data = { .x = x, .y = y, .num_data_points = num_data_points };
+    return accuracy_of(m, &data);
+}
+
+float loss_on_rows(Model* m, const DataRows* rows){
+    EvalData data = { .rows = rows, .num_data_points = rows->num_data_points };
+    return loss_of(m, &data);
+}
+
+float accuracy_on_rows(Model* m, const DataRows* rows){
+    EvalData data = { .rows = rows, .num_data_points = rows->num_data_points };
+    return accuracy_of(m, &data);
 }
 
 static size_t total_params(Model* m){
@@ -356,6 +858,42 @@ static size_t total_params(Model* m){
     return total_params;
 }
 
+//floats of one training workspace for mini batches of batch_size, the same matrices create_workspace() makes
+static size_t workspace_floats(Model* m, uint32_t batch_size){
+    size_t floats = 0, widest = 0;
+    for (size_t i = 0; i < m->num_layers; i++){
+        size_t layer_size = get(&m->layer_sizes, i);
+        widest = layer_size > widest ? layer_size : widest;
+        floats += layer_size * batch_size; //activations
+        if (i != 0)
+            floats += layer_size * batch_size; //outputs
+    }
+    floats += count_parameters(m); //gradients
+    floats += get(&m->layer_sizes, m->num_layers - 1) * batch_size; //observations
+    floats += 2 * widest * batch_size; //deltas
+    return floats;
+}
+
+MemoryReport memory_report(Model* m){
+    MemoryReport report;
+    memset(&report, 0, sizeof(report));
+    report.parameters = sizeof(float) * count_parameters(m);
+    report.optimizer_state = m->expwa_weights == NULL ? 0 : 2 * report.parameters;
+    for (uint32_t t = 0; t < m->num_workspaces; t++)
+        report.workspaces += sizeof(float) * workspace_floats(m, m->workspaces[t].batch_size);
+    report.inference_plans = inference_memory(m);
+    
+    //what compile() would have allocated on top
+    if (m->expwa_weights == NULL)
+        report.saved += 2 * report.parameters;
+    if (m->workspaces == NULL){
+        uint32_t num_threads = m->params.num_threads == 0 ? 1 : m->params.num_threads;
+        uint32_t batch_size = m->params.batch_size == 0 ? 1 : m->params.batch_size;
+        report.saved += sizeof(float) * num_threads * workspace_floats(m, (batch_size + num_threads - 1) / num_threads);
+    }
+    return report;
+}
+
 void summary(Model* m, uint8_t print_matrices){
     //Print Layer Sizes
     printf("Layer Sizes: ");
@@ -397,5 +935,12 @@ void summary(Model* m, uint8_t print_matrices){
     }
     
     size_t params = total_params(m);
-    printf("------------------------------------------\n\nTotal Parameters: %zu\n\n", params);
+    printf("------------------------------------------\n\nTotal Parameters: %zu\n", params);
+    MemoryReport memory = memory_report(m);
+    printf("Parameter memory: %zu bytes, optimizer state: %zu bytes, training workspaces: %zu bytes\n",
+           memory.parameters, memory.optimizer_state, memory.workspaces);
+    printf("Inference plan memory: %zu bytes\n", memory.inference_plans);
+    if (memory.saved != 0)
+        printf("Not allocated until the first train(): %zu bytes\n", memory.saved);
+    printf("\n");
 }
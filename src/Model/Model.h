@@ -12,8 +12,21 @@
 #include "Model/Activations.h"
 #include "Model/Loss.h"
 #include "Model/Matrix.h"
+#include "Model/ThreadPool.h"
+#include "Model/Random.h"
+#include "Model/DataSource.h"
 #include "Data Structure/Vector.h"
 
+//eval_batch() pushes this many data points through the network at a time
+#define EVAL_CHUNK_SIZE 256
+
+//inference plans are made for batch sizes 1, 2, 4 ... 65536, which covers every matrix create_matrix() can make
+#define NUM_PLAN_BUCKETS 17
+
+//the binary model format of save_model()
+#define MODEL_MAGIC "NNPARAMS"
+#define MODEL_VERSION 1
+
 typedef struct ModelParams{
     float learning_rate;
     uint32_t batch_size;
@@ -23,24 +36,125 @@ typedef struct ModelParams{
     float momentum2;
     float epsillon;
     
+    //most threads this model uses from the shared thread pool, and the number of pieces a mini batch is split into.
+    //0 and 1 both run everything on the calling thread
+    uint32_t num_threads;
+    
+    //Hogwild training: instead of splitting each mini batch and adding the pieces up, every thread works through its own part
+    //of the shuffled data and applies plain SGD updates straight to the shared weights, without locks. Threads read weights
+    //that others are writing to, which is fine for sparse or wide models where updates rarely collide. Not bit reproducible
+    uint8_t hogwild;
+    
+    //mini batches are gathered into contiguous buffers on a background thread while the one before is trained on.
+    //this is the number of buffers: 2 is double buffering, 3 triple buffering, 0 the default (see Prefetch.h).
+    //1 turns the thread off, and every mini batch is gathered on the training thread right before it's used
+    uint32_t prefetch_depth;
+    
+    //seed of the shuffles of train(). The same seed gives the same order of mini batches every run, 0 takes one from the clock
+    uint64_t seed;
+    
+    //train() writes a checkpoint to checkpoint_path every checkpoint_interval epochs (see Checkpoint.h), and once more when
+    //it's done if the last epoch wasn't one. 0 or a NULL path writes none
+    const char* checkpoint_path;
+    uint32_t checkpoint_interval;
+    
 } ModelParams;
 
+//the start of a binary model file. The layer sizes (num_layers of them) and activations (num_layers - 1) follow as uint32_t,
+//then the parameters from header_bytes on: weights 0, biases 0, weights 1... each padded to a cache line, so they can be
+//used right where they are once the file is mapped. All in the byte order of the machine that saved it
+typedef struct ModelHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_layers;
+    uint32_t loss_func;
+    uint32_t header_bytes; //where the parameters start, a multiple of ALLOCATOR_ALIGNMENT
+    uint64_t param_bytes; //size of the parameters, padding included. The file ends after them
+    uint64_t checksum; //of everything after this struct
+    
+    //the optimizer settings, so a loaded model can go on training
+    float learning_rate;
+    float momentum;
+    float momentum2;
+    float epsillon;
+    uint32_t batch_size;
+    uint32_t reserved;
+} ModelHeader;
+
 typedef struct LearningRateTuning{
     uint32_t patience;
     float decrease;
     float min;
 } LearningRateTuning;
 
+//where training is at, carried over from one train() to the next and saved in checkpoints, so training picks up
+//right where it left off
+typedef struct TrainingProgress{
+    uint32_t epochs; //trained so far. The Adam timestep counts on from it
+    uint32_t num_loss_increases; //of the learning rate tuning
+    float last_loss; //of the last epoch
+    uint32_t reserved;
+    Rng rng; //the shuffle generator at the end of the last epoch
+} TrainingProgress;
+
+
+//every buffer a training step needs, allocated once for a full mini batch (or a thread's share of it). The batch sized
+//matrices are (rows x batch_size) row major, so a smaller final batch just uses fewer columns of the same memory
+typedef struct Workspace{
+    uint32_t batch_size; //most data points this workspace can hold
+    
+    Matrix* activations; //num_layers of them, activations[0] is the input batch
+    Matrix* outputs; //raw layer outputs before the activation function
+    Matrix observ; //observations of the batch
+    
+    //every gradient in one buffer, laid out like Model.parameters. weight_grads and bias_grads are views into it
+    float* gradients;
+    Matrix* weight_grads;
+    Matrix* bias_grads;
+    
+    //the running derivative of back propagation ping pongs between these, sized for the widest layer
+    Matrix deltas[2];
+} Workspace;
+
+
+//memory for running inference on up to max_batch data points at once. Each layer writes its output at
+//memory + offsets[i], which alternates between two (widest layer x max_batch) halves, so the inputs of a layer are
+//never overwritten by its own output. Created once per batch size bucket and reused by every eval
+typedef struct InferencePlan{
+    size_t max_batch;
+    size_t* offsets; //one per layer with weights
+    float* memory;
+    size_t bytes;
+} InferencePlan;
+
+
+//bytes held by the parts of a model, see memory_report()
+typedef struct MemoryReport{
+    size_t parameters;
+    size_t optimizer_state; //Adam's two moments, 2x the parameters once allocated
+    size_t workspaces; //training buffers
+    size_t inference_plans;
+    size_t saved; //what compile() would have allocated on top, for a model that was loaded or compiled for inference
+} MemoryReport;
+
 
 typedef struct Model{
     uint8_t num_layers; //never going to exceed more than 255 layers (hopefully)
     Vector layer_sizes;
     Vector activations;
     
+    //every parameter lives in one buffer: weights 0, biases 0, weights 1... each padded to a cache line, the same layout
+    //as the parameters of a model file. The matrices are views into it, so anything that goes over the whole model
+    //(the optimizer, saving, adding up gradients) is a single pass over num_parameters floats
+    float* parameters;
+    size_t num_parameters; //padding included
     Matrix* weights;
     Matrix* biases;
     
-    //expwa = exponentially weighted averged
+    //expwa = exponentially weighted averged. NULL for a loaded model or one compiled for inference, until the first train().
+    //same layout as the parameters, with views into moments and moments_squared
+    float* moments;
+    float* moments_squared;
     Matrix* expwa_weights;
     Matrix* expwa_biases;
     
@@ -52,16 +166,57 @@ typedef struct Model{
     ModelParams params;
     uint8_t use_tuning;
     LearningRateTuning tuning;
+    TrainingProgress progress;
+    
+    //one workspace per training thread, each with its own gradients. NULL until compile() or train()
+    Workspace* workspaces;
+    uint32_t num_workspaces;
+    InferencePlan* plans[NUM_PLAN_BUCKETS]; //made on first use
+    
+    Allocator pool; //parameters, optimizer state and the workspace
+    Allocator step_arena; //temporaries of a single training step or evaluation, reset after each one
+    
+    //seconds the last train() spent waiting for its mini batches to be gathered. Near 0 unless the prefetching can't keep up
+    float prefetch_stall;
+    //same for the snapshots of its checkpoints, and for waiting on the one before to be written
+    float checkpoint_stall;
+    
+    //the file the weights and biases live in when the model was mapped by load_model(), NULL otherwise. It's mapped
+    //copy on write, so training a mapped model never changes the file
+    void* mapping;
+    size_t mapping_bytes;
 } Model;
 
 
 
 Model* create_model(ModelParams* params, LearningRateTuning* tuning);
 
+//loads a model written by save_model(), or by export_model_text() for older files. Exits if the file can't be opened
 Model* load_model(const char* path);
 
+//maps a file written by save_model(). Only the header and layer sizes are read, the parameters are used right where they
+//are in the mapping, so it takes about as long however big the model is. Unless verify_checksum is set, which reads
+//every parameter once to check them. Returns NULL if the file isn't a valid model.
+//loaded models are ready for inference only, without optimizer state or workspaces, until they're trained
+Model* map_model(const char* path, uint8_t verify_checksum);
+
+//writes the model in the binary format, with its parameters bit for bit
 uint8_t save_model(Model* m, const char* path);
 
+//bytes from the start of a model file to its parameters
+size_t model_header_bytes(uint32_t num_layers);
+
+//whether the header and the layer sizes and activations that follow it describe a model that can be built, with
+//param_bytes of parameters. Only the magic and version are left to the caller
+uint8_t check_model_layout(const ModelHeader* header, const uint32_t* sizes);
+
+//the first model_header_bytes() of a file of m: the header with the given magic and version, all but the checksum filled in,
+//then the layer sizes and activations and zeros up to the parameters
+void write_model_header(Model* m, const char* magic, uint32_t version, char* dest);
+
+//writes the model as text, one parameter per line with 6 decimals. Readable by load_model(), but it loses precision
+uint8_t export_model_text(Model* m, const char* path);
+
 void delete_model(Model* model);
 
 
@@ -70,18 +225,60 @@ float loss_on_dataset(Model* m, Matrix* x, Matrix* y, uint32_t num_data_points);
 
 float accuracy_on_dataset(Model* m, Matrix* x, Matrix* y, uint32_t num_data_points);
 
+//same, for data points that are rows of a block. Only a chunk of them is gathered at a time
+float loss_on_rows(Model* m, const DataRows* data);
+
+float accuracy_on_rows(Model* m, const DataRows* data);
+
 void add_layer(Model* m, int elem, Activation act);
 
 void set_loss_func(Model* m, Loss loss_func_);
 
 void init_weights_and_biases(Model* m, float mean, float standard_deviation); //to be used after compile...
 
+//allocates the parameters, optimizer state and training workspaces
 uint8_t compile(Model* m);
 
+//allocates only the parameters, for a model that's only ever evaluated. Training it still works, the rest is made when
+//train() is first called
+uint8_t compile_for_inference(Model* m);
 
+//points weights[i] and biases[i] at their place in buffer, which is laid out like Model.parameters
+void view_parameters(Model* m, float* buffer, Matrix* weights, Matrix* biases);
 
+//the zeroed optimizer state. Does nothing if it's already there
+void create_optimizer_state(Model* m);
+
+//how much memory the model holds, and how much it saved by leaving out the training state
+MemoryReport memory_report(Model* m);
+
+//(re)allocates one training workspace per thread, for mini batches of batch_size split evenly across num_threads.
+//compile() and train() call this for you
+void create_workspaces(Model* m, uint32_t batch_size, uint32_t num_threads);
+
+void delete_workspaces(Model* m);
+
+
+
+//the returned matrix is allocated, and has to be deleted by the caller
 Matrix eval(Model* m, Matrix* x);
 
+//writes the output for x into out, which has to be (output size x x->cols). Nothing is allocated, unless it's
+//the first call for a batch size bucket or x is wider than the biggest one. The plans aren't locked, so a model shouldn't be evaluated from two threads at once
+void eval_into(Model* m, Matrix* x, Matrix* out);
+
+//runs n data points through the network, a chunk at a time with one matrix product per layer.
+//inputs holds one data point per row (n x input size), and outputs receives one prediction per row (n x output size)
+void eval_batch(Model* m, const float* inputs, size_t n, float* outputs);
+
+//the plan for batches of up to batch_size data points, creating it if it doesn't exist yet
+InferencePlan* inference_plan(Model* m, size_t batch_size);
+
+//total bytes held by the inference plans created so far
+size_t inference_memory(Model* m);
+
+void delete_inference_plans(Model* m);
+
 void summary(Model* m, uint8_t print_matrices);
 
 #endif /* Model_h */
@@ -0,0 +1,117 @@
+//
+//  Prefetch.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Prefetch.h"
+#include "Model/FileIO.h"
+#include "pch.h"
+
+static void* producer_main(void* arg){
+    Prefetcher* p = (Prefetcher*) arg;
+
+    pthread_mutex_lock(&p->lock);
+    while (!p->stop && !p->finished && p->produced < p->num_batches){
+        //every slot is either waiting for the trainer or in use by it
+        if (p->produced - p->released >= p->depth){
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+
+        uint32_t batch = p->produced;
+        PrefetchSlot* slot = p->slots + batch % p->depth;
+        pthread_mutex_unlock(&p->lock);
+
+        uint32_t num_points = p->produce(p->ctx, batch, p->batch_size, slot->inputs, slot->outputs);
+
+        pthread_mutex_lock(&p->lock);
+        slot->num_points = num_points;
+        if (num_points == 0)
+            p->finished = 1;
+        else
+            p->produced++;
+        pthread_cond_broadcast(&p->changed);
+    }
+    p->finished = 1;
+    pthread_cond_broadcast(&p->changed);
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+void start_prefetch(Prefetcher* p, Allocator* allocator, uint32_t depth, uint32_t num_batches, uint32_t batch_size,
+                    uint32_t num_inputs, uint32_t num_outputs, ProduceBatch produce, void* ctx){
+    memset(p, 0, sizeof(Prefetcher));
+    p->produce = produce;
+    p->ctx = ctx;
+    p->num_batches = num_batches;
+    p->batch_size = batch_size;
+    p->depth = depth == 0 ? DEFAULT_PREFETCH_DEPTH : MIN(depth, MAX_PREFETCH_DEPTH);
+    p->allocator = allocator;
+    for (uint32_t i = 0; i < p->depth; i++){
+        p->slots[i].inputs = (float*) allocator_alloc(allocator, sizeof(float) * batch_size * num_inputs);
+        p->slots[i].outputs = (float*) allocator_alloc(allocator, sizeof(float) * batch_size * num_outputs);
+    }
+
+    if (p->depth == 1)
+        return;
+    pthread_mutex_init(&p->lock, NULL);
+    pthread_cond_init(&p->changed, NULL);
+    if (pthread_create(&p->thread, NULL, producer_main, p) != 0){
+        fprintf(stderr, "ERROR: Could not start the prefetch thread. Exiting...\n");
+        exit(-1);
+    }
+}
+
+uint32_t next_prefetched(Prefetcher* p, const float** inputs, const float** outputs){
+    double begin = seconds_now();
+    PrefetchSlot* slot = p->slots + p->consumed % p->depth;
+
+    //without a thread, the whole gather counts as a stall
+    if (p->depth == 1){
+        slot->num_points = p->consumed < p->num_batches ? p->produce(p->ctx, p->consumed, p->batch_size, slot->inputs, slot->outputs) : 0;
+        p->stall_seconds += seconds_now() - begin;
+        p->num_stalls++;
+    }
+    else{
+        pthread_mutex_lock(&p->lock);
+        //the batch handed out last time is done with
+        p->released = p->consumed;
+        pthread_cond_broadcast(&p->changed);
+
+        if (p->produced == p->consumed && !p->finished){
+            p->num_stalls++;
+            while (p->produced == p->consumed && !p->finished)
+                pthread_cond_wait(&p->changed, &p->lock);
+            p->stall_seconds += seconds_now() - begin;
+        }
+        if (p->produced == p->consumed)
+            slot->num_points = 0;
+        pthread_mutex_unlock(&p->lock);
+    }
+
+    if (slot->num_points == 0)
+        return 0;
+    p->consumed++;
+    *inputs = slot->inputs;
+    *outputs = slot->outputs;
+    return slot->num_points;
+}
+
+void stop_prefetch(Prefetcher* p){
+    if (p->depth > 1){
+        pthread_mutex_lock(&p->lock);
+        p->stop = 1;
+        pthread_cond_broadcast(&p->changed);
+        pthread_mutex_unlock(&p->lock);
+        pthread_join(p->thread, NULL);
+        pthread_mutex_destroy(&p->lock);
+        pthread_cond_destroy(&p->changed);
+    }
+
+    for (uint32_t i = 0; i < p->depth; i++){
+        allocator_free(p->allocator, p->slots[i].inputs);
+        allocator_free(p->allocator, p->slots[i].outputs);
+    }
+}
@@ -0,0 +1,65 @@
+//
+//  Prefetch.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Prefetch_h
+#define Prefetch_h
+
+#include "pch.h"
+#include "Model/Allocator.h"
+#include <pthread.h>
+
+//ModelParams.prefetch_depth of 0 uses this many buffers, so one batch is trained on while up to two are gathered
+#define DEFAULT_PREFETCH_DEPTH 3
+#define MAX_PREFETCH_DEPTH 8
+
+//writes mini batch number batch_index (of up to batch_size data points) as rows of inputs and outputs, and returns how many
+//data points it has. 0 once there are no more
+typedef uint32_t (*ProduceBatch)(void* ctx, uint32_t batch_index, uint32_t batch_size, float* inputs, float* outputs);
+
+typedef struct PrefetchSlot{
+    float* inputs;
+    float* outputs;
+    uint32_t num_points;
+} PrefetchSlot;
+
+//gathers mini batches into a ring of contiguous buffers on a background thread, while the training thread works on the one
+//before. Slots are produced and consumed strictly in order, and a slot is only reused once the trainer has moved past it.
+//with a depth of 1 there is no thread, and every batch is gathered on the training thread when it's asked for
+typedef struct Prefetcher{
+    ProduceBatch produce;
+    void* ctx;
+    uint32_t num_batches;
+    uint32_t batch_size;
+    uint32_t depth;
+    PrefetchSlot slots[MAX_PREFETCH_DEPTH];
+    Allocator* allocator;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint32_t produced; //batches written so far
+    uint32_t consumed; //batches handed to the trainer so far
+    uint32_t released; //batches the trainer is done with, their slots can be written again
+    uint8_t finished; //the producer ran out of batches
+    uint8_t stop;
+
+    //time the trainer spent waiting for a batch. If this is a big part of the epoch, the pipeline is starved
+    double stall_seconds;
+    uint32_t num_stalls;
+} Prefetcher;
+
+//allocates depth slots of batch_size points from allocator and starts producing batches 0 to num_batches - 1
+void start_prefetch(Prefetcher* p, Allocator* allocator, uint32_t depth, uint32_t num_batches, uint32_t batch_size,
+                    uint32_t num_inputs, uint32_t num_outputs, ProduceBatch produce, void* ctx);
+
+//hands out the next batch, which stays valid until the next call. Returns its number of data points, 0 once they ran out
+uint32_t next_prefetched(Prefetcher* p, const float** inputs, const float** outputs);
+
+//stops the producer, even halfway through, and frees the slots
+void stop_prefetch(Prefetcher* p);
+
+#endif /* Prefetch_h */
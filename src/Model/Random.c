@@ -0,0 +1,88 @@
+//
+//  Random.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/Random.h"
+#include "pch.h"
+#include <time.h>
+
+static _Thread_local Rng thread_generator;
+static _Thread_local uint8_t thread_seeded = 0;
+
+static uint64_t splitmix64(uint64_t* x){
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static uint64_t rotate_left(uint64_t x, int k){
+    return (x << k) | (x >> (64 - k));
+}
+
+void seed_rng(Rng* rng, uint64_t seed){
+    if (seed == 0){
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        //the address tells apart threads seeded in the same nanosecond
+        seed = (uint64_t) t.tv_sec * 1000000000ull + (uint64_t) t.tv_nsec + (uint64_t) (uintptr_t) rng;
+    }
+    for (int i = 0; i < 4; i++)
+        rng->state[i] = splitmix64(&seed);
+}
+
+uint64_t next_random(Rng* rng){
+    uint64_t* s = rng->state;
+    uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotate_left(s[3], 45);
+    return result;
+}
+
+uint32_t random_below(Rng* rng, uint32_t n){
+    //Lemire's method: the high half of a 32 x 32 bit product is uniform in [0, n) once the few low values that would
+    //make some results more likely are rejected
+    uint64_t product = (next_random(rng) >> 32) * n;
+    uint32_t low = (uint32_t) product;
+    if (low < n){
+        uint32_t threshold = -n % n;
+        while (low < threshold){
+            product = (next_random(rng) >> 32) * n;
+            low = (uint32_t) product;
+        }
+    }
+    return (uint32_t) (product >> 32);
+}
+
+float random_float(Rng* rng){
+    return (next_random(rng) >> 40) * (1.0f / 16777216.0f); //24 bits, all a float can hold
+}
+
+Rng* thread_rng(void){
+    if (!thread_seeded)
+        seed_random(0);
+    return &thread_generator;
+}
+
+void seed_random(uint64_t seed){
+    seed_rng(&thread_generator, seed);
+    thread_seeded = 1;
+}
+
+void shuffle_indices(Rng* rng, uint32_t* indices, uint32_t n, uint32_t count){
+    count = count < n ? count : n;
+    for (uint32_t i = 0; i < count && i + 1 < n; i++){
+        uint32_t j = i + random_below(rng, n - i);
+        uint32_t temp = indices[i];
+        indices[i] = indices[j];
+        indices[j] = temp;
+    }
+}
@@ -0,0 +1,41 @@
+//
+//  Random.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Random_h
+#define Random_h
+
+#include "pch.h"
+
+//xoshiro256** generator. Small, fast, and unlike rand() its state is a value, so every thread or data source can have its own
+//and a seed gives the same sequence on every platform
+typedef struct Rng{
+    uint64_t state[4];
+} Rng;
+
+//expands seed into a full state with splitmix64, so nearby seeds (like seed + rank) still give unrelated sequences.
+//a seed of 0 takes one from the clock instead
+void seed_rng(Rng* rng, uint64_t seed);
+
+uint64_t next_random(Rng* rng);
+
+//uniform in [0, n), without the bias of taking a modulo. n has to be at least 1
+uint32_t random_below(Rng* rng, uint32_t n);
+
+//uniform in [0, 1)
+float random_float(Rng* rng);
+
+//the calling thread's own generator. Seeded from the clock on first use, unless seed_random() came first
+Rng* thread_rng(void);
+
+//seeds the calling thread's generator, same as seed_rng()
+void seed_random(uint64_t seed);
+
+//Fisher-Yates: randomly permutes the first count positions of indices with the rest of them, in place and in O(count).
+//count == n shuffles the whole array. Shuffling an already shuffled array is just as random, so the buffer can be reused
+void shuffle_indices(Rng* rng, uint32_t* indices, uint32_t n, uint32_t count);
+
+#endif /* Random_h */
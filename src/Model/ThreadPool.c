@@ -0,0 +1,403 @@
+//
+//  ThreadPool.c
+//  Neural Net
+//
+//
+//
+
+#include "Model/ThreadPool.h"
+#include "Model/Gemm.h"
+#include "pch.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#ifdef __linux__
+    #include <sys/syscall.h>
+#endif
+
+//chunks of a parallel_range() per thread, so a thread that gets held up doesn't hold up the whole range
+#define RANGE_CHUNKS_PER_THREAD 4
+#define RANGE_ALIGNMENT 64
+
+//entries a worker's deque can hold. A parallel_for() pushes at most one entry per thread, so this only fills up with
+//deeply nested loops, and then the loop just runs on fewer threads
+#define DEQUE_CAPACITY 1024
+//times an idle worker looks for work before going to sleep
+#define IDLE_SPINS 256
+
+//one parallel_for(). It lives on the stack of the thread that called parallel_for(), and every entry in a deque is
+//a pointer to one. Whoever runs an entry takes indices from next_index until there are none left
+typedef struct ForJob{
+    Task task;
+    void* ctx;
+    size_t num_tasks;
+    uint32_t child_max_threads; //limit of parallel_for()s made from inside the tasks
+
+    atomic_size_t next_index;
+    atomic_size_t tasks_done;
+    //entries of this job that haven't finished yet. The job can't leave the stack before every one of them is done
+    atomic_uint entries_left;
+} ForJob;
+
+//Chase-Lev deque. The owner pushes and pops at the bottom, thieves take from the top
+typedef struct Deque{
+    atomic_long top;
+    atomic_long bottom;
+    _Atomic(ForJob*) entries[DEQUE_CAPACITY];
+} Deque;
+
+typedef struct Worker{
+    pthread_t thread;
+    Deque deque;
+    uint32_t index;
+} Worker;
+
+typedef struct ThreadPool{
+    uint32_t num_threads; //workers + the thread submitting work
+    uint8_t pin_threads;
+    Worker* workers; //num_threads - 1 of them
+
+    //entries from threads outside of the pool. Rarely used, so a lock is fine
+    pthread_mutex_t external_lock;
+    ForJob* external[DEQUE_CAPACITY];
+    size_t num_external;
+    atomic_size_t external_count;
+
+    //sleeping and waking idle workers
+    pthread_mutex_t sleep_lock;
+    pthread_cond_t wake;
+    atomic_uint sleepers;
+    atomic_ulong work_epoch; //bumped whenever work is submitted
+    atomic_int shutdown;
+} ThreadPool;
+
+static ThreadPool* _Atomic pool = NULL; //read without the lock once it's running
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t configured_threads = 0;
+static uint8_t configured_pinning = 0;
+
+//-1 on threads outside of the pool
+static _Thread_local int32_t worker_index = -1;
+static _Thread_local uint32_t thread_max_threads = 1;
+
+
+
+static uint8_t deque_push(Deque* deque, ForJob* job){
+    long bottom = atomic_load(&deque->bottom);
+    long top = atomic_load(&deque->top);
+    if (bottom - top >= DEQUE_CAPACITY)
+        return 0;
+
+    atomic_store(&deque->entries[bottom % DEQUE_CAPACITY], job);
+    atomic_store(&deque->bottom, bottom + 1);
+    return 1;
+}
+
+static ForJob* deque_pop(Deque* deque){
+    long bottom = atomic_load(&deque->bottom) - 1;
+    atomic_store(&deque->bottom, bottom);
+    long top = atomic_load(&deque->top);
+
+    if (top > bottom){
+        atomic_store(&deque->bottom, bottom + 1);
+        return NULL;
+    }
+
+    ForJob* job = atomic_load(&deque->entries[bottom % DEQUE_CAPACITY]);
+    if (top == bottom){
+        //last entry, race any thief for it
+        if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
+            job = NULL;
+        atomic_store(&deque->bottom, bottom + 1);
+    }
+    return job;
+}
+
+static ForJob* deque_steal(Deque* deque){
+    long top = atomic_load(&deque->top);
+    long bottom = atomic_load(&deque->bottom);
+    if (top >= bottom)
+        return NULL;
+
+    ForJob* job = atomic_load(&deque->entries[top % DEQUE_CAPACITY]);
+    if (!atomic_compare_exchange_strong(&deque->top, &top, top + 1))
+        return NULL; //someone else got it
+    return job;
+}
+
+
+
+static void work_on(ForJob* job){
+    for (;;){
+        size_t index = atomic_fetch_add(&job->next_index, 1);
+        if (index >= job->num_tasks)
+            return;
+        job->task(index, job->ctx);
+        atomic_fetch_add(&job->tasks_done, 1);
+    }
+}
+
+static void run_entry(ForJob* job){
+    uint32_t previous = thread_max_threads;
+    thread_max_threads = job->child_max_threads;
+    work_on(job);
+    thread_max_threads = previous;
+    //the last time the job is touched, it may be gone right after this
+    atomic_fetch_sub(&job->entries_left, 1);
+}
+
+static ForJob* find_work(ThreadPool* p){
+    if (worker_index >= 0){
+        ForJob* job = deque_pop(&p->workers[worker_index].deque);
+        if (job != NULL)
+            return job;
+    }
+
+    if (atomic_load(&p->external_count) != 0){
+        ForJob* job = NULL;
+        pthread_mutex_lock(&p->external_lock);
+        if (p->num_external != 0){
+            job = p->external[--p->num_external];
+            atomic_store(&p->external_count, p->num_external);
+        }
+        pthread_mutex_unlock(&p->external_lock);
+        if (job != NULL)
+            return job;
+    }
+
+    //steal, starting after ourselves so the thieves spread out
+    uint32_t num_workers = p->num_threads - 1;
+    uint32_t start = worker_index >= 0 ? (uint32_t) worker_index + 1 : 0;
+    for (uint32_t i = 0; i < num_workers; i++){
+        ForJob* job = deque_steal(&p->workers[(start + i) % num_workers].deque);
+        if (job != NULL)
+            return job;
+    }
+    return NULL;
+}
+
+static void wake_workers(ThreadPool* p){
+    atomic_fetch_add(&p->work_epoch, 1);
+    if (atomic_load(&p->sleepers) != 0){
+        pthread_mutex_lock(&p->sleep_lock);
+        pthread_cond_broadcast(&p->wake);
+        pthread_mutex_unlock(&p->sleep_lock);
+    }
+}
+
+//straight to the system call, since the glibc wrappers need _GNU_SOURCE before the first include, which pch.h already is
+static void pin_to_core(uint32_t core){
+#ifdef __linux__
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    core %= num_cores > 0 ? num_cores : 1;
+    
+    unsigned long mask[16] = { 0 }; //1024 cores
+    mask[core / (8 * sizeof(unsigned long)) % 16] = 1UL << (core % (8 * sizeof(unsigned long)));
+    syscall(SYS_sched_setaffinity, 0, sizeof(mask), mask); //0 is the calling thread
+#else
+    (void) core;
+#endif
+}
+
+static void* worker_main(void* arg){
+    Worker* worker = (Worker*) arg;
+    ThreadPool* p = pool;
+    worker_index = (int32_t) worker->index;
+    //core 0 is left for the thread that submits the work
+    if (p->pin_threads)
+        pin_to_core(worker->index + 1);
+
+    while (!atomic_load(&p->shutdown)){
+        ForJob* job = NULL;
+        for (uint32_t spin = 0; spin < IDLE_SPINS && job == NULL; spin++){
+            job = find_work(p);
+            if (job == NULL)
+                sched_yield();
+        }
+        if (job != NULL){
+            run_entry(job);
+            continue;
+        }
+
+        //nothing to do. Register as a sleeper, check one last time, then wait for the epoch to move.
+        //submitters bump the epoch before looking at the sleepers, so a wake up can't be missed
+        unsigned long epoch = atomic_load(&p->work_epoch);
+        atomic_fetch_add(&p->sleepers, 1);
+        job = find_work(p);
+        if (job == NULL){
+            pthread_mutex_lock(&p->sleep_lock);
+            while (!atomic_load(&p->shutdown) && atomic_load(&p->work_epoch) == epoch)
+                pthread_cond_wait(&p->wake, &p->sleep_lock);
+            pthread_mutex_unlock(&p->sleep_lock);
+        }
+        atomic_fetch_sub(&p->sleepers, 1);
+        if (job != NULL)
+            run_entry(job);
+    }
+    release_gemm_buffers();
+    return NULL;
+}
+
+static uint32_t default_num_threads(void){
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    return num_cores > 0 ? (uint32_t) num_cores : 1;
+}
+
+static ThreadPool* get_pool(void){
+    ThreadPool* p = pool;
+    if (p != NULL)
+        return p;
+
+    pthread_mutex_lock(&pool_lock);
+    if (pool == NULL){
+        p = (ThreadPool*) calloc(1, sizeof(ThreadPool));
+        p->num_threads = configured_threads == 0 ? default_num_threads() : configured_threads;
+        p->pin_threads = configured_pinning;
+        p->workers = (Worker*) calloc(p->num_threads, sizeof(Worker));
+        pthread_mutex_init(&p->external_lock, NULL);
+        pthread_mutex_init(&p->sleep_lock, NULL);
+        pthread_cond_init(&p->wake, NULL);
+        pool = p;
+
+        for (uint32_t i = 0; i + 1 < p->num_threads; i++){
+            p->workers[i].index = i;
+            if (pthread_create(&p->workers[i].thread, NULL, worker_main, p->workers + i) != 0){
+                fprintf(stderr, "ERROR: Could not start thread %u of the thread pool. Exiting...\n", i);
+                exit(-1);
+            }
+        }
+    }
+    p = pool;
+    pthread_mutex_unlock(&pool_lock);
+    return p;
+}
+
+void shutdown_thread_pool(void){
+    pthread_mutex_lock(&pool_lock);
+    ThreadPool* p = pool;
+    if (p != NULL){
+        atomic_store(&p->shutdown, 1);
+        pthread_mutex_lock(&p->sleep_lock);
+        pthread_cond_broadcast(&p->wake);
+        pthread_mutex_unlock(&p->sleep_lock);
+
+        for (uint32_t i = 0; i + 1 < p->num_threads; i++)
+            pthread_join(p->workers[i].thread, NULL);
+
+        pthread_mutex_destroy(&p->external_lock);
+        pthread_mutex_destroy(&p->sleep_lock);
+        pthread_cond_destroy(&p->wake);
+        free(p->workers);
+        free(p);
+        pool = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+void configure_thread_pool(uint32_t num_threads, uint8_t pin_threads){
+    shutdown_thread_pool();
+    pthread_mutex_lock(&pool_lock);
+    configured_threads = num_threads;
+    configured_pinning = pin_threads;
+    pthread_mutex_unlock(&pool_lock);
+}
+
+uint32_t set_max_threads(uint32_t max_threads){
+    uint32_t previous = thread_max_threads;
+    thread_max_threads = max_threads == 0 ? 1 : max_threads;
+    return previous;
+}
+
+uint32_t max_threads(void){
+    if (thread_max_threads <= 1)
+        return 1;
+    uint32_t pool_size = get_pool()->num_threads;
+    return thread_max_threads < pool_size ? thread_max_threads : pool_size;
+}
+
+
+
+void parallel_for(size_t num_tasks, Task task, void* ctx){
+    uint32_t width = max_threads();
+    if (width > num_tasks)
+        width = (uint32_t) num_tasks;
+
+    if (width <= 1){
+        for (size_t i = 0; i < num_tasks; i++)
+            task(i, ctx);
+        return;
+    }
+
+    ThreadPool* p = get_pool();
+    ForJob job;
+    job.task = task;
+    job.ctx = ctx;
+    job.num_tasks = num_tasks;
+    //whatever is left of our limit is split between the threads of this loop
+    job.child_max_threads = thread_max_threads / width == 0 ? 1 : thread_max_threads / width;
+    atomic_init(&job.next_index, 0);
+    atomic_init(&job.tasks_done, 0);
+    atomic_init(&job.entries_left, width - 1);
+
+    //one entry for every other thread that can help. The calling thread is the last one
+    uint32_t pushed = 0;
+    if (worker_index >= 0){
+        Deque* deque = &p->workers[worker_index].deque;
+        while (pushed < width - 1 && deque_push(deque, &job))
+            pushed++;
+    }
+    else{
+        pthread_mutex_lock(&p->external_lock);
+        for (; pushed < width - 1 && p->num_external < DEQUE_CAPACITY; pushed++)
+            p->external[p->num_external++] = &job;
+        atomic_store(&p->external_count, p->num_external);
+        pthread_mutex_unlock(&p->external_lock);
+    }
+    //entries that didn't fit won't ever run
+    atomic_fetch_sub(&job.entries_left, width - 1 - pushed);
+    wake_workers(p);
+
+    uint32_t previous = thread_max_threads;
+    thread_max_threads = job.child_max_threads;
+    work_on(&job);
+    thread_max_threads = previous;
+
+    //wait for the other threads. Instead of sitting idle, run whatever we can find, which also picks up our own
+    //entries nobody took and keeps nested loops of other threads moving
+    while (atomic_load(&job.tasks_done) != num_tasks || atomic_load(&job.entries_left) != 0){
+        ForJob* other = find_work(p);
+        if (other != NULL)
+            run_entry(other);
+        else
+            sched_yield();
+    }
+}
+
+typedef struct RangeJob{
+    RangeTask task;
+    void* ctx;
+    size_t n;
+    size_t chunk_size;
+} RangeJob;
+
+static void range_chunk(size_t index, void* ctx){
+    RangeJob* job = (RangeJob*) ctx;
+    size_t begin = index * job->chunk_size;
+    size_t end = job->n - begin < job->chunk_size ? job->n : begin + job->chunk_size;
+    job->task(begin, end, job->ctx);
+}
+
+void parallel_range(size_t n, size_t min_size, RangeTask task, void* ctx){
+    uint32_t num_threads = max_threads();
+    if (num_threads == 1 || n < min_size || n <= RANGE_ALIGNMENT){
+        task(0, n, ctx);
+        return;
+    }
+
+    size_t num_chunks = (size_t) num_threads * RANGE_CHUNKS_PER_THREAD;
+    size_t chunk_size = (n + num_chunks - 1) / num_chunks;
+    chunk_size = (chunk_size + RANGE_ALIGNMENT - 1) / RANGE_ALIGNMENT * RANGE_ALIGNMENT;
+    RangeJob job = { .task = task, .ctx = ctx, .n = n, .chunk_size = chunk_size };
+    parallel_for((n + chunk_size - 1) / chunk_size, range_chunk, &job);
+}
@@ -0,0 +1,48 @@
+//
+//  ThreadPool.h
+//  Neural Net
+//
+//
+//
+
+#ifndef ThreadPool_h
+#define ThreadPool_h
+
+#include "pch.h"
+
+//One work stealing thread pool for the whole process. Every parallel_for() (gemm, training, data loading...) submits to it,
+//so running several models at once never starts more threads than there are cores.
+//Each worker has its own deque. Pushing and popping your own deque and stealing from someone else's are lock free,
+//only submissions from threads outside of the pool go through a lock.
+
+//one unit of work of a parallel_for(). index is in [0, num_tasks)
+typedef void (*Task)(size_t index, void* ctx);
+
+//one chunk of a parallel_range(), the elements [begin, end)
+typedef void (*RangeTask)(size_t begin, size_t end, void* ctx);
+
+//sets the size of the pool (counting the thread that calls parallel_for(), which works as well) and whether workers are
+//pinned to their own core. 0 threads means one per core. Has to be called while nothing is running in the pool
+void configure_thread_pool(uint32_t num_threads, uint8_t pin_threads);
+
+//stops the workers. The pool starts again by itself on the next parallel_for()
+void shutdown_thread_pool(void);
+
+//the most threads a parallel_for() made on this thread can use right now. Starts out at 1 on every thread outside
+//of the pool, so nothing runs in parallel unless it's asked for. Returns the previous limit so it can be restored.
+//tasks inherit the limit of their parallel_for(), divided between them, so nested loops don't go over it either
+uint32_t set_max_threads(uint32_t max_threads);
+
+//threads a parallel_for() made on this thread would run on, the limit clamped to the size of the pool
+uint32_t max_threads(void);
+
+//runs task(i, ctx) for every i in [0, num_tasks) and returns once all of them are done.
+//which thread runs which index isn't fixed. The calling thread runs tasks while it waits
+void parallel_for(size_t num_tasks, Task task, void* ctx);
+
+//runs task over the elements [0, n), split into a few chunks per thread. Ranges under min_size, or a limit of 1 thread,
+//are a single task(0, n, ctx) on the calling thread. Chunks start at multiples of 64 elements, so chunks of floats never
+//share a cache line
+void parallel_range(size_t n, size_t min_size, RangeTask task, void* ctx);
+
+#endif /* ThreadPool_h */
@@ -6,18 +6,41 @@
 //
 
 #include "Model/Training.h"
+#include "Model/Layer.h"
+#include "Model/Kernels.h"
+#include "Model/ThreadPool.h"
+#include "Model/Communicator.h"
+#include "Model/Prefetch.h"
+#include "Model/Random.h"
+#include "Model/Checkpoint.h"
 #include "pch.h"
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
 
+//parameter matrices at least this big have their Adam update split between threads
+#define PARALLEL_ADAM_SIZE (1 << 16)
+#define MAX_ADAM_CHUNKS 64
 
-typedef struct Gradients{
-    Matrix* weights;
-    Matrix* biases;
-} Gradients;
 
-typedef struct ForwardPassCache{
-    Matrix* activations;
-    Matrix* outputs;
-} ForwardPassCache;
+//the data points train() and train_rows() go through. Either column vectors of their own (inputs and observ), or the rows
+//of a block. Whichever it is, mini batches are gathered straight from them, nothing is made per data point
+typedef struct TrainingData{
+    Matrix* inputs; //NULL for rows
+    Matrix* observ;
+    DataRows rows;
+    uint32_t num_data_points;
+} TrainingData;
+
+//one process of train_distributed()
+typedef struct DistributedRank{
+    Communicator* comm;
+    uint32_t rank;
+    size_t num_params;
+    uint32_t num_mini_batches; //the same on every rank, even when the shards differ by a data point
+    float* averaged; //this rank's buffer, which holds the averaged gradients after every all reduce
+} DistributedRank;
+
 
 
 //write loss and gradient magnitude data to a file so it can later be plotted by a python script
@@ -59,87 +82,83 @@ static void write_meta_data(const char* path, float* loss_data, float* gradient_
     
 }
 
-static void free_gradient_matrices(Gradients* grads, uint16_t num_layers){
-    for (size_t i = 0; i < num_layers - 1; i++){
-        delete_matrix(grads->biases + i);
-        delete_matrix(grads->weights + i);
+//points the batch sized matrices of the workspace at the first batch_size columns of their memory
+static void set_batch_size(Model* m, Workspace* ws, uint32_t batch_size){
+    for (size_t i = 0; i < m->num_layers; i++){
+        ws->activations[i].cols = batch_size;
+        if (i != 0)
+            ws->outputs[i - 1].cols = batch_size;
     }
+    ws->observ.cols = batch_size;
 }
 
-static void reset_gradient_matrices(Gradients* grads, uint16_t num_layers){
-    for (size_t i = 0; i < num_layers - 1; i++){
-        set_values_with(grads->weights + i, 0.0f);
-        set_values_with(grads->biases + i, 0.0f);
-    }
-}
 
-static void free_cache_matrices(ForwardPassCache* cache, uint16_t num_layers){
-    //free data from a forward pass cache
-    for (size_t i = 0; i < num_layers; i++){
-        delete_matrix(cache->activations + i);
-        
-        if (i < num_layers - 1){
-            delete_matrix(cache->outputs + i);
-        }
-    }
-}
 
 
 
 
 
+//shuffles the order the data points are visited in. Starting over from 0, 1, 2... every epoch makes the order depend on
+//nothing but the generator, so training resumed from a checkpoint visits the data points the way it would have
+static void randomize_dataset(uint32_t* order, uint32_t num_data_points){
+    for (uint32_t i = 0; i < num_data_points; i++)
+        order[i] = i;
+    shuffle_indices(thread_rng(), order, num_data_points, num_data_points);
+}
+
 
+//the inputs or outputs of data point i, size values of them
+static const float* data_point(const TrainingData* data, uint8_t outputs, uint32_t i, size_t size){
+    if (data->inputs != NULL)
+        return (outputs ? data->observ : data->inputs)[i].values;
+    size_t row = data->rows.rows == NULL ? i : data->rows.rows[i];
+    return (outputs ? data->rows.outputs : data->rows.inputs) + row * size;
+}
 
-static Vector randomize_dataset(uint32_t num_data_points){
-    //generate a list of indices from which to sample from
-    Vector vec = create_vector(num_data_points);
-    for (uint32_t i = 0; i < num_data_points; i++)
-        push(&vec, i);
-    
-    Vector indices = create_vector(num_data_points);
-    //generare a random index, and then remove an element from the index array at that index
-    for (uint32_t i = 0; i < num_data_points; i++){
-        uint32_t idx = (uint32_t) ( vec.size * (rand() / (float) RAND_MAX) );
-        push(&indices, get(&vec, idx));
-        remove_at(&vec, idx);
+//copies the data points of a mini batch into the columns of a single matrix, so every layer can process the whole batch at once
+static void gather_batch(const TrainingData* data, uint8_t outputs, const uint32_t* order, uint32_t offset, Matrix* batch){
+    for (uint32_t b = 0; b < batch->cols; b++){
+        const float* point = data_point(data, outputs, order[offset + b], batch->rows);
+        for (size_t r = 0; r < batch->rows; r++)
+            batch->values[r * batch->cols + b] = point[r];
     }
-        
-    delete_vector(&vec);
-    return indices;
 }
 
+//same, for data points that are already the rows of a contiguous buffer
+static void gather_rows(const float* rows, Matrix* batch){
+    for (uint32_t b = 0; b < batch->cols; b++){
+        const float* point = rows + b * batch->rows;
+        for (size_t r = 0; r < batch->rows; r++)
+            batch->values[r * batch->cols + b] = point[r];
+    }
+}
 
-static void forward_prop(Model* m, Matrix* x, ForwardPassCache* cache){
-    //running value propogated through the network
-    Matrix running = matrix_copy(x);
-    //first activations stores the input for convience's sake in backProp
-    *(cache->activations + 0) = matrix_copy(x);
-    
+//the input batch has to be in activations[0] of the workspace
+static void forward_prop(Model* m, Workspace* ws){
     for (size_t i = 0; i < m->num_layers - 1; i++){
-        //when we copy a new value to running, the previous value's memory is lost. Be sure to delete it
-        Matrix before = running; //shallow copy
-        running = mult(m->weights + i, &running); //new matrix allocated by mult() function
-        delete_matrix(&before);
-        
-        //add the biases
-        add_in_place(&running, m->biases + i);
-        //store the raw output before the activation function
-        *(cache->outputs + i) = matrix_copy(&running);
-        //apply the activation function to the running matrix
-        act_func(&running, get(&m->activations, i));
-        //store the result of the activation function
-        *(cache->activations + i + 1) = matrix_copy(&running);
+        //weights, biases and activation function in one pass. The raw output before the activation function
+        //goes to outputs[i], and the result of the activation function to activations[i + 1]
+        layer_forward(m->weights + i, ws->activations + i, m->biases + i, get(&m->activations, i),
+                      ws->outputs + i, ws->activations + i + 1);
     }
     
-    //be sure to cleanup running. The output of the network is stored in activations[num_layers - 1]
-    delete_matrix(&running);
+    //The output of the network is stored in activations[num_layers - 1]
 }
 
-static void back_prop(Model* m, Matrix* observ, ForwardPassCache* cache, Gradients* grads){
+//the gradients are averaged over the batch with 1 / batch_size, and written over whatever was in the workspace before
+static void back_prop(Model* m, Workspace* ws){
     //Last value of the activations array is the final output of the network
-    Matrix* pred = cache->activations + (m->num_layers - 1);
-    //running derivative to be propogated down the network
-    Matrix running_deriv = loss_func_deriv(pred, observ, m->loss_func);
+    Matrix* pred = ws->activations + (m->num_layers - 1);
+    Matrix* observ = &ws->observ;
+    float batch_scale = 1.0f / m->params.batch_size;
+    
+    //running derivative to be propogated down the network. One column per data point.
+    //it lives in one of the two delta buffers, and the matrix products write to the other one
+    uint8_t current = 0;
+    Matrix* running_deriv = ws->deltas + current;
+    running_deriv->rows = pred->rows;
+    running_deriv->cols = pred->cols;
+    loss_func_deriv_into(pred, observ, m->loss_func, running_deriv);
  
     
     //the weight and bias matrices correspond to the last two layers (the input layer has neither weights nor biases)
@@ -148,232 +167,409 @@ static void back_prop(Model* m, Matrix* observ, ForwardPassCache* cache, Gradien
 
         //Get the activation functions derivative...
         Activation act = get(&m->activations, i);
-        act_func_deriv(cache->outputs + i, act, observ); //Stores the derivative in outputs[i]
+        act_func_deriv(ws->outputs + i, act, observ); //Stores the derivative in outputs[i]
         
         //element-wise-multiply the activation derivatives by running_deriv...
-        dot_in_place(&running_deriv, cache->outputs + i);
+        dot_in_place(running_deriv, ws->outputs + i);
         
-        //Get the derivative of the weights and biases and store them...
-        grads->biases[i] = matrix_copy(&running_deriv);
+        //Get the derivative of the biases, summed over the data points of the batch...
+        sum_columns(running_deriv, ws->bias_grads + i, batch_scale);
         
         //matrix multiply the outputs of layer - 1 (represented by activations[i]) and the running_deriv
-        //Transpose the activations so the resulting matrix has the same shape as the weights matrix
-        cache->activations[i]  = transpose(cache->activations + i);
-        grads->weights[i] = mult(&running_deriv, cache->activations + i);
+        //The activations are read transposed so the resulting matrix has the same shape as the weights matrix.
+        //The inner dimension is the batch, so this one product also sums the gradients of every data point
+        mult_trans_into(ws->weight_grads + i, running_deriv, NO_TRANSPOSE, ws->activations + i, TRANSPOSE, batch_scale);
         
         
         //Continue on with the chain rule by multiplying the weights transpose by the running_deriv
         if (i != 0){
-            m->weights[i] = transpose(m->weights + i);
-            
-            //since matrix multiplication creates a new matrix, we must delete the previous value of
-            //running_deriv to prevent a memory leak...
-            Matrix before = running_deriv;
-            running_deriv = mult(m->weights + i, &running_deriv);
-            delete_matrix(&before);
+            Matrix* next = ws->deltas + (current ^ 1);
+            next->rows = m->weights[i].cols;
+            next->cols = running_deriv->cols;
+            mult_trans_into(next, m->weights + i, TRANSPOSE, running_deriv, NO_TRANSPOSE, 1.0f);
             
-            m->weights[i] = transpose(m->weights + i); //undo transpose
+            current ^= 1;
+            running_deriv = next;
         }
     }
 }
 
-static void apply_gradients2(Model* m, Gradients* grads, float* gradient_mag, uint32_t time_step){
-    for (size_t i = 0; i < m->num_layers - 1; i++){
-        scalar_mult(grads->weights + i, m->params.learning_rate);
-        scalar_mult(grads->biases + i, m->params.learning_rate);
-
-        sub_in_place(m->weights + i, grads->weights + i);
-        sub_in_place(m->biases + i, grads->biases + i);
-        
-        if (gradient_mag != NULL){
-            *gradient_mag += magnitude(grads->weights + i);
-            *gradient_mag += magnitude(grads->biases + i);
-        }
-    }
+//grads is laid out like m->parameters
+static void apply_gradients2(Model* m, float* grads, float* gradient_mag){
+    kernels.scale(grads, m->params.learning_rate, m->num_parameters);
+    kernels.sub(m->parameters, grads, m->num_parameters);
+    if (gradient_mag != NULL)
+        *gradient_mag += kernels.sum_squares(grads, m->num_parameters);
 }
 
-static void apply_gradients(Model* m, Gradients* grads, float* gradient_mag, uint32_t time_step){
-    for (size_t i = 0; i < m->num_layers - 1; i++){
-        //Get the Mt and Vt of the current timestep...
-
-        //Mt Weights...
-        //Mt = B1 * Mt-1 + (1 - B1)Gt^1
-        scalar_mult(m->expwa_weights + i, m->params.momentum);
-        scalar_mult(grads->weights + i, 1.0f - m->params.momentum);
-        add_in_place(m->expwa_weights + i, grads->weights + i);
-        scalar_div(grads->weights + i, 1.0f - m->params.momentum); // undo multiplication
-
-        //Mt Biases...
-        //Mt = B1 * Mt-1 + (1 - B1)Gt^1
-        scalar_mult(m->expwa_biases + i, m->params.momentum);
-        scalar_mult(grads->biases + i, 1.0f - m->params.momentum);
-        add_in_place(m->expwa_biases + i, grads->biases + i);
-        scalar_div(grads->biases + i, 1.0f - m->params.momentum); // undo multiplication
-
-        //Vt Weights...
-        //Vt = B2 * Vt-1 + (1 - B2)Gt^2
-        scalar_mult(m->expwa_weights_squared + i, m->params.momentum2);
-        matrix_square(grads->weights + i);
-        scalar_mult(grads->weights + i, 1.0f - m->params.momentum2);
-        add_in_place(m->expwa_weights_squared + i, grads->weights + i);
-        //No need to undo multiplication, as the gradients will be reset after this
-
-        //Vt Biases...
-        //Vt = B2 * Vt-1 + (B2 - 1)Gt^2
-        scalar_mult(m->expwa_biases_squared + i, m->params.momentum2);
-        matrix_square(grads->biases + i);
-        scalar_mult(grads->biases + i, 1.0f - m->params.momentum2);
-        add_in_place(m->expwa_biases_squared + i, grads->biases + i);
-        //No need to undo multiplication, as the gradients will be reset after this
-
-        //We can't modify Vt and Mt, so make copies...
-        Matrix Vt_copy_weights = matrix_copy(m->expwa_weights_squared + i);
-        Matrix Vt_copy_biases = matrix_copy(m->expwa_biases_squared + i);
-        Matrix Mt_copy_weights = matrix_copy(m->expwa_weights + i);
-        Matrix Mt_copy_biases = matrix_copy(m->expwa_biases + i);
-
-        //Bias correct...
-        scalar_div(&Vt_copy_weights, 1.0f - powf(m->params.momentum, time_step));
-        scalar_div(&Vt_copy_biases, 1.0f - powf(m->params.momentum, time_step));
-        scalar_div(&Mt_copy_weights, 1.0f - powf(m->params.momentum2, time_step));
-        scalar_div(&Mt_copy_biases, 1.0f - powf(m->params.momentum2, time_step));
-
-        //Sqrt(Vt) + Epsillon
-        matrix_sqrt(&Vt_copy_weights);
-        scalar_add(&Vt_copy_weights, m->params.epsillon);
-        matrix_sqrt(&Vt_copy_biases);
-        scalar_add(&Vt_copy_biases, m->params.epsillon);
+//everything the threads of a Hogwild epoch share
+typedef struct HogwildContext{
+    Model* m;
+    const TrainingData* data;
+    const uint32_t* order;
+    float* losses; //one per thread, NULL if the loss isn't needed
+    float* gradient_mags; //same
+} HogwildContext;
+
+//one thread of a Hogwild epoch. It takes its own slice of the shuffled data and goes through it in pieces the size of its
+//workspace, applying each gradient as soon as it has it. The weights are read and written with plain loads and stores,
+//so a forward pass might see part of another thread's update. That's the whole idea, the updates are small enough not to matter
+static void hogwild_thread(size_t thread_index, void* ctx){
+    HogwildContext* hogwild = (HogwildContext*) ctx;
+    Model* m = hogwild->m;
+    Workspace* ws = m->workspaces + thread_index;
+    
+    uint32_t num_data_points = hogwild->data->num_data_points;
+    uint32_t begin = (uint32_t) ((uint64_t) num_data_points * thread_index / m->num_workspaces);
+    uint32_t end = (uint32_t) ((uint64_t) num_data_points * (thread_index + 1) / m->num_workspaces);
+    for (uint32_t offset = begin; offset < end; offset += ws->batch_size){
+        set_batch_size(m, ws, MIN(end - offset, ws->batch_size));
+        gather_batch(hogwild->data, 0, hogwild->order, offset, ws->activations + 0);
+        gather_batch(hogwild->data, 1, hogwild->order, offset, &ws->observ);
         
-        //a * ( 1 / Sqrt(Vt) + Epsillon )
-        reciprocal(&Vt_copy_weights);
-        reciprocal(&Vt_copy_biases);
-        scalar_mult(&Vt_copy_weights, m->params.learning_rate);
-        scalar_mult(&Vt_copy_biases, m->params.learning_rate);
+        forward_prop(m, ws);
+        back_prop(m, ws); //scaled by 1 / batch_size, so a whole mini batch worth of pieces moves the weights as far as one synchronous step
+        if (hogwild->losses != NULL)
+            hogwild->losses[thread_index] += loss_func(ws->activations + m->num_layers - 1, &ws->observ, m->loss_func);
         
-        dot_in_place(&Vt_copy_weights, &Mt_copy_weights);
-        dot_in_place(&Vt_copy_biases, &Mt_copy_biases);
+        apply_gradients2(m, ws->gradients, hogwild->gradient_mags == NULL ? NULL : hogwild->gradient_mags + thread_index);
+    }
+}
 
-        //calculation isnt done in the same order as the original equation, but still remains equivalent
-        //Mt * a * ( 1 / Sqrt(Vt) + Epsillon )
-        scalar_mult(&Vt_copy_weights, m->params.learning_rate);
-        scalar_mult(&Vt_copy_biases, m->params.learning_rate);
+typedef struct AdamChunks{
+    float* params;
+    float* moment;
+    float* moment2;
+    const float* grads;
+    size_t n;
+    size_t chunk_size;
+    const AdamStep* step;
+    float sums[MAX_ADAM_CHUNKS]; //squared updates of each chunk, added up in order afterwards
+} AdamChunks;
+
+static void adam_chunk(size_t index, void* ctx){
+    AdamChunks* chunks = (AdamChunks*) ctx;
+    size_t begin = index * chunks->chunk_size;
+    size_t end = begin + chunks->chunk_size < chunks->n ? begin + chunks->chunk_size : chunks->n;
+    chunks->sums[index] = kernels.adam(chunks->params + begin, chunks->moment + begin, chunks->moment2 + begin,
+                                       chunks->grads + begin, end - begin, chunks->step);
+}
 
-        //Gt+1 = Gt - a * Mt / Sqrt(Vt + Epsillon)
-        sub_in_place(m->weights + i, &Vt_copy_weights);
-        sub_in_place(m->biases + i, &Vt_copy_biases);
-        
-        //really tried avoiding making new matrices to avoid extra memory allocation
-        
-        if (gradient_mag != NULL){
-            *gradient_mag += magnitude(&Vt_copy_weights);
-            *gradient_mag += magnitude(&Vt_copy_biases);
-        }
+//the update is element wise, so splitting it changes nothing but the order the magnitude is summed in
+static float adam_update(float* params, float* moment, float* moment2, const float* grads, size_t n, const AdamStep* step){
+    uint32_t num_threads = max_threads();
+    if (num_threads == 1 || n < PARALLEL_ADAM_SIZE)
+        return kernels.adam(params, moment, moment2, grads, n, step);
+    
+    size_t num_chunks = num_threads * 4 < MAX_ADAM_CHUNKS ? num_threads * 4 : MAX_ADAM_CHUNKS;
+    AdamChunks chunks = {
+        .params = params, .moment = moment, .moment2 = moment2, .grads = grads, .n = n,
+        .chunk_size = (n + num_chunks - 1) / num_chunks,
+        .step = step,
+    };
+    num_chunks = (n + chunks.chunk_size - 1) / chunks.chunk_size;
+    parallel_for(num_chunks, adam_chunk, &chunks);
+    
+    float sum = 0.0f;
+    for (size_t i = 0; i < num_chunks; i++)
+        sum += chunks.sums[i];
+    return sum;
+}
 
-        //cleanup
-        delete_matrix(&Mt_copy_weights);
-        delete_matrix(&Mt_copy_biases);
-        delete_matrix(&Vt_copy_weights);
-        delete_matrix(&Vt_copy_biases);
+//grads is laid out like m->parameters
+static void apply_gradients(Model* m, float* grads, float* gradient_mag, uint32_t time_step){
+    //Gt+1 = Gt - a * Mt / (Sqrt(Vt) + Epsillon)
+    //keeps the same update the step by step version always made, so tuned learning rates carry over:
+    //the learning rate is applied twice, Mt is corrected by 1 - B2^t and Vt by 1 - B1^t
+    AdamStep step = {
+        .step_size = m->params.learning_rate * m->params.learning_rate,
+        .momentum = m->params.momentum,
+        .momentum2 = m->params.momentum2,
+        .epsillon = m->params.epsillon,
+        .correction = 1.0f / (1.0f - powf(m->params.momentum2, time_step)),
+        .correction2 = 1.0f / (1.0f - powf(m->params.momentum, time_step)),
+    };
+    
+    //one pass over every parameter of the model, which updates Mt, Vt and the parameters together (see Kernels.c).
+    //the padding between the matrices is zero in all four buffers, and stays zero
+    float mag = adam_update(m->parameters, m->moments, m->moments_squared, grads, m->num_parameters, &step);
+    if (gradient_mag != NULL)
+        *gradient_mag += mag;
+}
 
+//everything the threads working on one mini batch share
+typedef struct StepContext{
+    Model* m;
+    //the mini batch, one data point per row (batch_size x features), as the prefetcher gathered it
+    const float* batch_inputs;
+    const float* batch_observ;
+    uint32_t batch_size; //size of this mini batch, the last one of an epoch can be smaller
+    uint32_t share; //data points per thread
+    uint32_t num_shares; //threads that actually got data points
+    float* losses; //one per share, NULL if the loss isn't needed
+} StepContext;
+
+//runs one thread's share of the mini batch through the network. The gradients end up in that share's workspace
+static void retrieve_gradients(size_t share_index, void* ctx){
+    StepContext* step = (StepContext*) ctx;
+    Model* m = step->m;
+    Workspace* ws = m->workspaces + share_index;
+    
+    //transpose this share's rows of the mini batch into (features x share) matrices
+    uint32_t start = (uint32_t) share_index * step->share;
+    uint32_t end = MIN(step->batch_size, start + step->share); //do not exceed the mini batch
+    set_batch_size(m, ws, end - start);
+    gather_rows(step->batch_inputs + (size_t) start * ws->activations[0].rows, ws->activations + 0);
+    gather_rows(step->batch_observ + (size_t) start * ws->observ.rows, &ws->observ);
+    
+    //the entire share goes through the network at once, so every layer is a matrix-matrix product
+    forward_prop(m, ws);
+    back_prop(m, ws);
+    
+    if (step->losses != NULL)
+        step->losses[share_index] = loss_func(ws->activations + m->num_layers - 1, &ws->observ, m->loss_func);
+}
 
+//tree reduction of every share's gradients into the first workspace: share 1 is added into 0, 3 into 2, ...
+//then 2 into 0, and so on. The pairs never depend on timing, so the sums come out bit for bit the same every run.
+//the gradient buffer is split into one slice per thread, on cache line boundaries, and each thread reduces its own slice
+//through the whole tree
+static void reduce_gradients(size_t slice, void* ctx){
+    StepContext* step = (StepContext*) ctx;
+    Model* m = step->m;
+    size_t num_slices = m->num_workspaces;
+    size_t num_lines = m->num_parameters / (ALLOCATOR_ALIGNMENT / sizeof(float));
+    size_t begin = num_lines * slice / num_slices * (ALLOCATOR_ALIGNMENT / sizeof(float));
+    size_t end = num_lines * (slice + 1) / num_slices * (ALLOCATOR_ALIGNMENT / sizeof(float));
+    
+    for (uint32_t stride = 1; stride < step->num_shares; stride *= 2){
+        for (uint32_t w = 0; w + stride < step->num_shares; w += 2 * stride)
+            kernels.add(m->workspaces[w].gradients + begin, m->workspaces[w + stride].gradients + begin, end - begin);
     }
 }
 
-static void retrieve_gradients(Model* m, Matrix* inputs, Matrix* observ, Vector* indices, uint32_t offset, uint32_t num_data_points, Gradients* collective_grads, float* cumulative_loss){
+//runs one mini batch through the network, split across the model's threads. The summed gradients end up in the first workspace
+static void compute_batch_gradients(StepContext* step, float* cumulative_loss){
+    Model* m = step->m;
+    step->num_shares = (step->batch_size + step->share - 1) / step->share;
     
-    //allocate the gradients that will be used from datapoint to datapoint
-    Gradients grads;
-    grads.weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    grads.biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
+    parallel_for(step->num_shares, retrieve_gradients, step);
+    if (step->num_shares > 1)
+        parallel_for(m->num_workspaces, reduce_gradients, step);
     
-    //allocate the cache used to store data from the forward pass
-    ForwardPassCache cache;
-    cache.activations = (Matrix*) calloc(sizeof(Matrix), m->num_layers);
-    cache.outputs = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    
-
-    //now go through the random data-indices and generate gradients
-    uint32_t size = MIN(num_data_points, offset + m->params.batch_size); //do not exceed data set size
-    for (uint32_t i = offset; i < size; i++){
-        uint32_t idx = get(indices, i); //data index
-        forward_prop(m, inputs + idx, &cache);
-        back_prop(m, observ + idx, &cache, &grads);
-        
-        for (size_t j = 0; j < m->num_layers - 1; j++){
-            //average the weights and biases collected from the batch
-            // 1/batch_size * (grads1 + grads2 + gradsn...) = 1/batch_size * grads1 + 1/batch_size * grads2 +...
-            scalar_div(grads.weights + j, m->params.batch_size);
-            scalar_div(grads.biases + j, m->params.batch_size);
-            
-            //add them to a collective gradient for the entire batch
-            add_in_place(collective_grads->weights + j, grads.weights + j);
-            add_in_place(collective_grads->biases + j, grads.biases + j);
-        }
-        
-        //add to the cumulative loss
-        if (cumulative_loss != NULL)
-            *cumulative_loss += loss_func(cache.activations + m->num_layers - 1, observ + idx, m->loss_func);
-        
-        //free the matrices, as they will be replaced in the next iteration and memory will be leaked
-        free_cache_matrices(&cache, m->num_layers);
-        free_gradient_matrices(&grads, m->num_layers);
+    //add to the cumulative loss, in a fixed order as well
+    if (cumulative_loss != NULL){
+        for (uint32_t t = 0; t < step->num_shares; t++)
+            *cumulative_loss += step->losses[t];
     }
+}
+
+
+//averages the gradients of this mini batch with the other ranks'. A rank whose shard ran out adds zeros.
+//the buffers of the communicator are laid out like m->parameters, and the loss of the batch is summed along after them
+static void average_gradients(Model* m, DistributedRank* dist, uint32_t batch_size, float* batch_loss){
+    float* buffer = rank_buffer(dist->comm, dist->rank);
+    if (batch_size != 0)
+        memcpy(buffer, m->workspaces[0].gradients, sizeof(float) * dist->num_params);
+    else
+        memset(buffer, 0, sizeof(float) * dist->num_params);
+    buffer[dist->num_params] = *batch_loss;
     
-    //free the containers for the cache...
-    free(cache.activations);
-    free(cache.outputs);
+    uint32_t num_ranks = dist->comm->num_ranks;
+    all_reduce(dist->comm, dist->rank, dist->num_params + 1, 1.0f / num_ranks);
+    *batch_loss = buffer[dist->num_params] * num_ranks;
+}
+
+//what the prefetch thread of perform_epoch() gathers the mini batches from
+typedef struct ShuffledData{
+    const TrainingData* data;
+    const uint32_t* order;
+    size_t num_inputs;
+    size_t num_outputs;
+} ShuffledData;
+
+//copies the data points of mini batch batch_index, in the shuffled order, into consecutive rows
+static uint32_t gather_shuffled_batch(void* ctx, uint32_t batch_index, uint32_t batch_size, float* inputs, float* outputs){
+    ShuffledData* shuffled = (ShuffledData*) ctx;
+    uint32_t num_data_points = shuffled->data->num_data_points;
+    uint32_t offset = batch_index * batch_size;
+    if (offset >= num_data_points)
+        return 0;
     
-    //and gradients...
-    free(grads.weights);
-    free(grads.biases);
+    uint32_t n = MIN(num_data_points - offset, batch_size);
+    size_t input_size = shuffled->num_inputs, output_size = shuffled->num_outputs;
+    for (uint32_t b = 0; b < n; b++){
+        uint32_t index = shuffled->order[offset + b];
+        memcpy(inputs + b * input_size, data_point(shuffled->data, 0, index, input_size), sizeof(float) * input_size);
+        memcpy(outputs + b * output_size, data_point(shuffled->data, 1, index, output_size), sizeof(float) * output_size);
+    }
+    return n;
+}
+
+static uint32_t next_source_batch(void* ctx, uint32_t batch_index, uint32_t batch_size, float* inputs, float* outputs){
+    (void) batch_index; //a source only ever goes forward, the batches come in order anyway
+    DataSource* source = (DataSource*) ctx;
+    return source->next_batch(source, inputs, outputs, batch_size);
 }
 
+static void start_model_prefetch(Model* m, Prefetcher* prefetcher, uint32_t num_batches, ProduceBatch produce, void* ctx){
+    uint32_t num_inputs = (uint32_t) get(&m->layer_sizes, 0), num_outputs = (uint32_t) get(&m->layer_sizes, m->num_layers - 1);
+    start_prefetch(prefetcher, &m->pool, m->params.prefetch_depth, num_batches, m->params.batch_size, num_inputs, num_outputs, produce, ctx);
+}
 
-static void perform_epoch(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points, uint32_t epoch, float* cumulative_loss, float* gradient_mag){
+//dist is NULL unless this is one process of train_distributed()
+static void perform_epoch(Model* m, const TrainingData* data, uint32_t* order, uint32_t epoch, DistributedRank* dist, float* cumulative_loss, float* gradient_mag, size_t* step_allocations, float* stall){
+    uint32_t num_data_points = data->num_data_points;
     
     //add +1 to the number of batches if num_data_points doesn't divide evenly by the batch size (we have some data points left over)
     uint32_t num_mini_batches = num_data_points / m->params.batch_size + (num_data_points % m->params.batch_size != 0);
+    if (dist != NULL)
+        num_mini_batches = dist->num_mini_batches;
     
-    Gradients collective_grads;
-    collective_grads.weights = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    collective_grads.biases = (Matrix*) calloc(sizeof(Matrix), m->num_layers - 1);
-    
-    for (size_t i = 0; i < m->num_layers - 1; i++){
-        collective_grads.weights[i] = create_matrix(m->weights[i].rows, m->weights[i].cols);
-        collective_grads.biases[i] = create_matrix(m->biases[i].rows, m->biases[i].cols);
-    }
+    //the gradients of every mini batch are summed into the first workspace, or averaged with the other ranks into the communicator
+    float* collective_grads = dist == NULL ? m->workspaces[0].gradients : dist->averaged;
     
     //randomize the order of the dataset
-    //TODO make this only a small portion of the dataset
-    Vector indices = randomize_dataset(num_data_points);
-    //data offset to be used by the retrieve_gradients() function
-    uint32_t offset = 0;
+    randomize_dataset(order, num_data_points);
+    
+    //batch i + 1 is gathered in the background while batch i is computed. The random reads into the dataset are what's
+    //slow, so the trainer only ever reads the contiguous copy
+    ShuffledData shuffled = {
+        .data = data,
+        .order = order,
+        .num_inputs = (size_t) get(&m->layer_sizes, 0),
+        .num_outputs = (size_t) get(&m->layer_sizes, m->num_layers - 1),
+    };
+    Prefetcher prefetcher;
+    start_model_prefetch(m, &prefetcher, num_mini_batches, gather_shuffled_batch, &shuffled);
+    
+    float* losses = cumulative_loss == NULL ? NULL : (float*) calloc(sizeof(float), m->num_workspaces);
+    StepContext step = {
+        .m = m,
+        .share = m->workspaces[0].batch_size,
+        .losses = losses,
+    };
+    
+    //anything a step allocates only lives until the end of that step
+    Allocator* previous = use_allocator(&m->step_arena);
     for (uint32_t i = 0; i < num_mini_batches; i++){
-        retrieve_gradients(m, inputs, observ, &indices, offset, num_data_points, &collective_grads, cumulative_loss);
-        apply_gradients(m, &collective_grads, gradient_mag, epoch + 1 + i);
-        //reset gradients to 0-matrices. No need to delete their matrices
-        reset_gradient_matrices(&collective_grads, m->num_layers);
-        offset += m->params.batch_size;
+        size_t allocations_before = allocation_count();
+        
+        //a distributed rank whose shard ran out gets 0 data points
+        step.batch_size = next_prefetched(&prefetcher, &step.batch_inputs, &step.batch_observ);
+        if (dist == NULL)
+            compute_batch_gradients(&step, cumulative_loss);
+        else{
+            float batch_loss = 0.0f;
+            if (step.batch_size != 0)
+                compute_batch_gradients(&step, cumulative_loss == NULL ? NULL : &batch_loss);
+            average_gradients(m, dist, step.batch_size, &batch_loss);
+            if (cumulative_loss != NULL)
+                *cumulative_loss += batch_loss;
+        }
+        //the gradients are overwritten every batch, so there's no need to reset them
+        apply_gradients(m, collective_grads, gradient_mag, epoch + 1 + i);
+        
+        *step_allocations += allocation_count() - allocations_before;
+        arena_reset(&m->step_arena);
     }
+    use_allocator(previous);
     
     //cleanup
-    delete_vector(&indices);
-    free_gradient_matrices(&collective_grads, m->num_layers);
-    free(collective_grads.weights);
-    free(collective_grads.biases);
+    stop_prefetch(&prefetcher);
+    *stall += (float) prefetcher.stall_seconds;
+    free(losses);
 }
 
-uint8_t train(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points, uint32_t num_epochs, const char* file_name){
+//an epoch of Hogwild training, see ModelParams.hogwild. Threads only ever touch their own workspace, except for the parameters
+static void perform_hogwild_epoch(Model* m, const TrainingData* data, uint32_t* order, float* cumulative_loss, float* gradient_mag){
+    randomize_dataset(order, data->num_data_points);
+    HogwildContext hogwild = {
+        .m = m,
+        .data = data,
+        .order = order,
+        .losses = cumulative_loss == NULL ? NULL : (float*) calloc(sizeof(float), m->num_workspaces),
+        .gradient_mags = gradient_mag == NULL ? NULL : (float*) calloc(sizeof(float), m->num_workspaces),
+    };
     
-    //do some validation...
-    if (num_data_points < m->params.batch_size || num_data_points <= 0){
-        delete_model(m);
-        printf("ERROR: Bad parameters for train function. Exiting...\n");
-        return 0;
+    parallel_for(m->num_workspaces, hogwild_thread, &hogwild);
+    
+    for (uint32_t t = 0; t < m->num_workspaces; t++){
+        if (cumulative_loss != NULL)
+            *cumulative_loss += hogwild.losses[t];
+        if (gradient_mag != NULL)
+            *gradient_mag += hogwild.gradient_mags[t];
+    }
+    
+    free(hogwild.losses);
+    free(hogwild.gradient_mags);
+}
+
+//an epoch over whatever the source gives us. Only a few mini batches of it are in memory at a time
+static void perform_stream_epoch(Model* m, DataSource* source, uint32_t epoch, float* cumulative_loss, float* gradient_mag, size_t* step_allocations, float* stall){
+    float* collective_grads = m->workspaces[0].gradients;
+    
+    source->begin_epoch(source);
+    Prefetcher prefetcher;
+    start_model_prefetch(m, &prefetcher, UINT32_MAX, next_source_batch, source);
+    
+    float* losses = cumulative_loss == NULL ? NULL : (float*) calloc(sizeof(float), m->num_workspaces);
+    StepContext step = {
+        .m = m,
+        .share = m->workspaces[0].batch_size,
+        .losses = losses,
+    };
+    
+    Allocator* previous = use_allocator(&m->step_arena);
+    for (uint32_t i = 0; ; i++){
+        step.batch_size = next_prefetched(&prefetcher, &step.batch_inputs, &step.batch_observ);
+        if (step.batch_size == 0)
+            break;
+        
+        size_t allocations_before = allocation_count();
+        compute_batch_gradients(&step, cumulative_loss);
+        apply_gradients(m, collective_grads, gradient_mag, epoch + 1 + i);
+        *step_allocations += allocation_count() - allocations_before;
+        arena_reset(&m->step_arena);
+    }
+    use_allocator(previous);
+    
+    stop_prefetch(&prefetcher);
+    *stall += (float) prefetcher.stall_seconds;
+    free(losses);
+}
+
+//the training loop of every train function and of every process of train_distributed(). The data either comes from
+//data, or from source if it isn't NULL
+static uint8_t train_process(Model* m, const TrainingData* data, DataSource* source, uint32_t num_epochs, const char* file_name, DistributedRank* dist){
+    uint32_t num_data_points = data == NULL ? 0 : data->num_data_points;
+    
+    //seed the shuffles, unless this goes on from an earlier train() or a checkpoint. Each rank shuffles its shard differently
+    uint32_t rank = dist == NULL ? 0 : dist->rank;
+    if (m->progress.epochs == 0){
+        uint64_t seed = m->params.seed != 0 ? m->params.seed : (uint64_t) time(0);
+        seed_random(seed + rank);
     }
-       
-    //initialize rand function with a seed
-    srand((unsigned int) time(0)); //cast to get rid of warning...
+    else{
+        *thread_rng() = m->progress.rng;
+        if (rank != 0)
+            seed_random(next_random(thread_rng()) + rank);
+    }
+    
+    //the order the data points are visited in, shuffled again at the start of every epoch
+    uint32_t* order = (uint32_t*) allocator_alloc(&m->pool, sizeof(uint32_t) * (num_data_points == 0 ? 1 : num_data_points));
+    
+    //everything the training loop runs in parallel stays within the model's share of the thread pool
+    uint32_t previous_max_threads = set_max_threads(m->params.num_threads);
+    //one share of the batch per thread the pool can actually give us, asking for more than there are cores only adds overhead
+    uint32_t num_threads = max_threads();
+    
+    //the workspaces are sized by compile(), but the batch size or thread count might have been changed since
+    uint32_t share = (m->params.batch_size + num_threads - 1) / num_threads;
+    if (m->workspaces == NULL || m->num_workspaces != num_threads || m->workspaces[0].batch_size != share)
+        create_workspaces(m, m->params.batch_size, num_threads);
+    //a loaded model, or one compiled for inference, doesn't have it yet
+    create_optimizer_state(m);
     
     //prepare data arrays if we're writing the loss and gradient magnitude data to a file
     float* loss_data = NULL;
@@ -384,30 +580,54 @@ uint8_t train(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points
         gradient_mag_data = (float*) calloc(sizeof(float), num_epochs);
     }
 
-    uint32_t num_loss_increases = 0; //number of times loss has increased
-    float loss = 0.0f, gradient_mag = 0.0f;
+    //only rank 0 writes checkpoints, the others have the same state anyway
+    uint8_t checkpointing = m->params.checkpoint_path != NULL && m->params.checkpoint_interval != 0 && rank == 0;
+    Checkpointer checkpointer;
+    if (checkpointing)
+        start_checkpointer(&checkpointer, m->params.checkpoint_path);
+    
+    float gradient_mag = 0.0f;
     float cumulative_time = 0.0f;
+    m->prefetch_stall = 0.0f;
+    m->checkpoint_stall = 0.0f;
     
     for (uint32_t i = 0; i < num_epochs; i++){
         
         float curr_loss = 0.0f;
         gradient_mag = 0.0f; //reset the gradient magnitude each iteration
         float* grad_p = m->params.verbose == 2 || write_to_file ? &gradient_mag : NULL;
-        float* loss_p = m->params.verbose >= 1 || m->use_tuning || write_to_file ? &curr_loss : NULL;
+        //every rank needs the loss when training distributed, so they all tune the learning rate the same way
+        float* loss_p = m->params.verbose >= 1 || m->use_tuning || write_to_file || dist != NULL ? &curr_loss : NULL;
         
         //time how long each epoch takes and add it to a total
         clock_t begin = clock();
-        perform_epoch(m, inputs, observ, num_data_points, i, loss_p, grad_p);
+        size_t step_allocations = 0;
+        //the ranks of distributed training have to take their steps together, so they never run Hogwild
+        if (source != NULL)
+            perform_stream_epoch(m, source, m->progress.epochs, loss_p, grad_p, &step_allocations, &m->prefetch_stall);
+        else if (m->params.hogwild && dist == NULL)
+            perform_hogwild_epoch(m, data, order, loss_p, grad_p);
+        else
+            perform_epoch(m, data, order, m->progress.epochs, dist, loss_p, grad_p, &step_allocations, &m->prefetch_stall);
         clock_t end = clock();
         cumulative_time += (float)(end - begin) / CLOCKS_PER_SEC;
         
         //printing information
         if (m->params.verbose >= 1){
-            printf("Epoch #%d, Loss: %f", i, loss);
+            printf("Epoch #%d, Loss: %f", i, m->progress.last_loss);
             if (m->params.verbose >= 2){
                 printf(", Gradient Magnitude: %f", gradient_mag);
-                if (m->params.verbose == 3)
-                    printf(", Average time per epoch: %fs\n, ", cumulative_time / i);
+                if (m->params.verbose == 3){
+                    printf(", Average time per epoch: %fs", cumulative_time / i);
+                    printf(", Waiting for mini batches: %fs", m->prefetch_stall);
+                    if (checkpointing)
+                        printf(", Checkpointing: %fs", (float) checkpointer.stall_seconds);
+#ifdef DEBUG
+                    //should stay at 0, everything a training step needs is in the workspace
+                    printf(", Allocations in training steps: %zu", step_allocations);
+#endif
+                    printf("\n, ");
+                }
                 else
                     printf("\n");
             }
@@ -423,16 +643,33 @@ uint8_t train(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points
         
         
         //learning rate scheduler
-        if (i != 0 && m->use_tuning && curr_loss < loss){
-            num_loss_increases++;
+        TrainingProgress* progress = &m->progress;
+        if (progress->epochs != 0 && m->use_tuning && curr_loss < progress->last_loss){
+            progress->num_loss_increases++;
             
-            if (num_loss_increases == m->tuning.patience){
+            if (progress->num_loss_increases == m->tuning.patience){
                 m->params.learning_rate = MAX(m->params.learning_rate * m->tuning.decrease, m->tuning.min);
-                num_loss_increases = 0;
+                progress->num_loss_increases = 0;
             }
         }
         
-        loss = curr_loss;
+        progress->last_loss = curr_loss;
+        progress->epochs++;
+        progress->rng = *thread_rng();
+        
+        //only the snapshot holds up training, the next epoch runs while it's written
+        if (checkpointing && (progress->epochs % m->params.checkpoint_interval == 0 || i == num_epochs - 1))
+            checkpoint_async(&checkpointer, m);
+    }
+    
+    //the last checkpoint is on disk by the time train() returns. The model is trained either way, but a checkpoint that
+    //couldn't be written fails the training, there'd be nothing to resume from
+    uint8_t success = 1;
+    if (checkpointing){
+        m->checkpoint_stall = (float) checkpointer.stall_seconds;
+        success = stop_checkpointer(&checkpointer);
+        if (!success)
+            fprintf(stderr, "ERROR: Not every checkpoint could be written to %s. Returning...\n", m->params.checkpoint_path);
     }
     
     //finally writing data to a file, then freeing it
@@ -442,6 +679,186 @@ uint8_t train(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points
         free(gradient_mag_data);
     }
     
-    return 1;
+    allocator_free(&m->pool, order);
+    set_max_threads(previous_max_threads);
+    return success;
+    
+}
+
+//whether the data can be trained on, one batch at least and as many inputs and outputs as the model has
+static uint8_t check_training_data(Model* m, const TrainingData* data){
+    if (data->num_data_points < m->params.batch_size || data->num_data_points <= 0)
+        return 0;
+    return data->inputs != NULL || (data->rows.num_inputs == (uint32_t) get(&m->layer_sizes, 0) &&
+                                     data->rows.num_outputs == (uint32_t) get(&m->layer_sizes, m->num_layers - 1));
+}
+
+static TrainingData matrix_data(Matrix* inputs, Matrix* observ, uint32_t num_data_points){
+    TrainingData data = { .inputs = inputs, .observ = observ, .num_data_points = num_data_points };
+    return data;
+}
+
+static TrainingData row_data(const DataRows* rows){
+    TrainingData data = { .rows = *rows, .num_data_points = rows->num_data_points };
+    return data;
+}
+
+static uint8_t train_data(Model* m, const TrainingData* data, uint32_t num_epochs, const char* file_name){
+    
+    //do some validation...
+    if (!check_training_data(m, data)){
+        delete_model(m);
+        printf("ERROR: Bad parameters for train function. Exiting...\n");
+        return 0;
+    }
+    
+    return train_process(m, data, NULL, num_epochs, file_name, NULL);
+}
+
+uint8_t train(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points, uint32_t num_epochs, const char* file_name){
+    TrainingData data = matrix_data(inputs, observ, num_data_points);
+    return train_data(m, &data, num_epochs, file_name);
+}
+
+uint8_t train_rows(Model* m, const DataRows* rows, uint32_t num_epochs, const char* file_name){
+    TrainingData data = row_data(rows);
+    return train_data(m, &data, num_epochs, file_name);
+}
+
+uint8_t train_stream(Model* m, DataSource* source, uint32_t num_epochs, const char* file_name){
+    if (source == NULL || source->num_inputs != (uint32_t) get(&m->layer_sizes, 0) || source->num_outputs != (uint32_t) get(&m->layer_sizes, m->num_layers - 1)){
+        fprintf(stderr, "ERROR: The data source doesn't match the input and output layers of the model. Returning...\n");
+        return 0;
+    }
+    
+    return train_process(m, NULL, source, num_epochs, file_name, NULL);
+}
+
+
+
+//data points [begin, end) of data, without copying any
+static TrainingData shard_of(const TrainingData* data, uint32_t begin, uint32_t end){
+    TrainingData shard = *data;
+    shard.num_data_points = end - begin;
+    shard.rows.num_data_points = end - begin;
+    if (data->inputs != NULL){
+        shard.inputs += begin;
+        shard.observ += begin;
+    }
+    else if (data->rows.rows != NULL)
+        shard.rows.rows += begin;
+    else{
+        shard.rows.inputs += (size_t) begin * data->rows.num_inputs;
+        shard.rows.outputs += (size_t) begin * data->rows.num_outputs;
+    }
+    return shard;
+}
+
+//one process of train_distributed(), working on its own shard of the data
+static uint8_t train_rank(Model* m, const TrainingData* data, uint32_t num_epochs, const char* file_name,
+                          Communicator* comm, uint32_t rank, size_t num_params){
+    uint32_t num_data_points = data->num_data_points;
+    uint32_t k = comm->num_ranks;
+    uint32_t begin = (uint32_t) ((uint64_t) num_data_points * rank / k);
+    uint32_t end = (uint32_t) ((uint64_t) num_data_points * (rank + 1) / k);
+    uint32_t largest_shard = (num_data_points + k - 1) / k;
+    
+    //only rank 0 reports anything
+    if (rank != 0){
+        m->params.verbose = 0;
+        file_name = NULL;
+    }
+    
+    //start from rank 0's weights. fork() already copied them, but this way the ranks agree no matter what happened in between
+    float* buffer = rank_buffer(comm, rank);
+    memcpy(buffer, m->parameters, sizeof(float) * num_params);
+    broadcast(comm, rank, num_params);
+    memcpy(m->parameters, buffer, sizeof(float) * num_params);
+    
+    DistributedRank dist = {
+        .comm = comm,
+        .rank = rank,
+        .num_params = num_params,
+        .num_mini_batches = largest_shard / m->params.batch_size + (largest_shard % m->params.batch_size != 0),
+        .averaged = buffer,
+    };
+    TrainingData shard = shard_of(data, begin, end);
+    return train_process(m, &shard, NULL, num_epochs, file_name, &dist);
+}
+
+static uint8_t train_data_distributed(Model* m, const TrainingData* data, uint32_t num_epochs, uint32_t num_processes, const char* file_name){
+    if (num_processes <= 1)
+        return train_data(m, data, num_epochs, file_name);
+    
+    uint32_t num_data_points = data->num_data_points;
+    if (num_data_points / num_processes < m->params.batch_size){
+        fprintf(stderr, "ERROR: %u data points can't be split into %u shards of at least one batch. Returning...\n", num_data_points, num_processes);
+        return 0;
+    }
+    if (!check_training_data(m, data)){
+        fprintf(stderr, "ERROR: The data doesn't match the input and output layers of the model. Returning...\n");
+        return 0;
+    }
+    
+    size_t num_params = m->num_parameters;
+    Communicator comm = create_communicator(num_processes, num_params + 1); //+1 for the loss
+    
+    //threads don't survive fork(), so stop the pool and let every process start its own.
+    //the cores are split between the processes, so together they don't start more threads than there are cores
+    shutdown_thread_pool();
+    long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t cores_per_process = num_cores > num_processes ? (uint32_t) num_cores / num_processes : 1;
+    uint32_t previous_num_threads = m->params.num_threads;
+    if (m->params.num_threads == 0 || m->params.num_threads > cores_per_process)
+        m->params.num_threads = cores_per_process;
+    fflush(stdout); //or the children print whatever was buffered again
+    
+    //this process is rank 0, so it ends up with the trained model
+    pid_t* children = (pid_t*) calloc(num_processes, sizeof(pid_t));
+    for (uint32_t rank = 1; rank < num_processes; rank++){
+        pid_t pid = fork();
+        if (pid == 0){
+            uint8_t success = train_rank(m, data, num_epochs, file_name, &comm, rank, num_params);
+            _exit(success ? 0 : 1);
+        }
+        
+        if (pid < 0){
+            //the ones already running would wait for this rank forever
+            fprintf(stderr, "ERROR: Could not start training process %u. Returning...\n", rank);
+            for (uint32_t r = 1; r < rank; r++){
+                kill(children[r], SIGKILL);
+                waitpid(children[r], NULL, 0);
+            }
+            free(children);
+            delete_communicator(&comm);
+            m->params.num_threads = previous_num_threads;
+            return 0;
+        }
+        children[rank] = pid;
+    }
+    
+    uint8_t success = train_rank(m, data, num_epochs, file_name, &comm, 0, num_params);
+    for (uint32_t rank = 1; rank < num_processes; rank++){
+        int status = 0;
+        waitpid(children[rank], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0){
+            fprintf(stderr, "ERROR: Training process %u failed\n", rank);
+            success = 0;
+        }
+    }
     
+    free(children);
+    delete_communicator(&comm);
+    m->params.num_threads = previous_num_threads;
+    return success;
+}
+
+uint8_t train_distributed(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points, uint32_t num_epochs, uint32_t num_processes, const char* file_name){
+    TrainingData data = matrix_data(inputs, observ, num_data_points);
+    return train_data_distributed(m, &data, num_epochs, num_processes, file_name);
+}
+
+uint8_t train_rows_distributed(Model* m, const DataRows* rows, uint32_t num_epochs, uint32_t num_processes, const char* file_name){
+    TrainingData data = row_data(rows);
+    return train_data_distributed(m, &data, num_epochs, num_processes, file_name);
 }
@@ -9,9 +9,28 @@
 #define Training_h
 
 #include "Model/Model.h"
+#include "Model/DataSource.h"
 
-//trains the model. Optionally writes training data to a file. If NULL is passed in for the string, no such data will be written
+//trains the model. Optionally writes training data to a file. If NULL is passed in for the string, no such data will be written.
+//training goes on from where the last train() or load_checkpoint() left off: the Adam timestep, learning rate tuning and
+//shuffles all pick up from Model.progress. Returns 0 if the data doesn't fit the model, or if a checkpoint couldn't be written
 uint8_t train(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points, uint32_t num_epochs, const char* file_name);
 
+//same as train(), for data points that are the rows of a block, like a dataset or one half of a split (see data_rows()).
+//each mini batch is gathered straight out of the rows
+uint8_t train_rows(Model* m, const DataRows* rows, uint32_t num_epochs, const char* file_name);
+
+//trains the model on mini batches pulled from source, so the data never has to be in memory all at once.
+//the source decides the order of the data points, and the hogwild option is ignored
+uint8_t train_stream(Model* m, DataSource* source, uint32_t num_epochs, const char* file_name);
+
+//trains the model with num_processes copies of this process, forked off on this machine. Each one owns a shard of the data,
+//and the gradients of every mini batch are averaged between them through shared memory, so a step sees num_processes mini batches.
+//every process starts from this one's weights, and this one ends up with the trained model. Only it prints or writes the file
+uint8_t train_distributed(Model* m, Matrix* inputs, Matrix* observ, uint32_t num_data_points, uint32_t num_epochs, uint32_t num_processes, const char* file_name);
+
+//same as train_distributed(), for rows of a block. The processes share the block through fork(), each reads its own shard
+uint8_t train_rows_distributed(Model* m, const DataRows* rows, uint32_t num_epochs, uint32_t num_processes, const char* file_name);
+
 
 #endif /* Training_h */
@@ -6,224 +6,620 @@
 //
 
 #include "core/Data Loader.h"
+#include "Model/ThreadPool.h"
+#include "Model/Random.h"
+#include "Model/Checksum.h"
+#include "Model/FileIO.h"
 #include "pch.h"
+#include <fcntl.h>
+#include <float.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+//a csv is parsed in this many chunks per thread, so a thread that's done early can take another one
+#define CHUNKS_PER_THREAD 4
+#define MAX_CSV_CHUNKS 1024
+//smaller chunks aren't worth a task
+#define MIN_CHUNK_BYTES (1 << 20)
 
-#define CHAR_BUFF_SIZE 8000
+static _Thread_local LoadReport last_report;
 
 
-
-uint32_t num_datapoints_of_csv(const char* path){
-    FILE* file_ptr;
-    file_ptr = fopen(path, "r");
+Data create_data(uint32_t num_data_points, uint32_t num_inputs, uint32_t num_outputs){
+    Data data = {
+        .num_data_points = num_data_points,
+        .num_inputs = num_inputs,
+        .num_outputs = num_outputs,
+    };
     
-    if (file_ptr == NULL){
-        fprintf(stderr, "ERROR: Could not open file in num_rows_of_csv. Exiting...\n");
-        fclose(file_ptr);
+    //the outputs start on a fresh cache line, so both halves stay aligned
+    size_t input_floats = (size_t) num_data_points * num_inputs;
+    size_t floats_per_line = ALLOCATOR_ALIGNMENT / sizeof(float);
+    input_floats = (input_floats + floats_per_line - 1) / floats_per_line * floats_per_line;
+    data.values = (float*) allocator_alloc(NULL, sizeof(float) * (input_floats + (size_t) num_data_points * num_outputs));
+    data.inputs = data.values;
+    data.outputs = data.values + input_floats;
+    return data;
+}
+
+float* data_inputs(Data* data, uint32_t i){
+    return data->inputs + (size_t) (data->rows == NULL ? i : data->rows[i]) * data->num_inputs;
+}
+
+float* data_outputs(Data* data, uint32_t i){
+    return data->outputs + (size_t) (data->rows == NULL ? i : data->rows[i]) * data->num_outputs;
+}
+
+DataRows data_rows(Data* data){
+    DataRows rows = {
+        .inputs = data->inputs,
+        .outputs = data->outputs,
+        .rows = data->rows,
+        .num_data_points = data->num_data_points,
+        .num_inputs = data->num_inputs,
+        .num_outputs = data->num_outputs,
+    };
+    return rows;
+}
+
+
+
+//a mapping of a whole file. Only readable unless map_file() was asked for a writable one, whose writes stay private
+typedef struct MappedFile{
+    const char* data;
+    size_t size;
+} MappedFile;
+
+static MappedFile map_file(const char* path, uint8_t writable){
+    MappedFile file = { NULL, 0 };
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0){
+        fprintf(stderr, "ERROR: Could not open file %s. Exiting...\n", path);
         exit(-1);
     }
     
-    
-    uint32_t row_count = 0;
-    char c;
-    do{
-        c = fgetc(file_ptr);
-        if (c == '\n' || c == EOF)
-            row_count++;
-    }while(c != EOF);
-    
-    fclose(file_ptr);
+    file.size = (size_t) info.st_size;
+    if (file.size != 0){
+        void* data = mmap(NULL, file.size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED){
+            fprintf(stderr, "ERROR: Could not map file %s. Exiting...\n", path);
+            exit(-1);
+        }
+        if (!writable)
+            madvise(data, file.size, MADV_SEQUENTIAL); //the kernel reads ahead further
+        file.data = (const char*) data;
+    }
+    close(fd); //the mapping stays valid
+    return file;
+}
 
-    return row_count - 1; //to omit the information row
+static void unmap_file(MappedFile* file){
+    if (file->data != NULL)
+        munmap((void*) file->data, file->size);
+    file->data = NULL;
+    file->size = 0;
 }
 
-uint32_t num_features_of_csv(const char* path){
-    FILE* file_ptr;
-    file_ptr = fopen(path, "r");
+//start of the line after p, or end
+static const char* next_line(const char* p, const char* end){
+    const char* newline = (const char*) memchr(p, '\n', (size_t) (end - p));
+    return newline == NULL ? end : newline + 1;
+}
+
+//lines with something on them between begin and end. memchr goes through the bytes about as fast as memory can deliver them
+static uint32_t count_rows(const char* begin, const char* end){
+    uint32_t rows = 0;
+    for (const char* p = begin; p < end; p = next_line(p, end)){
+        if (*p != '\n' && *p != '\r')
+            rows++;
+    }
+    return rows;
+}
+
+//columns of the (header) line at p
+static uint32_t count_columns(const char* p, const char* end){
+    const char* line_end = next_line(p, end);
+    uint32_t columns = 1;
+    for (; p < line_end; p++)
+        columns += *p == ',';
+    return columns;
+}
+
+static const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//the number at *p, which has to end before end. Leaves *p on the character after it.
+//plain decimals with up to 19 significant digits and small exponents (anything a float can tell apart) come out of one
+//multiplication or division by an exact power of ten, which rounds once in double precision. Everything else (nan, inf, hex,
+//very long or extreme numbers) goes to strtod
+static float parse_float(const char** p, const char* end){
+    const char* start = *p;
+    const char* s = start;
+    uint8_t negative = 0;
+    if (s < end && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
     
-    if (file_ptr == NULL){
-        fprintf(stderr, "ERROR: Could not open file in num_rows_of_csv. Exiting...\n");
-        fclose(file_ptr);
-        exit(-1);
+    uint64_t mantissa = 0;
+    int32_t digits = 0, exponent = 0;
+    const char* digits_start = s;
+    for (; s < end && (unsigned) (*s - '0') < 10; s++){
+        if (digits < 19)
+            mantissa = mantissa * 10 + (uint64_t) (*s - '0');
+        else
+            exponent++; //digits past the 19th only scale
+        digits += mantissa != 0 || digits != 0;
+    }
+    if (s < end && *s == '.'){
+        for (s++; s < end && (unsigned) (*s - '0') < 10; s++){
+            if (digits < 19){
+                mantissa = mantissa * 10 + (uint64_t) (*s - '0');
+                exponent--;
+            }
+            digits += mantissa != 0 || digits != 0;
+        }
     }
+    uint8_t has_digits = s != digits_start && !(s == digits_start + 1 && *digits_start == '.');
     
-    char line_buffer[CHAR_BUFF_SIZE];
-    char* token;
+    if (has_digits && s < end && (*s == 'e' || *s == 'E')){
+        const char* e = s + 1;
+        uint8_t negative_exponent = 0;
+        if (e < end && (*e == '-' || *e == '+'))
+            negative_exponent = *e++ == '-';
+        if (e < end && (unsigned) (*e - '0') < 10){
+            int32_t value = 0;
+            for (; e < end && (unsigned) (*e - '0') < 10; e++)
+                value = value < 10000 ? value * 10 + (*e - '0') : value;
+            exponent += negative_exponent ? -value : value;
+            s = e;
+        }
+    }
     
+    //the number has to end at the end of its column, anything else (like the x of a hex number) is strtod's business
+    uint8_t ends = s == end || *s == ',' || *s == '\n' || *s == '\r' || *s == ' ' || *s == '\t';
+    if (has_digits && ends && digits <= 19 && mantissa < (1ull << 53) && exponent >= -22 && exponent <= 22){
+        double value = (double) mantissa;
+        value = exponent < 0 ? value / powers_of_ten[-exponent] : value * powers_of_ten[exponent];
+        
+        //rounding to double and then to float can only go wrong if the double sits exactly halfway between two floats
+        //(the 29 bits a float drops are 1000...). Subnormal floats drop more bits than that, so they take the slow path too
+        uint64_t bits;
+        memcpy(&bits, &value, sizeof(bits));
+        if ((bits & 0x1fffffff) != 0x10000000 && (value == 0.0 || value >= FLT_MIN)){
+            *p = s;
+            return (float) (negative ? -value : value);
+        }
+    }
+    
+    //slow path. strtod needs a terminated string, and the mapping isn't one
+    size_t length = 0;
+    while (start + length < end && start[length] != ',' && start[length] != '\n' && start[length] != '\r')
+        length++;
+    char small[64];
+    char* copy = length < sizeof(small) ? small : (char*) malloc(length + 1);
+    memcpy(copy, start, length);
+    copy[length] = '\0';
+    char* parsed_end;
+    float value = strtof(copy, &parsed_end);
+    *p = start + (parsed_end - copy);
+    if (copy != small)
+        free(copy);
+    return value;
+}
+
+//clears data point row, which couldn't be parsed, and moves *line past the line p is on and any blank lines after it
+static uint8_t skip_row(const char** line, const char* p, const char* end, float* inputs, float* outputs, Data* data){
+    memset(inputs, 0, sizeof(float) * data->num_inputs);
+    memset(outputs, 0, sizeof(float) * data->num_outputs);
+    p = next_line(p, end);
+    while (p < end && (*p == '\n' || *p == '\r'))
+        p++;
+    *line = p;
+    return 0;
+}
+
+//parses the line at *p into data point row, and moves *p to the start of the next line.
+//a line that isn't a data point is skipped with an error, and 0 is returned
+static uint8_t parse_row(const char** line, const char* end, Data* data, uint32_t row, uint32_t num_cols, uint32_t target_column, uint32_t num_targets){
+    float* inputs = data_inputs(data, row);
+    float* outputs = data_outputs(data, row);
+    const char* p = *line;
     
-    fgets(line_buffer, CHAR_BUFF_SIZE, file_ptr);
-    token = strtok(line_buffer, ",");
-    uint32_t token_count = 1;
-    while(token != NULL){
-        token = strtok(NULL, ",");
-        token_count += token == NULL ? 0 : 1;
+    for (uint32_t column = 0; column < num_cols; column++){
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        const char* token = p;
+        float value = parse_float(&p, end);
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        
+        uint8_t last = column + 1 == num_cols;
+        uint8_t well_formed = p != token && (last ? p == end || *p == '\n' || *p == '\r' : p < end && *p == ',');
+        if (!well_formed){
+            fprintf(stderr, "ERROR: Could not read column %u of data point %u, or it doesn't have %u columns. Skipping it...\n", column, row, num_cols);
+            return skip_row(line, p, end, inputs, outputs, data);
+        }
+        //written this way round so NaN fails it too, before it gets anywhere near a cast
+        if (column == target_column && num_targets > 1 && !(value >= 0.0f && value < (float) num_targets)){
+            fprintf(stderr, "ERROR: Target %f of data point %u isn't a class below %u. Skipping it...\n", value, row, num_targets);
+            return skip_row(line, p, end, inputs, outputs, data);
+        }
+        if (p < end)
+            p++; //past the comma or line ending, the last line doesn't have to have one
+        
+        if (column == target_column){
+            //one hot encoding...
+            if (num_targets > 1)
+                outputs[(uint32_t) value] = 1.0f;
+            else
+                outputs[0] = value;
+        }
+        else
+            inputs[column > target_column ? column - 1 : column] = value;
     }
     
-    fclose(file_ptr);
+    //the rest of the line ending, and blank lines
+    while (p < end && (*p == '\n' || *p == '\r'))
+        p++;
+    *line = p;
+    return 1;
+}
+
+//a newline aligned piece of the file, parsed by one task
+typedef struct CsvChunk{
+    const char* begin;
+    const char* end;
+    uint32_t num_rows; //counted first, then the rows this chunk parses
+    uint32_t first_row;
+    uint32_t parsed; //less than num_rows if lines were skipped
+} CsvChunk;
+
+typedef struct CsvJob{
+    CsvChunk* chunks;
+    Data* data;
+    uint32_t num_cols;
+    uint32_t target_column;
+    uint32_t num_targets;
+} CsvJob;
+
+static void count_chunk(size_t index, void* ctx){
+    CsvChunk* chunk = ((CsvJob*) ctx)->chunks + index;
+    chunk->num_rows = count_rows(chunk->begin, chunk->end);
+}
+
+static void parse_chunk(size_t index, void* ctx){
+    CsvJob* job = (CsvJob*) ctx;
+    CsvChunk* chunk = job->chunks + index;
+    const char* p = chunk->begin;
+    while (p < chunk->end && (*p == '\n' || *p == '\r'))
+        p++;
     
-    return token_count;
+    uint32_t row = chunk->first_row;
+    while (row < chunk->first_row + chunk->num_rows && p < chunk->end)
+        row += parse_row(&p, chunk->end, job->data, row, job->num_cols, job->target_column, job->num_targets);
+    chunk->parsed = row - chunk->first_row;
 }
 
+//splits [begin, end) into up to num_chunks pieces that start and end on line boundaries. Returns how many there are
+static size_t split_chunks(const char* begin, const char* end, size_t num_chunks, CsvChunk* chunks){
+    size_t length = (size_t) (end - begin);
+    if (num_chunks > length / MIN_CHUNK_BYTES)
+        num_chunks = length / MIN_CHUNK_BYTES;
+    if (num_chunks == 0)
+        num_chunks = 1;
+    
+    const char* chunk_begin = begin;
+    for (size_t i = 0; i < num_chunks; i++){
+        const char* chunk_end = i + 1 == num_chunks ? end : begin + length * (i + 1) / num_chunks;
+        if (chunk_end != end && chunk_end > chunk_begin)
+            chunk_end = next_line(chunk_end - 1, end); //the chunk takes the rest of the line it ends in
+        if (chunk_end < chunk_begin)
+            chunk_end = chunk_begin;
+        chunks[i] = (CsvChunk) { .begin = chunk_begin, .end = chunk_end };
+        chunk_begin = chunk_end;
+    }
+    return num_chunks;
+}
 
-//num targets is how many targets we have. So say for a digit dataset like MNIST, we would have 10 targets because there are 10 digits to choose from
-Data read_csv(const char* path, uint32_t num_rows, uint32_t num_cols, uint32_t target_column, uint32_t num_targets){
+//the data points of the csv, parsing at most max_rows of them. The file is cut into chunks at line boundaries, the rows of every
+//chunk are counted at once, and then every chunk parses its rows straight into their place in the data, in file order
+static Data parse_csv(MappedFile* file, uint32_t max_rows, uint32_t num_cols, uint32_t target_column, uint32_t num_targets){
+    double start = seconds_now();
     
-    Data data;
-    //TODO make it clear that num_rows is the number of desired data points and not the number of file rows
-    //IF num rows doesnt equal file rows then bad shit happens, hence the matrix count < num_rows on the loop
-    data.inputs = (Matrix*) calloc(sizeof(Matrix), num_rows);
-    data.outputs = (Matrix*) calloc(sizeof(Matrix), num_rows);
-    data.num_data_points = num_rows;
+    //as many threads as the caller lets it have, see set_max_threads()
+    uint32_t num_threads = max_threads();
     
-    FILE* file_ptr;
-    file_ptr = fopen(path, "r");
+    const char* end = file->data + file->size;
+    const char* begin = file->data == NULL ? end : next_line(file->data, end); //move past the first line
     
-    if (file_ptr == NULL){
-        fprintf(stderr, "ERROR: Could not open file in num_rows_of_csv. Exiting...\n");
-        fclose(file_ptr);
-        exit(-1);
+    CsvChunk chunks[MAX_CSV_CHUNKS];
+    size_t num_chunks = split_chunks(begin, end, (size_t) num_threads * CHUNKS_PER_THREAD < MAX_CSV_CHUNKS ? num_threads * CHUNKS_PER_THREAD : MAX_CSV_CHUNKS, chunks);
+    CsvJob job = {
+        .chunks = chunks,
+        .num_cols = num_cols,
+        .target_column = target_column,
+        .num_targets = num_targets,
+    };
+    parallel_for(num_chunks, count_chunk, &job);
+    
+    //where each chunk's rows go, leaving out whatever is past max_rows
+    uint32_t num_rows = 0;
+    for (size_t i = 0; i < num_chunks; i++){
+        chunks[i].first_row = num_rows;
+        chunks[i].num_rows = chunks[i].num_rows < max_rows - num_rows ? chunks[i].num_rows : max_rows - num_rows;
+        num_rows += chunks[i].num_rows;
     }
     
-    char line_buffer[CHAR_BUFF_SIZE];
-    char* token;
-    fgets(line_buffer, CHAR_BUFF_SIZE, file_ptr); //move past the first line
+    Data data = create_data(num_rows, num_cols - 1, num_targets); //-1 to omit the target feature
+    data.one_hot = num_targets > 1;
+    job.data = &data;
+    parallel_for(num_chunks, parse_chunk, &job);
     
-    uint32_t token_count = 0;
-    uint32_t matrix_count = 0;
-    while (!feof(file_ptr) && matrix_count < num_rows){
-        fgets(line_buffer, CHAR_BUFF_SIZE, file_ptr);
-        token = strtok(line_buffer, ",");
-        
-        data.inputs[matrix_count] = create_matrix(num_cols - 1, 1); //column vector. -1 to omit the target feature
-        data.outputs[matrix_count] = create_matrix(num_targets, 1); //one hot encoded column vector
-        token_count = 0;
-        
-        do {
-            
-            if (token_count == target_column){
-                
-                //one hot encoding...
-                if (num_targets > 1){
-                    set_values_with(data.outputs + matrix_count, 0.0f);
-                    uint32_t idx = atoi(token);
-                    data.outputs[matrix_count].values[idx] = 1.0f;
-                }
-                else
-                    data.outputs[matrix_count].values[0] = atof(token);
-            }
-            else{
-                uint32_t index = token_count > target_column ? token_count - 1 : token_count;
-                data.inputs[matrix_count].values[index] = atof(token);
-            }
-            
-            token_count++;
-            token = strtok(NULL, ",");
-        }while(token != NULL);
-
-        matrix_count++;
+    //skipped lines leave gaps at the end of their chunk. Close them, which is one move per chunk
+    uint32_t row = 0;
+    for (size_t i = 0; i < num_chunks; i++){
+        if (row != chunks[i].first_row && chunks[i].parsed != 0){
+            memmove(data.inputs + (size_t) row * data.num_inputs, data.inputs + (size_t) chunks[i].first_row * data.num_inputs,
+                    sizeof(float) * data.num_inputs * chunks[i].parsed);
+            memmove(data.outputs + (size_t) row * data.num_outputs, data.outputs + (size_t) chunks[i].first_row * data.num_outputs,
+                    sizeof(float) * data.num_outputs * chunks[i].parsed);
+        }
+        row += chunks[i].parsed;
     }
+    if (row != num_rows){
+        memset(data.inputs + (size_t) row * data.num_inputs, 0, sizeof(float) * data.num_inputs * (num_rows - row));
+        memset(data.outputs + (size_t) row * data.num_outputs, 0, sizeof(float) * data.num_outputs * (num_rows - row));
+    }
+    data.num_data_points = row;
     
-    fclose(file_ptr);
+    last_report.bytes = file->size;
+    last_report.num_data_points = row;
+    last_report.num_threads = num_threads < num_chunks ? num_threads : (uint32_t) num_chunks;
+    last_report.seconds = seconds_now() - start;
+    last_report.megabytes_per_second = last_report.seconds > 0.0 ? (double) file->size / 1e6 / last_report.seconds : 0.0;
     return data;
 }
 
 
-void delete_data(Data* data){
-    for (uint32_t i = 0; i < data->num_data_points; i++){
-        delete_matrix(data->inputs + i);
-        delete_matrix(data->outputs + i);
+
+LoadReport last_load_report(void){
+    return last_report;
+}
+
+uint32_t num_datapoints_of_csv(const char* path){
+    MappedFile file = map_file(path, 0);
+    const char* end = file.data + file.size;
+    uint32_t rows = file.data == NULL ? 0 : count_rows(next_line(file.data, end), end); //to omit the information row
+    unmap_file(&file);
+    return rows;
+}
+
+uint32_t num_features_of_csv(const char* path){
+    MappedFile file = map_file(path, 0);
+    uint32_t columns = file.data == NULL ? 0 : count_columns(file.data, file.data + file.size);
+    unmap_file(&file);
+    return columns;
+}
+
+Data load_csv(const char* path, uint32_t target_column, uint32_t num_targets){
+    MappedFile file = map_file(path, 0);
+    uint32_t num_cols = file.data == NULL ? 0 : count_columns(file.data, file.data + file.size);
+    if (target_column >= num_cols){
+        fprintf(stderr, "ERROR: Target column %u of %s doesn't exist, it has %u columns. Exiting...\n", target_column, path, num_cols);
+        exit(-1);
     }
     
-    free(data->inputs);
-    free(data->outputs);
+    Data data = parse_csv(&file, UINT32_MAX, num_cols, target_column, num_targets);
+    unmap_file(&file);
+    return data;
 }
 
-DataSplit train_test_split(Data* data, uint32_t train_size){
-    uint32_t total_data_points = data->num_data_points;
-    uint32_t test_size = total_data_points - train_size;
-    
-    if (train_size > total_data_points){
-        fprintf(stderr, "ERROR: Training dataset size of %u is greater than total dataset size of %u. Returning empty struct...\n", train_size, total_data_points);
-        DataSplit split;
-        return split;
+//num targets is how many targets we have. So say for a digit dataset like MNIST, we would have 10 targets because there are 10 digits to choose from
+Data read_csv(const char* path, uint32_t num_rows, uint32_t num_cols, uint32_t target_column, uint32_t num_targets){
+    MappedFile file = map_file(path, 0);
+    if (target_column >= num_cols){
+        fprintf(stderr, "ERROR: Target column %u doesn't exist, there are only %u columns. Exiting...\n", target_column, num_cols);
+        exit(-1);
     }
     
-    DataSplit split = {
-        .total_data_points = total_data_points,
-        
-        .train = {
-            .inputs = (Matrix*) calloc(sizeof(Matrix), train_size),
-            .outputs = (Matrix*) calloc(sizeof(Matrix), train_size),
-            .num_data_points = train_size,
-        },
-        
-        .test = {
-            .inputs = (Matrix*) calloc(sizeof(Matrix), test_size),
-            .outputs = (Matrix*) calloc(sizeof(Matrix), test_size),
-            .num_data_points = test_size,
-        },
-    };
-  
-    
-    //make a vector of indices
-    Vector indices = create_vector(total_data_points);
-    for (uint32_t i = 0; i < total_data_points; i++)
-        push(&indices, i);
+    //if the file has fewer rows than asked for, the data only holds the ones it has
+    Data data = parse_csv(&file, num_rows, num_cols, target_column, num_targets);
+    unmap_file(&file);
+    return data;
+}
+
+
+void delete_data(Data* data){
+    //the block or the mapping is all there is to free, the rows of a view belong to its split
+    if (data->mapping != NULL)
+        munmap(data->mapping, data->mapping_bytes);
+    else
+        allocator_free(NULL, data->values);
+    data->values = NULL;
+    data->mapping = NULL;
+    data->inputs = NULL;
+    data->outputs = NULL;
+    data->rows = NULL;
+}
+
+
+
+//where the outputs of a dataset of this shape start in its file, and how many bytes they take. The same padding create_data()
+//puts between the halves. Every product is checked with a division before it's made, so a header can't make any of it
+//wrap around. Returns 0 if it doesn't fit in a size_t
+static uint8_t dataset_layout(uint64_t num_data_points, uint32_t num_inputs, uint32_t num_outputs, size_t* outputs_offset, size_t* output_bytes){
+    size_t floats_per_line = ALLOCATOR_ALIGNMENT / sizeof(float);
+    if ((uint64_t) (size_t) num_data_points != num_data_points ||
+        (num_inputs != 0 && num_data_points > SIZE_MAX / num_inputs) || (num_outputs != 0 && num_data_points > SIZE_MAX / num_outputs))
+        return 0;
     
-    //initialize the random seed for the rand() function
-    srand((unsigned int) time(0)); //cast to get rid of warning
+    size_t input_floats = (size_t) num_data_points * num_inputs;
+    size_t output_floats = (size_t) num_data_points * num_outputs;
+    if (input_floats > SIZE_MAX - floats_per_line)
+        return 0;
+    input_floats = (input_floats + floats_per_line - 1) / floats_per_line * floats_per_line;
+    if (input_floats > (SIZE_MAX - sizeof(DatasetHeader)) / sizeof(float) || output_floats > SIZE_MAX / sizeof(float))
+        return 0;
     
-    //remove random elements from the index vector and use those elements to add random matrices to the train test split
-    //this is the 'shuffling' portion of the split
-    uint32_t rand_index;
-    for (uint32_t i = 0; i < train_size; i++){
-        rand_index = (uint32_t) ( ( rand() / (float)RAND_MAX ) * indices.size );
-        
-        rand_index = remove_at(&indices, rand_index);
-        
-        //shallow copies
-        split.train.inputs[i] = data->inputs[rand_index];
-        split.train.outputs[i] = data->outputs[rand_index];
+    *outputs_offset = sizeof(DatasetHeader) + sizeof(float) * input_floats;
+    *output_bytes = sizeof(float) * output_floats;
+    return 1;
+}
+
+uint8_t check_dataset_header(const DatasetHeader* header, size_t file_size){
+    size_t outputs_offset = 0, output_bytes = 0;
+    uint8_t valid = memcmp(header->magic, DATASET_MAGIC, sizeof(header->magic)) == 0 && header->version == DATASET_VERSION &&
+                    header->dtype == DATASET_FLOAT32 && header->header_bytes == sizeof(DatasetHeader) &&
+                    header->num_data_points != 0 && (uint64_t) header->num_inputs + header->num_outputs != 0 &&
+                    dataset_layout(header->num_data_points, header->num_inputs, header->num_outputs, &outputs_offset, &output_bytes) &&
+                    header->outputs_offset == outputs_offset;
+    //written so that neither side can wrap
+    return valid && outputs_offset <= file_size && output_bytes <= file_size - outputs_offset;
+}
+
+uint8_t save_dataset(Data* data, const char* path){
+    //an empty dataset couldn't be loaded again
+    size_t outputs_offset, output_bytes;
+    if (data->num_data_points == 0 || data->num_inputs + data->num_outputs == 0 ||
+        !dataset_layout(data->num_data_points, data->num_inputs, data->num_outputs, &outputs_offset, &output_bytes)){
+        fprintf(stderr, "ERROR: Can't save a dataset of %u data points with %u inputs and %u outputs. Returning...\n", data->num_data_points, data->num_inputs, data->num_outputs);
+        return 0;
     }
     
-    uint32_t i = 0;
-    while (indices.size > 0){
-        rand_index = remove_at(&indices, indices.size - 1);
-        
-        //shallow copies
-        split.test.inputs[i] = data->inputs[rand_index];
-        split.test.outputs[i] = data->outputs[rand_index];
-        i++;
+    FILE* f = fopen(path, "wb");
+    if (f == NULL){
+        fprintf(stderr, "ERROR: Could not open %s to save the dataset. Returning...\n", path);
+        return 0;
     }
     
+    DatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+    header.version = DATASET_VERSION;
+    header.dtype = DATASET_FLOAT32;
+    header.num_data_points = data->num_data_points;
+    header.num_inputs = data->num_inputs;
+    header.num_outputs = data->num_outputs;
+    header.one_hot = data->one_hot;
+    header.header_bytes = sizeof(DatasetHeader);
+    header.outputs_offset = outputs_offset;
     
-    //free the allocated arrays that were holding the data
-    free(data->inputs);
-    free(data->outputs);
-    delete_vector(&indices);
+    //the header goes in last, once the checksum is known. The rows of a view are written in its order, so splits work too
+    uint8_t success = fwrite(&header, sizeof(header), 1, f) == 1;
+    uint64_t checksum = CHECKSUM_SEED;
+    if (data->rows == NULL)
+        success = success && write_checksummed(f, data->inputs, sizeof(float) * data->num_inputs * data->num_data_points, &checksum);
+    for (uint32_t i = 0; i < data->num_data_points && data->rows != NULL && success; i++)
+        success = write_checksummed(f, data_inputs(data, i), sizeof(float) * data->num_inputs, &checksum);
     
-    return split;
+    static const float zeros[ALLOCATOR_ALIGNMENT / sizeof(float)] = { 0 };
+    size_t padding = header.outputs_offset - sizeof(header) - sizeof(float) * (size_t) data->num_data_points * data->num_inputs;
+    success = success && write_checksummed(f, zeros, padding, &checksum);
+    
+    if (data->rows == NULL)
+        success = success && write_checksummed(f, data->outputs, output_bytes, &checksum);
+    for (uint32_t i = 0; i < data->num_data_points && data->rows != NULL && success; i++)
+        success = write_checksummed(f, data_outputs(data, i), sizeof(float) * data->num_outputs, &checksum);
+    
+    header.checksum = checksum;
+    success = success && fseek(f, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, f) == 1;
+    success = fclose(f) == 0 && success;
+    if (!success)
+        fprintf(stderr, "ERROR: Could not write the dataset to %s. Returning...\n", path);
+    return success;
 }
 
-void delete_split_data(DataSplit* split){
-    for (size_t i = 0; i < split->train.num_data_points; i++){
-            //deleting the inputs x and outputs y of the train and test sets
-            delete_matrix(split->train.inputs + i);
-            delete_matrix(split->train.outputs + i);
+Data load_dataset(const char* path, uint8_t verify_checksum){
+    Data empty;
+    memset(&empty, 0, sizeof(empty));
+    
+    MappedFile file = map_file(path, 1);
+    DatasetHeader header;
+    if (file.size < sizeof(header)){
+        fprintf(stderr, "ERROR: %s is too small to be a dataset. Returning empty dataset...\n", path);
+        unmap_file(&file);
+        return empty;
+    }
+    memcpy(&header, file.data, sizeof(header));
+    
+    if (!check_dataset_header(&header, file.size) || header.num_data_points > UINT32_MAX){
+        fprintf(stderr, "ERROR: %s isn't a dataset of version %d, or it was cut short. Returning empty dataset...\n", path, DATASET_VERSION);
+        unmap_file(&file);
+        return empty;
     }
+    //the header was checked, so this can't wrap
+    size_t expected = header.outputs_offset + sizeof(float) * header.num_data_points * header.num_outputs;
     
-    for (size_t i = 0; i < split->test.num_data_points; i++){
-        //deleting the inputs x outputs y of the train and test sets
-        delete_matrix(split->test.inputs + i);
-        delete_matrix(split->test.outputs + i);
+    if (verify_checksum && checksum_words(CHECKSUM_SEED, file.data + sizeof(header), expected - sizeof(header)) != header.checksum){
+        fprintf(stderr, "ERROR: The checksum of %s doesn't match, the file is corrupted. Returning empty dataset...\n", path);
+        unmap_file(&file);
+        return empty;
     }
+    
+    Data data = {
+        .num_data_points = (uint32_t) header.num_data_points,
+        .num_inputs = header.num_inputs,
+        .num_outputs = header.num_outputs,
+        .one_hot = (uint8_t) header.one_hot,
+        .inputs = (float*) (file.data + sizeof(header)),
+        .outputs = (float*) (file.data + header.outputs_offset),
+        .values = (float*) (file.data + sizeof(header)),
+        .mapping = (void*) file.data,
+        .mapping_bytes = file.size,
+    };
+    return data;
+}
+
+uint8_t convert_csv(const char* csv_path, const char* dataset_path, uint32_t target_column, uint32_t num_targets){
+    Data data = load_csv(csv_path, target_column, num_targets);
+    uint8_t success = save_dataset(&data, dataset_path);
+    delete_data(&data);
+    return success;
+}
+
 
 
-    //free the inputs x and y of the training set
-    free(split->train.inputs);
-    free(split->train.outputs);
+DataSplit train_test_split(Data* data, uint32_t train_size, uint64_t seed){
+    uint32_t total_data_points = data->num_data_points;
+    
+    DataSplit split;
+    memset(&split, 0, sizeof(split));
+    if (train_size > total_data_points){
+        fprintf(stderr, "ERROR: Training dataset size of %u is greater than total dataset size of %u. Returning empty struct...\n", train_size, total_data_points);
+        return split;
+    }
+    
+    //the rows of data, which are data points 0, 1, 2... unless it's a view itself. Only the first train_size positions need
+    //to be shuffled: they're a random subset in random order, and the rest is the test set
+    split.total_data_points = total_data_points;
+    split.order = (uint32_t*) malloc(sizeof(uint32_t) * (total_data_points == 0 ? 1 : total_data_points));
+    for (uint32_t i = 0; i < total_data_points; i++)
+        split.order[i] = data->rows == NULL ? i : data->rows[i];
+    Rng rng;
+    seed_rng(&rng, seed);
+    shuffle_indices(&rng, split.order, total_data_points, train_size);
     
-    //free the inputs x and y of the test set
-    free(split->test.inputs);
-    free(split->test.outputs);
+    //the data now belongs to the split
+    split.whole = *data;
+    memset(data, 0, sizeof(Data));
+    split.train = split.whole;
+    split.train.values = NULL;
+    split.train.mapping = NULL;
+    split.train.rows = split.order;
+    split.train.num_data_points = train_size;
+    split.test = split.train;
+    split.test.rows = split.order + train_size;
+    split.test.num_data_points = total_data_points - train_size;
+    return split;
+}
+
+void delete_split_data(DataSplit* split){
+    delete_data(&split->train);
+    delete_data(&split->test);
+    delete_data(&split->whole);
+    free(split->order);
+    split->order = NULL;
 }
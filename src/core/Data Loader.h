@@ -11,26 +11,110 @@
 #include "pch.h"
 #include "Data Structure/Vector.h"
 #include "Model/Matrix.h"
+#include "Model/DataSource.h"
 
+//every input and output of a dataset lives in one aligned block, the inputs of all data points first and then the outputs,
+//a row per data point. Nothing is kept per data point, data_inputs() and data_outputs() find its row.
+//a dataset can also be a view of another one's rows in some order (see train_test_split()). Then data point i is row rows[i]
 typedef struct Data{
     uint32_t num_data_points;
-    Matrix* inputs;
-    Matrix* outputs;
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+    uint8_t one_hot; //whether the outputs are one hot encoded classes
+    float* inputs; //num_inputs floats per row
+    float* outputs; //num_outputs floats per row, starting on a cache line of its own
+    const uint32_t* rows; //NULL if data point i is row i
+    
+    float* values; //the block, NULL if this views another dataset's
+    void* mapping; //the mapped dataset file values points into, NULL if values was allocated
+    size_t mapping_bytes;
 } Data;
 
+//the train and test sets view the rows of whole, which the split owns. order is a shuffle of the rows: the train set is
+//its first train_size entries and the test set the rest, so the split costs one index per data point and nothing is copied
 typedef struct DataSplit{
     uint32_t total_data_points;
     Data train;
     Data test;
+    
+    Data whole;
+    uint32_t* order;
 } DataSplit;
 
+//binary dataset files start with this header, followed by the block of the dataset exactly as it's laid out in memory,
+//so it can be mapped and used as is. Everything is little endian
+#define DATASET_MAGIC "NNDATSET"
+#define DATASET_VERSION 1
+#define DATASET_FLOAT32 0
+
+typedef struct DatasetHeader{
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint64_t num_data_points;
+    uint32_t num_inputs;
+    uint32_t num_outputs;
+    uint32_t one_hot;
+    uint32_t header_bytes; //where the inputs start, a multiple of 64 so the mapped values stay aligned
+    uint64_t outputs_offset;
+    uint64_t checksum; //of everything after the header
+    uint64_t reserved; //pads the header to 64 bytes
+} DatasetHeader;
+
+//how fast the last csv loaded on this thread was read
+typedef struct LoadReport{
+    size_t bytes;
+    uint32_t num_data_points;
+    uint32_t num_threads;
+    double seconds;
+    double megabytes_per_second;
+} LoadReport;
+
+//zero filled dataset
+Data create_data(uint32_t num_data_points, uint32_t num_inputs, uint32_t num_outputs);
+
+//the num_inputs inputs and num_outputs outputs of data point i
+float* data_inputs(Data* data, uint32_t i);
+float* data_outputs(Data* data, uint32_t i);
+
+//the data points of the dataset, for train_rows(), loss_on_rows()... It doesn't own anything, so data has to outlive it
+DataRows data_rows(Data* data);
+
+//rows after the header line, not counting blank ones
 uint32_t num_datapoints_of_csv(const char* path);
 //includes the target feature + input feature(s)
 uint32_t num_features_of_csv(const char* path);
 
+//maps the csv into memory and parses all of it in one go, working out the number of data points and columns along the way.
+//the first line is a header. There's no limit on the length of a line. num_targets > 1 one hot encodes the target column.
+//the file is split into chunks at line boundaries that are parsed on as many threads as set_max_threads() allows on the calling
+//thread, see last_load_report()
+Data load_csv(const char* path, uint32_t target_column, uint32_t num_targets);
+
+//same as load_csv(), for at most num_rows data points of a csv with num_cols columns
 Data read_csv(const char* path, uint32_t num_rows, uint32_t num_cols, uint32_t target_column, uint32_t num_targets);
 
-DataSplit train_test_split(Data* data, uint32_t train_size);
+//writes the data in the binary format, which can be loaded with load_dataset(). Returns 0 if the file couldn't be written,
+//or if the data is empty
+uint8_t save_dataset(Data* data, const char* path);
+
+//whether the header describes a dataset this version can read, with at least one data point and one value per data point,
+//which fits in a file of file_size bytes. Sizes that overflow anywhere along the way fail it
+uint8_t check_dataset_header(const DatasetHeader* header, size_t file_size);
+
+//maps a file written by save_dataset() into memory. The data points are used right where they are, so it takes the same time
+//however big the file is, and jobs loading the same file share it through the page cache. Writes to the values stay private.
+//checking the checksum means reading the whole file, so it's optional. Returns an empty dataset if the file isn't valid
+Data load_dataset(const char* path, uint8_t verify_checksum);
+
+//parses the csv once and saves it in the binary format, for load_dataset() from then on
+uint8_t convert_csv(const char* csv_path, const char* dataset_path, uint32_t target_column, uint32_t num_targets);
+
+//shuffles the indices of the data points into a train set of train_size and a test set with the rest. Nothing is copied,
+//the sets are views of data, which the split takes over. The same seed always gives the same split, 0 takes one from the clock
+DataSplit train_test_split(Data* data, uint32_t train_size, uint64_t seed);
+
+LoadReport last_load_report(void);
 
 void delete_data(Data* data);
 void delete_split_data(DataSplit* data);
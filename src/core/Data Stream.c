@@ -0,0 +1,255 @@
+//
+//  Data Stream.c
+//  Neural Net
+//
+//
+//
+
+#include "core/Data Stream.h"
+#include "core/Data Loader.h"
+#include "Model/Allocator.h"
+#include "Model/FileIO.h"
+#include "Model/Random.h"
+#include "pch.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//blocks the reader thread rotates through. One is trained on while the other is read
+#define STREAM_BLOCKS 2
+
+typedef struct StreamBlock{
+    float* inputs;
+    float* outputs;
+    uint32_t num_points; //0 marks the end of the file
+    uint8_t full; //read and waiting for (or being used by) the trainer
+} StreamBlock;
+
+typedef struct DatasetStream{
+    DataSource source; //has to come first
+    int fd;
+    DatasetHeader header;
+    uint32_t block_points;
+
+    //shared with the reader thread, under the lock
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    StreamBlock blocks[STREAM_BLOCKS];
+    uint32_t fill_index; //block the reader fills next
+    uint64_t read_position; //data point the reader reads next
+    uint64_t generation; //bumped by every begin_epoch, so the reader can tell its read is stale
+    uint8_t end_sent; //the reader is done with this epoch
+    uint8_t stop;
+
+    //only touched by the trainer
+    uint32_t take_index; //block the trainer takes next
+    StreamBlock* current;
+    uint32_t current_point;
+    uint8_t exhausted;
+
+    float* shuffle_inputs;
+    float* shuffle_outputs;
+    uint32_t shuffle_capacity;
+    uint32_t shuffle_count;
+    Rng rng; //batches are drawn on the prefetch thread, so the stream has its own
+} DatasetStream;
+
+
+
+static void* reader_main(void* arg){
+    DatasetStream* s = (DatasetStream*) arg;
+    uint32_t num_inputs = s->header.num_inputs, num_outputs = s->header.num_outputs;
+
+    pthread_mutex_lock(&s->lock);
+    while (!s->stop){
+        StreamBlock* block = s->blocks + s->fill_index;
+        if (block->full || s->end_sent){
+            pthread_cond_wait(&s->changed, &s->lock);
+            continue;
+        }
+
+        uint64_t generation = s->generation;
+        uint64_t position = s->read_position;
+        uint64_t left = s->header.num_data_points - position;
+        uint32_t n = left < s->block_points ? (uint32_t) left : s->block_points;
+        pthread_mutex_unlock(&s->lock);
+
+        //the inputs and outputs are two separate regions of the file, each read sequentially
+        uint8_t success = n == 0 ||
+            (read_fully(s->fd, block->inputs, sizeof(float) * n * num_inputs, s->header.header_bytes + sizeof(float) * position * num_inputs) &&
+             read_fully(s->fd, block->outputs, sizeof(float) * n * num_outputs, s->header.outputs_offset + sizeof(float) * position * num_outputs));
+        if (!success){
+            fprintf(stderr, "ERROR: Could not read data points %llu to %llu of the dataset stream. Ending the epoch early...\n",
+                    (unsigned long long) position, (unsigned long long) (position + n));
+            n = 0;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if (generation != s->generation)
+            continue; //an epoch started while reading, so this block belongs to the old one
+        block->num_points = n;
+        block->full = 1;
+        s->fill_index = (s->fill_index + 1) % STREAM_BLOCKS;
+        s->read_position += n;
+        s->end_sent = n == 0;
+        pthread_cond_broadcast(&s->changed);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+static StreamBlock* take_block(DatasetStream* s){
+    StreamBlock* block = s->blocks + s->take_index;
+    pthread_mutex_lock(&s->lock);
+    while (!block->full)
+        pthread_cond_wait(&s->changed, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+    return block;
+}
+
+static void release_block(DatasetStream* s, StreamBlock* block){
+    pthread_mutex_lock(&s->lock);
+    block->full = 0;
+    s->take_index = (s->take_index + 1) % STREAM_BLOCKS;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+//copies the next data point of the file into slot of the shuffle buffer. 0 at the end of the file
+static uint8_t read_point(DatasetStream* s, uint32_t slot){
+    uint32_t num_inputs = s->header.num_inputs, num_outputs = s->header.num_outputs;
+    while (!s->exhausted){
+        if (s->current == NULL){
+            s->current = take_block(s);
+            s->current_point = 0;
+            if (s->current->num_points == 0){
+                release_block(s, s->current);
+                s->current = NULL;
+                s->exhausted = 1;
+                return 0;
+            }
+        }
+
+        if (s->current_point < s->current->num_points){
+            uint32_t p = s->current_point++;
+            memcpy(s->shuffle_inputs + (size_t) slot * num_inputs, s->current->inputs + (size_t) p * num_inputs, sizeof(float) * num_inputs);
+            memcpy(s->shuffle_outputs + (size_t) slot * num_outputs, s->current->outputs + (size_t) p * num_outputs, sizeof(float) * num_outputs);
+            return 1;
+        }
+        release_block(s, s->current);
+        s->current = NULL;
+    }
+    return 0;
+}
+
+
+
+static void stream_begin_epoch(DataSource* source){
+    DatasetStream* s = (DatasetStream*) source;
+    pthread_mutex_lock(&s->lock);
+    s->generation++;
+    s->read_position = 0;
+    s->end_sent = 0;
+    for (uint32_t i = 0; i < STREAM_BLOCKS; i++)
+        s->blocks[i].full = 0;
+    s->fill_index = 0;
+    s->take_index = 0;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+
+    s->current = NULL;
+    s->exhausted = 0;
+    s->shuffle_count = 0;
+    //seeded by whoever starts the epoch, so a seeded train_stream() draws the same batches every run
+    seed_rng(&s->rng, next_random(thread_rng()) | 1);
+}
+
+static uint32_t stream_next_batch(DataSource* source, float* inputs, float* outputs, uint32_t max_points){
+    DatasetStream* s = (DatasetStream*) source;
+    uint32_t num_inputs = s->header.num_inputs, num_outputs = s->header.num_outputs;
+
+    uint32_t n = 0;
+    for (; n < max_points; n++){
+        //top the buffer up, then draw a random point out of it and fill the hole with the last one
+        while (s->shuffle_count < s->shuffle_capacity && read_point(s, s->shuffle_count))
+            s->shuffle_count++;
+        if (s->shuffle_count == 0)
+            break;
+
+        uint32_t slot = random_below(&s->rng, s->shuffle_count);
+        uint32_t last = --s->shuffle_count;
+        memcpy(inputs + (size_t) n * num_inputs, s->shuffle_inputs + (size_t) slot * num_inputs, sizeof(float) * num_inputs);
+        memcpy(outputs + (size_t) n * num_outputs, s->shuffle_outputs + (size_t) slot * num_outputs, sizeof(float) * num_outputs);
+        memcpy(s->shuffle_inputs + (size_t) slot * num_inputs, s->shuffle_inputs + (size_t) last * num_inputs, sizeof(float) * num_inputs);
+        memcpy(s->shuffle_outputs + (size_t) slot * num_outputs, s->shuffle_outputs + (size_t) last * num_outputs, sizeof(float) * num_outputs);
+    }
+    return n;
+}
+
+static void stream_close(DataSource* source){
+    DatasetStream* s = (DatasetStream*) source;
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->reader, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->changed);
+    for (uint32_t i = 0; i < STREAM_BLOCKS; i++){
+        allocator_free(NULL, s->blocks[i].inputs);
+        allocator_free(NULL, s->blocks[i].outputs);
+    }
+    allocator_free(NULL, s->shuffle_inputs);
+    allocator_free(NULL, s->shuffle_outputs);
+    close(s->fd);
+    free(s);
+}
+
+DataSource* open_dataset_stream(const char* path, uint32_t shuffle_capacity, size_t block_bytes){
+    int fd = open(path, O_RDONLY);
+    struct stat info;
+    DatasetHeader header;
+    if (fd < 0 || fstat(fd, &info) != 0 || !read_fully(fd, &header, sizeof(header), 0) || !check_dataset_header(&header, (size_t) info.st_size)){
+        fprintf(stderr, "ERROR: Could not open %s as a dataset of version %d. Returning NULL...\n", path, DATASET_VERSION);
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); //the kernel reads ahead further
+#endif
+
+    DatasetStream* s = (DatasetStream*) calloc(1, sizeof(DatasetStream));
+    s->source.num_inputs = header.num_inputs;
+    s->source.num_outputs = header.num_outputs;
+    s->source.begin_epoch = stream_begin_epoch;
+    s->source.next_batch = stream_next_batch;
+    s->source.close = stream_close;
+    s->fd = fd;
+    s->header = header;
+
+    size_t point_bytes = sizeof(float) * (header.num_inputs + header.num_outputs);
+    block_bytes = block_bytes == 0 ? DEFAULT_STREAM_BLOCK_BYTES : block_bytes;
+    s->block_points = block_bytes / point_bytes == 0 ? 1 : (uint32_t) (block_bytes / point_bytes);
+    for (uint32_t i = 0; i < STREAM_BLOCKS; i++){
+        s->blocks[i].inputs = (float*) allocator_alloc(NULL, sizeof(float) * s->block_points * header.num_inputs);
+        s->blocks[i].outputs = (float*) allocator_alloc(NULL, sizeof(float) * s->block_points * header.num_outputs);
+    }
+
+    s->shuffle_capacity = shuffle_capacity == 0 ? 1 : shuffle_capacity; //1 streams the points in file order
+    s->shuffle_inputs = (float*) allocator_alloc(NULL, sizeof(float) * s->shuffle_capacity * header.num_inputs);
+    s->shuffle_outputs = (float*) allocator_alloc(NULL, sizeof(float) * s->shuffle_capacity * header.num_outputs);
+
+    //nothing to read until the first epoch starts
+    s->end_sent = 1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->changed, NULL);
+    if (pthread_create(&s->reader, NULL, reader_main, s) != 0){
+        fprintf(stderr, "ERROR: Could not start the reader thread of the dataset stream. Exiting...\n");
+        exit(-1);
+    }
+    return &s->source;
+}
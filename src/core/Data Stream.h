@@ -0,0 +1,25 @@
+//
+//  Data Stream.h
+//  Neural Net
+//
+//
+//
+
+#ifndef Data_Stream_h
+#define Data_Stream_h
+
+#include "pch.h"
+#include "Model/DataSource.h"
+
+//the reader thread reads this far ahead of training by default
+#define DEFAULT_STREAM_BLOCK_BYTES (8 << 20)
+
+//a DataSource for train_stream() that reads a dataset file (see save_dataset()) front to back in blocks of about block_bytes,
+//without ever loading all of it. A background thread reads the next block while the current one is trained on.
+//data points go through a shuffle buffer of shuffle_capacity points: every batch draws random points out of it, and
+//each one is replaced by the next point from the file. The bigger the buffer, the closer it gets to a full shuffle.
+//memory use is 2 blocks plus the shuffle buffer, however big the file is. 0 block_bytes is the default.
+//returns NULL if the file can't be opened or isn't a dataset
+DataSource* open_dataset_stream(const char* path, uint32_t shuffle_capacity, size_t block_bytes);
+
+#endif /* Data_Stream_h */
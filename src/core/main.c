@@ -8,21 +8,24 @@
 #include "pch.h"
 #include "Model/Model.h"
 #include "Model/Training.h"
+#include "Model/ThreadPool.h"
 #include "core/Data Loader.h"
 #include "Contracts.h"
 
 DataSplit get_data(const char* path){
     
-    uint32_t num_data_points = num_datapoints_of_csv(path);
-    uint32_t num_features = num_features_of_csv(path);
-    
     //2nd to last param --> The column of the target feature in the csv
     //last param --> the number of output classes (for something like mnist we would have 10)
-    Data m_data = read_csv(path, num_data_points, num_features, 1, 1);
+    //loading can have every core, the limit goes back to what it was afterwards
+    uint32_t previous_max_threads = set_max_threads(UINT32_MAX);
+    Data m_data = load_csv(path, 1, 1);
+    set_max_threads(previous_max_threads);
+    LoadReport report = last_load_report();
+    printf("Loaded %u data points in %fs, %.1f MB/s on %u threads\n", report.num_data_points, report.seconds, report.megabytes_per_second, report.num_threads);
     
     float train_percent = 0.90f;
-    uint32_t train_size = (uint32_t) (train_percent * num_data_points);
-    DataSplit split = train_test_split(&m_data, train_size);
+    uint32_t train_size = (uint32_t) (train_percent * m_data.num_data_points);
+    DataSplit split = train_test_split(&m_data, train_size, 0);
     
     return split; //pointers are copied, so no memory leak
 }
@@ -35,6 +38,7 @@ Model* get_model(void){
         .momentum = 0.9f,
         .momentum2 = 0.99f,
         .epsillon = 1e-8,
+        .num_threads = 1,
     };
     
     //verbose level 1 : prints loss
@@ -75,14 +79,19 @@ int main(int argc, const char* argv[]) {
 
     uint32_t epochs = 2000;
     const char* training_data_file_ = "../training data/example.json";
-    uint8_t success = train(model, split.train.inputs, split.train.outputs, split.train.num_data_points, epochs, training_data_file_);
+    //the train and test sets are rows of the same block, each mini batch is gathered from them as it's needed
+    DataRows train_set = data_rows(&split.train);
+    DataRows test_set = data_rows(&split.test);
+    uint8_t success = train_rows(model, &train_set, epochs, training_data_file_);
 
-    //can save and load models with save_model and load_model
-    if (success)
-         save_model(model, "../saved models/example.txt");
+    //can save and load models with save_model and load_model. export_model_text writes the older, human readable format
+    if (success){
+        save_model(model, "../saved models/example.model");
+        export_model_text(model, "../saved models/example.txt");
+    }
 
-    float loss = loss_on_dataset(model, split.test.inputs, split.test.outputs, split.test.num_data_points);
-    float accuracy = accuracy_on_dataset(model, split.test.inputs, split.test.outputs, split.test.num_data_points);
+    float loss = loss_on_rows(model, &test_set);
+    float accuracy = accuracy_on_rows(model, &test_set);
     printf("\n\nLoss on test set: %f\n", loss);
 
     for (int i = 0; i <= 10; i++){
@@ -3,5 +3,6 @@
 #include <time.h>
 #include <stdlib.h>
 #include <math.h>
+#include <stdint.h>
 
 #define MIN(x, y) x < y ? x : y
\ No newline at end of file
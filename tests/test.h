@@ -0,0 +1,47 @@
+//
+//  test.h
+//  Neural Net
+//
+//
+//
+
+#ifndef test_h
+#define test_h
+
+#include "pch.h"
+#include <unistd.h>
+
+static int failed_checks = 0;
+
+//counts the failure and goes on, so one run shows every check that fails
+#define CHECK(condition) do { \
+    if (!(condition)){ \
+        fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        failed_checks++; \
+    } \
+} while (0)
+
+//what main() returns, 0 if every check passed
+static inline int test_result(void){
+    if (failed_checks != 0)
+        fprintf(stderr, "%d checks failed\n", failed_checks);
+    return failed_checks == 0 ? 0 : 1;
+}
+
+//a file name in the working directory, made from name, that no other test run uses at the same time
+#define TEST_PATH_LENGTH 256
+static inline void test_path(char* dest, const char* name){
+    snprintf(dest, TEST_PATH_LENGTH, "test_%ld_%s", (long) getpid(), name);
+}
+
+//writes the bytes to path, replacing it
+static inline void write_test_file(const char* path, const void* bytes, size_t num_bytes){
+    FILE* f = fopen(path, "wb");
+    if (f == NULL || fwrite(bytes, 1, num_bytes, f) != num_bytes){
+        fprintf(stderr, "ERROR: Could not write the test file %s. Exiting...\n", path);
+        exit(-1);
+    }
+    fclose(f);
+}
+
+#endif /* test_h */
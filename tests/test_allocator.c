@@ -0,0 +1,116 @@
+//
+//  test_allocator.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Allocator.h"
+#include "Model/Matrix.h"
+#include "Model/ThreadPool.h"
+#include "pch.h"
+#include <pthread.h>
+
+#define NUM_TASKS 8
+#define ALLOCATIONS_PER_TASK 2000
+
+#ifdef DEBUG
+
+//every kind of allocation counts once, whichever allocator it comes from
+static void test_counted(void){
+    Allocator arena = create_arena(0);
+    Allocator pool = create_pool();
+
+    size_t before = allocation_count();
+    void* heap_block = allocator_alloc(NULL, 100);
+    allocator_alloc(&arena, 100);
+    void* pool_block = allocator_alloc(&pool, 100);
+    Matrix mat = create_matrix_with(4, 4, &pool);
+    count_allocation();
+    CHECK(allocation_count() - before == 5);
+
+    //freeing isn't an allocation
+    allocator_free(NULL, heap_block);
+    allocator_free(&pool, pool_block);
+    delete_matrix(&mat);
+    arena_reset(&arena);
+    CHECK(allocation_count() - before == 5);
+
+    delete_allocator(&arena);
+    delete_allocator(&pool);
+}
+
+static void allocate_task(size_t index, void* ctx){
+    Allocator* arenas = (Allocator*) ctx;
+    for (int i = 0; i < ALLOCATIONS_PER_TASK; i++)
+        allocator_alloc(arenas + index, 16);
+}
+
+//threads allocating at the same time don't lose any counts
+static void test_concurrent(void){
+    Allocator arenas[NUM_TASKS];
+    for (int i = 0; i < NUM_TASKS; i++)
+        arenas[i] = create_arena(0);
+
+    uint32_t previous = set_max_threads(NUM_TASKS);
+    size_t before = allocation_count();
+    parallel_for(NUM_TASKS, allocate_task, arenas);
+    CHECK(allocation_count() - before == NUM_TASKS * ALLOCATIONS_PER_TASK);
+    set_max_threads(previous);
+
+    for (int i = 0; i < NUM_TASKS; i++)
+        delete_allocator(arenas + i);
+}
+
+static void* gemm_thread(void* arg){
+    size_t* counts = (size_t*) arg;
+    Matrix a = create_matrix_with(96, 80, NULL);
+    Matrix b = create_matrix_with(80, 72, NULL);
+    Matrix c = create_matrix_with(96, 72, NULL);
+
+    //the first gemm on a thread makes its packing buffers, the ones after reuse them
+    size_t before = allocation_count();
+    mult_trans_into(&c, &a, NO_TRANSPOSE, &b, NO_TRANSPOSE, 1.0f);
+    counts[0] = allocation_count() - before;
+    before = allocation_count();
+    mult_trans_into(&c, &a, NO_TRANSPOSE, &b, NO_TRANSPOSE, 1.0f);
+    counts[1] = allocation_count() - before;
+
+    delete_matrix(&a);
+    delete_matrix(&b);
+    delete_matrix(&c);
+    release_gemm_buffers();
+    return NULL;
+}
+
+//gemm manages its packing buffers itself, and reports them
+static void test_gemm_buffers(void){
+    size_t counts[2] = { 0, 0 };
+    pthread_t thread;
+    pthread_create(&thread, NULL, gemm_thread, counts);
+    pthread_join(thread, NULL);
+    CHECK(counts[0] >= 3); //a level and its two buffers
+    CHECK(counts[1] == 0);
+}
+
+int main(void){
+    //a pool of 8 threads even on a machine with fewer cores, so the allocations really are concurrent
+    configure_thread_pool(NUM_TASKS, 0);
+    test_counted();
+    test_concurrent();
+    test_gemm_buffers();
+    return test_result();
+}
+
+#else
+
+//nothing is counted outside of DEBUG builds
+int main(void){
+    allocator_free(NULL, allocator_alloc(NULL, 16));
+    count_allocation();
+    CHECK(allocation_count() == 0);
+    return test_result();
+}
+
+#endif
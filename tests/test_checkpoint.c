@@ -0,0 +1,201 @@
+//
+//  test_checkpoint.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Checkpoint.h"
+#include "Model/Model.h"
+#include "Model/Training.h"
+#include "pch.h"
+
+#define NUM_POINTS 64
+
+static ModelParams example_params(void){
+    ModelParams params = {
+        .learning_rate = 0.05f,
+        .batch_size = 8,
+        .momentum = 0.9f,
+        .momentum2 = 0.99f,
+        .epsillon = 1e-8,
+        .num_threads = 1,
+        .seed = 11,
+    };
+    return params;
+}
+
+static Model* example_model(void){
+    ModelParams params = example_params();
+    Model* m = create_model(&params, NULL);
+    add_layer(m, 2, NONE);
+    add_layer(m, 5, HYPERBOLIC_TANGENT);
+    add_layer(m, 1, LINEAR);
+    set_loss_func(m, LEAST_SQUARES);
+    compile(m);
+    srand(4);
+    init_weights_and_biases(m, 0, 1);
+    return m;
+}
+
+//y = x0 - x1
+static void example_data(float* values, Matrix* inputs, Matrix* outputs){
+    for (uint32_t i = 0; i < NUM_POINTS; i++){
+        float* p = values + 3 * i;
+        p[0] = (float) (i % 7) / 7.0f;
+        p[1] = (float) (i % 5) / 5.0f;
+        p[2] = p[0] - p[1];
+        inputs[i] = (Matrix) { .rows = 2, .cols = 1, .values = p };
+        outputs[i] = (Matrix) { .rows = 1, .cols = 1, .values = p + 2 };
+    }
+}
+
+static uint8_t same_floats(const float* a, const float* b, size_t n){
+    return memcmp(a, b, sizeof(float) * n) == 0;
+}
+
+static char* read_file(const char* path, size_t* size){
+    FILE* f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    *size = (size_t) ftell(f);
+    rewind(f);
+    char* bytes = (char*) malloc(*size);
+    if (fread(bytes, 1, *size, f) != *size)
+        *size = 0;
+    fclose(f);
+    return bytes;
+}
+
+//training 3 epochs, checkpointing, and going on for 3 more from the checkpoint is the same as training 6 at once
+static void test_resume(const char* path){
+    float values[3 * NUM_POINTS];
+    Matrix inputs[NUM_POINTS], outputs[NUM_POINTS];
+    example_data(values, inputs, outputs);
+
+    Model* straight = example_model();
+    CHECK(train(straight, inputs, outputs, NUM_POINTS, 6, NULL));
+
+    Model* first = example_model();
+    first->params.checkpoint_path = path;
+    first->params.checkpoint_interval = 2; //after epoch 2, and once more after the last one
+    CHECK(train(first, inputs, outputs, NUM_POINTS, 3, NULL));
+
+    Model* resumed = load_checkpoint(path);
+    CHECK(resumed != NULL);
+    if (resumed != NULL){
+        CHECK(resumed->num_parameters == first->num_parameters);
+        CHECK(same_floats(resumed->parameters, first->parameters, first->num_parameters));
+        CHECK(same_floats(resumed->moments, first->moments, first->num_parameters));
+        CHECK(same_floats(resumed->moments_squared, first->moments_squared, first->num_parameters));
+        CHECK(resumed->progress.epochs == 3 && memcmp(&resumed->progress, &first->progress, sizeof(TrainingProgress)) == 0);
+        CHECK(resumed->params.learning_rate == first->params.learning_rate && resumed->params.batch_size == first->params.batch_size);
+
+        resumed->params.num_threads = 1;
+        CHECK(train(resumed, inputs, outputs, NUM_POINTS, 3, NULL));
+        CHECK(same_floats(resumed->parameters, straight->parameters, straight->num_parameters));
+        delete_model(resumed);
+    }
+
+    //save_checkpoint() writes the same file the training loop does
+    char copy[TEST_PATH_LENGTH];
+    test_path(copy, "copy.ckpt");
+    CHECK(save_checkpoint(first, copy));
+    size_t a_size, b_size;
+    char* a = read_file(path, &a_size);
+    char* b = read_file(copy, &b_size);
+    CHECK(a_size == b_size && memcmp(a, b, a_size) == 0);
+    free(a);
+    free(b);
+    remove(copy);
+
+    delete_model(straight);
+    delete_model(first);
+}
+
+//a checkpoint that can't be written fails train(), even though the model was trained
+static void test_unwritable(void){
+    float values[3 * NUM_POINTS];
+    Matrix inputs[NUM_POINTS], outputs[NUM_POINTS];
+    example_data(values, inputs, outputs);
+
+    Model* m = example_model();
+    m->params.checkpoint_path = "no such directory/model.ckpt";
+    m->params.checkpoint_interval = 1;
+    CHECK(!train(m, inputs, outputs, NUM_POINTS, 2, NULL));
+    CHECK(m->progress.epochs == 2);
+    CHECK(!save_checkpoint(m, "no such directory/model.ckpt"));
+    delete_model(m);
+}
+
+static void check_rejected(const char* path, const char* bytes, size_t size){
+    write_test_file(path, bytes, size);
+    Model* m = load_checkpoint(path);
+    CHECK(m == NULL);
+    if (m != NULL)
+        delete_model(m);
+}
+
+static void test_rejected(const char* path){
+    Model* m = example_model();
+    CHECK(save_checkpoint(m, path));
+    delete_model(m);
+    size_t size;
+    char* file = read_file(path, &size);
+    char* copy = (char*) malloc(size);
+    ModelHeader header;
+    memcpy(&header, file, sizeof(header));
+    uint32_t* sizes = (uint32_t*) (copy + sizeof(header));
+
+    //cut short anywhere, even right before the state
+    check_rejected(path, file, sizeof(header) - 1);
+    check_rejected(path, file, header.header_bytes);
+    check_rejected(path, file, size - sizeof(CheckpointState));
+    check_rejected(path, file, size - 4);
+
+    //a flipped bit in the moments or the state
+    memcpy(copy, file, size);
+    copy[header.header_bytes + header.param_bytes + 5] ^= 0x01;
+    check_rejected(path, copy, size);
+    memcpy(copy, file, size);
+    copy[size - 3] ^= 0x01;
+    check_rejected(path, copy, size);
+
+    //the wrong magic, a model file isn't a checkpoint
+    memcpy(copy, file, size);
+    memcpy(copy, MODEL_MAGIC, sizeof(header.magic));
+    check_rejected(path, copy, size);
+
+    //layers that can't be built, or that have more or fewer parameters than the file
+    memcpy(copy, file, size);
+    sizes[1] = 0;
+    check_rejected(path, copy, size);
+    memcpy(copy, file, size);
+    sizes[header.num_layers] = NONE + 1;
+    check_rejected(path, copy, size);
+    memcpy(copy, file, size);
+    sizes[1] = 40;
+    check_rejected(path, copy, size);
+    memcpy(copy, file, size);
+    sizes[0] = 1u << 31;
+    sizes[1] = 1u << 31;
+    check_rejected(path, copy, size);
+
+    //parameters bigger than the whole file
+    memcpy(copy, file, size);
+    ((ModelHeader*) copy)->param_bytes = UINT64_MAX / 3 + 1;
+    check_rejected(path, copy, size);
+
+    free(copy);
+    free(file);
+}
+
+int main(void){
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "model.ckpt");
+    test_resume(path);
+    test_unwritable();
+    test_rejected(path);
+    remove(path);
+    return test_result();
+}
@@ -0,0 +1,90 @@
+//
+//  test_communicator.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Communicator.h"
+#include "pch.h"
+#include <sys/wait.h>
+
+//the most floats any of the runs reduces. Everything past n has to be left alone
+#define CAPACITY 1001
+#define UNTOUCHED -7.0f
+
+//small whole numbers, so the sums are exact whatever order they're added in
+static float value(uint32_t rank, size_t i){
+    return (float) ((rank + 1) * 3 + i % 13);
+}
+
+//what one rank does and checks, returns 1 if everything came out right
+static uint8_t run_rank(Communicator* comm, uint32_t rank, size_t n){
+    uint32_t k = comm->num_ranks;
+    float* own = rank_buffer(comm, rank);
+    for (size_t i = 0; i < CAPACITY; i++)
+        own[i] = i < n ? value(rank, i) : UNTOUCHED;
+
+    //the sum over every rank, halved
+    all_reduce(comm, rank, n, 0.5f);
+    uint8_t ok = 1;
+    for (size_t i = 0; i < CAPACITY; i++){
+        float expected = UNTOUCHED;
+        if (i < n){
+            expected = 0.0f;
+            for (uint32_t r = 0; r < k; r++)
+                expected += value(r, i);
+            expected *= 0.5f;
+        }
+        ok &= own[i] == expected;
+    }
+
+    //nobody can start writing for the broadcast before everyone checked the all reduce
+    communicator_barrier(comm);
+    for (size_t i = 0; i < n; i++)
+        own[i] = rank == 0 ? value(100, i) : -1.0f;
+    broadcast(comm, rank, n);
+    for (size_t i = 0; i < CAPACITY; i++)
+        ok &= own[i] == (i < n ? value(100, i) : UNTOUCHED);
+
+    //the buffers are still the rank's own, reading and writing them afterwards doesn't race with anyone
+    communicator_barrier(comm);
+    return ok;
+}
+
+//ranks 1 .. k - 1 are child processes, rank 0 is this one
+static void check_collectives(uint32_t k, size_t n){
+    Communicator comm = create_communicator(k, CAPACITY);
+    pid_t children[8];
+    for (uint32_t rank = 1; rank < k; rank++){
+        children[rank] = fork();
+        if (children[rank] < 0){
+            fprintf(stderr, "ERROR: Could not fork rank %u. Exiting...\n", rank);
+            exit(-1);
+        }
+        if (children[rank] == 0)
+            _exit(run_rank(&comm, rank, n) ? 0 : 1);
+    }
+
+    uint8_t ok = run_rank(&comm, 0, n);
+    for (uint32_t rank = 1; rank < k; rank++){
+        int status;
+        ok &= waitpid(children[rank], &status, 0) == children[rank] && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+    if (!ok)
+        fprintf(stderr, "collectives of %u ranks on %zu floats\n", k, n);
+    CHECK(ok);
+    delete_communicator(&comm);
+}
+
+int main(void){
+    //fewer floats than ranks, and counts that don't split evenly between them
+    uint32_t ranks[] = { 1, 2, 3, 4, 7 };
+    size_t sizes[] = { 1, 5, CAPACITY };
+    for (size_t r = 0; r < sizeof(ranks) / sizeof(ranks[0]); r++){
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            check_collectives(ranks[r], sizes[s]);
+    }
+    return test_result();
+}
@@ -0,0 +1,165 @@
+//
+//  test_csv.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "core/Data Loader.h"
+#include "Model/Random.h"
+#include "Model/ThreadPool.h"
+#include "pch.h"
+
+#define NUM_NUMBERS 200000
+
+static const char* special_numbers[] = {
+    "0", "-0", "+0", "0.0", ".5", "5.", "-.5e1", "1e0", "1E+2", "1e-2",
+    "nan", "-nan", "inf", "-inf", "infinity", "0x1.8p3", "-0x10",
+    "16777217", "16777217.000000001", "16777216.999999999", "33554435", //halfway between two floats, and right next to it
+    "3.4028235e38", "3.4028236e38", "1e39", "-1e39", "1.17549435e-38", "1.4e-45", "7e-46", "1e-50",
+    "0.000000000000000000000000000000000000000000001", "123456789012345678901234567890", "1.00000000000000000000000001",
+    "9007199254740993", "4.9406564584124654e-324", "2.2250738585072014e-308",
+};
+
+//a random decimal in most of the shapes a csv can have them in
+static void random_number(Rng* rng, char* dest){
+    char* p = dest;
+    uint32_t sign = random_below(rng, 3);
+    if (sign != 0)
+        *p++ = sign == 1 ? '-' : '+';
+
+    uint32_t int_digits = random_below(rng, 12);
+    uint32_t frac_digits = random_below(rng, 12);
+    if (int_digits + frac_digits == 0)
+        int_digits = 1;
+    if (random_below(rng, 8) == 0)
+        int_digits += random_below(rng, 20); //past what the fast path takes
+    for (uint32_t i = 0; i < int_digits; i++)
+        *p++ = (char) ('0' + random_below(rng, 10));
+    if (frac_digits != 0 || random_below(rng, 4) == 0){
+        *p++ = '.';
+        for (uint32_t i = 0; i < frac_digits; i++)
+            *p++ = (char) ('0' + random_below(rng, 10));
+    }
+    if (random_below(rng, 3) == 0){
+        *p++ = random_below(rng, 2) ? 'e' : 'E';
+        uint32_t exponent_sign = random_below(rng, 3);
+        if (exponent_sign != 0)
+            *p++ = exponent_sign == 1 ? '-' : '+';
+        p += sprintf(p, "%u", random_below(rng, 2) ? random_below(rng, 25) : random_below(rng, 60));
+    }
+    *p = '\0';
+}
+
+static uint8_t same_float(float a, float b){
+    return (isnan(a) && isnan(b)) || memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+//every number has to come out bit for bit the way strtof reads it
+static void test_matches_strtof(void){
+    size_t num_special = sizeof(special_numbers) / sizeof(special_numbers[0]);
+    size_t count = num_special + NUM_NUMBERS;
+    char (*numbers)[64] = malloc(sizeof(*numbers) * count);
+
+    Rng rng;
+    seed_rng(&rng, 16);
+    for (size_t i = 0; i < count; i++){
+        if (i < num_special)
+            strcpy(numbers[i], special_numbers[i]);
+        else
+            random_number(&rng, numbers[i]);
+    }
+
+    //big enough for several chunks, so each thread starts somewhere in the middle of the file
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "numbers.csv");
+    FILE* f = fopen(path, "w");
+    fprintf(f, "target,number\n");
+    for (size_t i = 0; i < count; i++)
+        fprintf(f, i % 7 == 0 ? "%zu, %s\r\n" : "%zu,%s\n", i, numbers[i]);
+    fclose(f);
+
+    //loading uses the threads it's given, and leaves the limit alone
+    uint32_t previous_max_threads = set_max_threads(4);
+    Data data = load_csv(path, 0, 1);
+    CHECK(last_load_report().num_threads <= 4);
+    CHECK(set_max_threads(1) == 4);
+    Data serial = load_csv(path, 0, 1);
+    CHECK(last_load_report().num_threads == 1);
+    CHECK(set_max_threads(previous_max_threads) == 1);
+    remove(path);
+    CHECK(serial.num_data_points == data.num_data_points);
+    CHECK(memcmp(serial.values, data.values, sizeof(float) * data.num_data_points * (data.num_inputs + data.num_outputs)) == 0);
+    delete_data(&serial);
+
+    CHECK(data.num_data_points == count);
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count && i < data.num_data_points; i++){
+        float expected = strtof(numbers[i], NULL);
+        float value = data_inputs(&data, i)[0];
+        if (!same_float(value, expected) || data_outputs(&data, i)[0] != (float) i){
+            if (mismatches++ < 10)
+                fprintf(stderr, "%s was read as %.9g, strtof says %.9g\n", numbers[i], value, expected);
+        }
+    }
+    CHECK(mismatches == 0);
+    delete_data(&data);
+    free(numbers);
+}
+
+static Data load_text(const char* text, uint32_t target_column, uint32_t num_targets){
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "rows.csv");
+    write_test_file(path, text, strlen(text));
+    Data data = load_csv(path, target_column, num_targets);
+    remove(path);
+    return data;
+}
+
+static void test_last_line_without_newline(void){
+    Data data = load_text("x,y\n1,2\n3,4", 1, 1);
+    CHECK(data.num_data_points == 2);
+    if (data.num_data_points == 2){
+        CHECK(data_inputs(&data, 1)[0] == 3.0f);
+        CHECK(data_outputs(&data, 1)[0] == 4.0f);
+    }
+    delete_data(&data);
+
+    //a file that ends in the middle of a number is just as fine
+    data = load_text("x,y\n1,2\n3,4.5e1", 1, 1);
+    CHECK(data.num_data_points == 2 && data_outputs(&data, 1)[0] == 45.0f);
+    delete_data(&data);
+}
+
+//labels that aren't one of the classes skip their row, they don't end the program
+static void test_bad_labels(void){
+    Data data = load_text("x,label\n0.5,1\n0.25,nan\n0.75,-1\n1,3\n1.5,-0.5\n2,2\n", 1, 3);
+    CHECK(data.num_data_points == 2);
+    if (data.num_data_points == 2){
+        CHECK(data_inputs(&data, 0)[0] == 0.5f && data_inputs(&data, 1)[0] == 2.0f);
+        float* first = data_outputs(&data, 0);
+        float* second = data_outputs(&data, 1);
+        CHECK(first[0] == 0.0f && first[1] == 1.0f && first[2] == 0.0f);
+        CHECK(second[0] == 0.0f && second[1] == 0.0f && second[2] == 1.0f);
+    }
+    delete_data(&data);
+}
+
+static void test_malformed_rows(void){
+    Data data = load_text("x,y\n1,2\n1,,\n3\n\n0x,1\n4 , 5\r\n6,7,8\n", 1, 1);
+    CHECK(data.num_data_points == 2);
+    if (data.num_data_points == 2){
+        CHECK(data_inputs(&data, 0)[0] == 1.0f && data_outputs(&data, 0)[0] == 2.0f);
+        CHECK(data_inputs(&data, 1)[0] == 4.0f && data_outputs(&data, 1)[0] == 5.0f);
+    }
+    delete_data(&data);
+}
+
+int main(void){
+    test_matches_strtof();
+    test_last_line_without_newline();
+    test_bad_labels();
+    test_malformed_rows();
+    return test_result();
+}
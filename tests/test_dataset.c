@@ -0,0 +1,215 @@
+//
+//  test_dataset.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "core/Data Loader.h"
+#include "core/Data Stream.h"
+#include "pch.h"
+
+#define NUM_POINTS 1000
+#define NUM_INPUTS 3
+#define NUM_OUTPUTS 2
+
+static Data example_data(void){
+    Data data = create_data(NUM_POINTS, NUM_INPUTS, NUM_OUTPUTS);
+    for (uint32_t i = 0; i < NUM_POINTS; i++){
+        for (uint32_t j = 0; j < NUM_INPUTS; j++)
+            data_inputs(&data, i)[j] = (float) i + 0.25f * (float) j;
+        for (uint32_t j = 0; j < NUM_OUTPUTS; j++)
+            data_outputs(&data, i)[j] = -(float) i - 0.5f * (float) j;
+    }
+    return data;
+}
+
+static uint8_t same_data_points(Data* a, Data* b){
+    if (a->num_data_points != b->num_data_points || a->num_inputs != b->num_inputs || a->num_outputs != b->num_outputs)
+        return 0;
+    for (uint32_t i = 0; i < a->num_data_points; i++){
+        if (memcmp(data_inputs(a, i), data_inputs(b, i), sizeof(float) * a->num_inputs) != 0 ||
+            memcmp(data_outputs(a, i), data_outputs(b, i), sizeof(float) * a->num_outputs) != 0)
+            return 0;
+    }
+    return 1;
+}
+
+static void test_round_trip(const char* path){
+    Data data = example_data();
+    CHECK(save_dataset(&data, path));
+
+    Data loaded = load_dataset(path, 1);
+    CHECK(same_data_points(&data, &loaded));
+    CHECK(loaded.mapping != NULL && loaded.one_hot == data.one_hot);
+
+    //a split of a mapped dataset views the mapping, which only whole unmaps
+    DataSplit split = train_test_split(&loaded, NUM_POINTS / 2, 1);
+    CHECK(split.train.mapping == NULL && split.test.mapping == NULL && split.whole.mapping != NULL);
+    CHECK(split.train.inputs == split.whole.inputs);
+    delete_split_data(&split);
+
+    //a shuffle buffer of 1 streams the points in file order
+    DataSource* stream = open_dataset_stream(path, 1, 64);
+    CHECK(stream != NULL);
+    if (stream != NULL){
+        float inputs[7 * NUM_INPUTS], outputs[7 * NUM_OUTPUTS];
+        uint32_t total = 0, matches = 1, n;
+        stream->begin_epoch(stream);
+        while ((n = stream->next_batch(stream, inputs, outputs, 7)) != 0){
+            for (uint32_t i = 0; i < n && total + i < NUM_POINTS; i++){
+                matches &= memcmp(inputs + i * NUM_INPUTS, data_inputs(&data, total + i), sizeof(float) * NUM_INPUTS) == 0;
+                matches &= memcmp(outputs + i * NUM_OUTPUTS, data_outputs(&data, total + i), sizeof(float) * NUM_OUTPUTS) == 0;
+            }
+            total += n;
+        }
+        CHECK(total == NUM_POINTS && matches);
+        stream->close(stream);
+    }
+
+    //a bigger one draws them in another order, but still each one once an epoch, and again after a restart
+    stream = open_dataset_stream(path, 64, 64);
+    CHECK(stream != NULL);
+    for (int epoch = 0; epoch < 2 && stream != NULL; epoch++){
+        float inputs[7 * NUM_INPUTS], outputs[7 * NUM_OUTPUTS];
+        uint8_t seen[NUM_POINTS] = { 0 };
+        uint32_t total = 0, in_order = 1, all_once = 1, n;
+        stream->begin_epoch(stream);
+        while ((n = stream->next_batch(stream, inputs, outputs, 7)) != 0){
+            for (uint32_t i = 0; i < n; i++){
+                uint32_t point = (uint32_t) inputs[i * NUM_INPUTS];
+                if (point < NUM_POINTS)
+                    seen[point]++;
+                in_order &= point == total + i;
+            }
+            total += n;
+        }
+        for (uint32_t i = 0; i < NUM_POINTS; i++)
+            all_once &= seen[i] == 1;
+        CHECK(total == NUM_POINTS && all_once && !in_order);
+    }
+    if (stream != NULL)
+        stream->close(stream);
+
+    //a flipped byte in the last output is only caught when the checksum is checked
+    FILE* f = fopen(path, "rb");
+    if (f == NULL || fseek(f, 0, SEEK_END) != 0){
+        fprintf(stderr, "ERROR: Could not read %s. Exiting...\n", path);
+        exit(-1);
+    }
+    size_t length = (size_t) ftell(f);
+    char* bytes = (char*) malloc(length);
+    CHECK(fseek(f, 0, SEEK_SET) == 0 && fread(bytes, 1, length, f) == length);
+    fclose(f);
+    bytes[length - 1] ^= 0x10;
+    write_test_file(path, bytes, length);
+    free(bytes);
+    loaded = load_dataset(path, 0);
+    CHECK(loaded.num_data_points == NUM_POINTS);
+    delete_data(&loaded);
+    loaded = load_dataset(path, 1);
+    CHECK(loaded.num_data_points == 0 && loaded.values == NULL);
+    delete_data(&loaded);
+    delete_data(&data);
+
+    //empty datasets aren't written, they couldn't be read back
+    Data empty = create_data(0, NUM_INPUTS, NUM_OUTPUTS);
+    CHECK(!save_dataset(&empty, path));
+    delete_data(&empty);
+}
+
+static DatasetHeader read_header(const char* path){
+    DatasetHeader header;
+    FILE* f = fopen(path, "rb");
+    if (f == NULL || fread(&header, sizeof(header), 1, f) != 1){
+        fprintf(stderr, "ERROR: Could not read the header of %s. Exiting...\n", path);
+        exit(-1);
+    }
+    fclose(f);
+    return header;
+}
+
+//neither the loader nor the stream may take the file
+static void check_rejected(const char* path){
+    Data data = load_dataset(path, 0);
+    CHECK(data.num_data_points == 0 && data.values == NULL && data.inputs == NULL);
+    DataSource* stream = open_dataset_stream(path, 16, 0);
+    CHECK(stream == NULL);
+    if (stream != NULL)
+        stream->close(stream);
+}
+
+static void test_truncated(const char* path){
+    Data data = example_data();
+    CHECK(save_dataset(&data, path));
+    delete_data(&data);
+    DatasetHeader header = read_header(path);
+
+    //cut off in the outputs, in the inputs, and in the header itself
+    size_t lengths[] = { header.outputs_offset + 4, header.outputs_offset - 4, 100, sizeof(header) - 1 };
+    char* bytes = (char*) malloc(header.outputs_offset + 4);
+    FILE* f = fopen(path, "rb");
+    CHECK(f != NULL && fread(bytes, 1, header.outputs_offset + 4, f) == header.outputs_offset + 4);
+    fclose(f);
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++){
+        write_test_file(path, bytes, lengths[i]);
+        check_rejected(path);
+        if (lengths[i] >= sizeof(header))
+            CHECK(!check_dataset_header(&header, lengths[i]));
+    }
+    free(bytes);
+}
+
+//headers whose sizes only look consistent because a product wrapped around
+static void test_wrapping(const char* path){
+    DatasetHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DATASET_MAGIC, sizeof(header.magic));
+    header.version = DATASET_VERSION;
+    header.dtype = DATASET_FLOAT32;
+    header.header_bytes = sizeof(DatasetHeader);
+
+    //4 * 2^31 * 2^31 bytes of inputs is 2^64, so the offset and length of both halves came out as 0 before
+    header.num_data_points = 1ull << 31;
+    header.num_inputs = 1u << 31;
+    header.num_outputs = 1u << 31;
+    header.outputs_offset = sizeof(DatasetHeader);
+    char file[256] = { 0 };
+    memcpy(file, &header, sizeof(header));
+    CHECK(!check_dataset_header(&header, sizeof(file)));
+    write_test_file(path, file, sizeof(file));
+    check_rejected(path);
+
+    //the stream reads files with more than 2^32 data points, so only the product stops this one
+    header.num_data_points = 1ull << 62;
+    header.num_inputs = 4;
+    header.num_outputs = 4;
+    memcpy(file, &header, sizeof(header));
+    CHECK(!check_dataset_header(&header, sizeof(file)));
+    write_test_file(path, file, sizeof(file));
+    check_rejected(path);
+
+    //no data points, and data points without any values
+    header.num_data_points = 0;
+    header.num_inputs = 4;
+    header.num_outputs = 4;
+    CHECK(!check_dataset_header(&header, sizeof(file)));
+    header.num_data_points = 16;
+    header.num_inputs = 0;
+    header.num_outputs = 0;
+    CHECK(!check_dataset_header(&header, sizeof(file)));
+    memcpy(file, &header, sizeof(header));
+    write_test_file(path, file, sizeof(file));
+    check_rejected(path);
+}
+
+int main(void){
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "dataset.bin");
+    test_round_trip(path);
+    test_truncated(path);
+    test_wrapping(path);
+    remove(path);
+    return test_result();
+}
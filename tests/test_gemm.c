@@ -0,0 +1,233 @@
+//
+//  test_gemm.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Gemm.h"
+#include "Model/Layer.h"
+#include "Model/ThreadPool.h"
+#include "pch.h"
+
+//(m x n x k) products on every path: empty, the gemv and small loops, and the blocked one on both sides of MR, NR, KC, MC, NC
+//and of the size where it's split between threads
+static const size_t shapes[][3] = {
+    { 0, 5, 3 }, { 4, 6, 0 },
+    { 1, 1, 1 }, { 3, 1, 7 }, { 37, 1, 300 },
+    { 7, 3, 5 }, { 31, 33, 31 },
+    { 4, 8, 256 }, { 5, 9, 257 }, { 33, 17, 40 }, { 129, 13, 513 },
+    { 130, 2049, 3 }, { 127, 260, 100 }, { 257, 40, 300 },
+};
+#define NUM_SHAPES (sizeof(shapes) / sizeof(shapes[0]))
+
+//the padding on every leading dimension, so the strides aren't the same as the widths
+#define PADDING 3
+
+static void fill(float* values, size_t n, float seed){
+    for (size_t i = 0; i < n; i++)
+        values[i] = sinf((float) i * 0.61f + seed);
+}
+
+//C = alpha * op(A) * op(B) + beta * C in doubles, one element at a time. bound gets the sum of the absolute values that went into each element,
+//which is what the rounding error of the float version scales with
+static void naive_gemm(Transpose trans_a, Transpose trans_b, size_t m, size_t n, size_t k, float alpha,
+                       const float* a, size_t lda, const float* b, size_t ldb, float beta, const float* c, size_t ldc,
+                       double* result, double* bound){
+    for (size_t i = 0; i < m; i++){
+        for (size_t j = 0; j < n; j++){
+            double sum = 0.0, abs_sum = 0.0;
+            for (size_t p = 0; p < k; p++){
+                double a_ip = trans_a == TRANSPOSE ? a[p * lda + i] : a[i * lda + p];
+                double b_pj = trans_b == TRANSPOSE ? b[j * ldb + p] : b[p * ldb + j];
+                sum += a_ip * b_pj;
+                abs_sum += fabs(a_ip * b_pj);
+            }
+            double old = beta == 0.0f ? 0.0 : (double) c[i * ldc + j];
+            result[i * n + j] = alpha * sum + beta * old;
+            bound[i * n + j] = fabs(alpha) * abs_sum + fabs(beta * old);
+        }
+    }
+}
+
+static uint8_t close_to(float value, double expected, double bound){
+    return fabs(value - expected) <= 1e-5 * bound + 1e-6;
+}
+
+//an epilogue that adds 1000 to every element and counts how many times it saw each one
+typedef struct CountingEpilogue{
+    uint32_t* visits;
+    size_t n;
+    uint8_t bad_tile;
+} CountingEpilogue;
+
+static void counting_epilogue(float* tile, size_t ldc, size_t row, size_t col, size_t rows, size_t cols, void* ctx){
+    CountingEpilogue* counting = (CountingEpilogue*) ctx;
+    if (rows == 0 || cols == 0 || col + cols > counting->n)
+        counting->bad_tile = 1;
+    for (size_t r = 0; r < rows; r++){
+        for (size_t c = 0; c < cols; c++){
+            tile[r * ldc + c] += 1000.0f;
+            counting->visits[(row + r) * counting->n + col + c]++;
+        }
+    }
+}
+
+//one product with every pair of transpositions, with and without beta, as gemm() and as gemm_epilogue()
+static void check_shape(size_t m, size_t n, size_t k){
+    const float scales[][2] = { { 1.0f, 0.0f }, { 0.5f, -1.5f }, { -2.0f, 1.0f } };
+    float* a = (float*) malloc(sizeof(float) * ((m + PADDING) * (k + PADDING) + 1));
+    float* b = (float*) malloc(sizeof(float) * ((k + PADDING) * (n + PADDING) + 1));
+    float* c = (float*) malloc(sizeof(float) * (m * (n + PADDING) + 1));
+    float* original_c = (float*) malloc(sizeof(float) * (m * (n + PADDING) + 1));
+    double* expected = (double*) malloc(sizeof(double) * (m * n + 1));
+    double* bound = (double*) malloc(sizeof(double) * (m * n + 1));
+    uint32_t* visits = (uint32_t*) malloc(sizeof(uint32_t) * (m * n + 1));
+    size_t ldc = n + PADDING;
+
+    for (int trans_a = 0; trans_a < 2; trans_a++){
+        for (int trans_b = 0; trans_b < 2; trans_b++){
+            //the stored shapes of A and B
+            size_t lda = (trans_a == TRANSPOSE ? m : k) + PADDING;
+            size_t ldb = (trans_b == TRANSPOSE ? k : n) + PADDING;
+            fill(a, (trans_a == TRANSPOSE ? k : m) * lda, 0.3f);
+            fill(b, (trans_b == TRANSPOSE ? n : k) * ldb, 1.7f);
+
+            for (size_t s = 0; s < sizeof(scales) / sizeof(scales[0]); s++){
+                float alpha = scales[s][0], beta = scales[s][1];
+                fill(original_c, m * ldc, 2.9f);
+                //C isn't read when beta is 0, so it can hold anything
+                if (beta == 0.0f){
+                    for (size_t i = 0; i < m * ldc; i++)
+                        original_c[i] = NAN;
+                }
+                naive_gemm(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, original_c, ldc, expected, bound);
+
+                memcpy(c, original_c, sizeof(float) * m * ldc);
+                gemm(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc);
+                uint8_t same = 1;
+                for (size_t i = 0; i < m && same; i++){
+                    for (size_t j = 0; j < n; j++)
+                        same &= close_to(c[i * ldc + j], expected[i * n + j], bound[i * n + j]);
+                    //the padding is left alone
+                    for (size_t j = n; j < ldc; j++)
+                        same &= memcmp(c + i * ldc + j, original_c + i * ldc + j, sizeof(float)) == 0;
+                }
+                if (!same)
+                    fprintf(stderr, "gemm %zu x %zu x %zu, transposes %d %d, alpha %g beta %g\n", m, n, k, trans_a, trans_b, alpha, beta);
+                CHECK(same);
+
+                //the epilogue sees every element once, after it's final
+                memcpy(c, original_c, sizeof(float) * m * ldc);
+                memset(visits, 0, sizeof(uint32_t) * m * n);
+                CountingEpilogue counting = { .visits = visits, .n = n };
+                GemmEpilogue epilogue = { .apply = counting_epilogue, .ctx = &counting };
+                gemm_epilogue(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c, ldc, &epilogue);
+                same = !counting.bad_tile;
+                for (size_t i = 0; i < m && same; i++){
+                    for (size_t j = 0; j < n; j++)
+                        same &= visits[i * n + j] == 1 && close_to(c[i * ldc + j] - 1000.0f, expected[i * n + j], bound[i * n + j] + 1000.0);
+                }
+                if (!same)
+                    fprintf(stderr, "gemm_epilogue %zu x %zu x %zu, transposes %d %d, alpha %g beta %g\n", m, n, k, trans_a, trans_b, alpha, beta);
+                CHECK(same);
+            }
+        }
+    }
+
+    free(a);
+    free(b);
+    free(c);
+    free(original_c);
+    free(expected);
+    free(bound);
+    free(visits);
+}
+
+static void test_gemm(void){
+    for (size_t i = 0; i < NUM_SHAPES; i++)
+        check_shape(shapes[i][0], shapes[i][1], shapes[i][2]);
+}
+
+//layer_forward_trans() against the biased product put through act_func(), for every activation
+static void check_layer(size_t rows, size_t cols, size_t batch, Transpose trans_x, Activation act){
+    Matrix weights = create_matrix(rows, cols);
+    Matrix biases = create_matrix(rows, 1);
+    Matrix x = trans_x == TRANSPOSE ? create_matrix(batch, cols) : create_matrix(cols, batch);
+    Matrix out = create_matrix(rows, batch);
+    Matrix pre = create_matrix(rows, batch);
+    Matrix expected_pre = create_matrix(rows, batch);
+    fill(weights.values, size(&weights), 0.1f);
+    fill(biases.values, size(&biases), 0.4f);
+    fill(x.values, size(&x), 0.8f);
+    for (size_t i = 0; i < size(&weights); i++)
+        weights.values[i] *= 3.0f; //so the clipped activations get past the clipping range
+
+    for (size_t r = 0; r < rows; r++){
+        for (size_t c = 0; c < batch; c++){
+            double sum = biases.values[r];
+            for (size_t p = 0; p < cols; p++)
+                sum += (double) weights.values[r * cols + p] * (trans_x == TRANSPOSE ? x.values[c * cols + p] : x.values[p * batch + c]);
+            expected_pre.values[r * batch + c] = (float) sum;
+        }
+    }
+    Matrix expected_out = matrix_copy(&expected_pre);
+    act_func(&expected_out, act);
+
+    //with and without the pre activation
+    for (int with_pre = 0; with_pre < 2; with_pre++){
+        set_values_with(&out, NAN);
+        layer_forward_trans(&weights, &x, trans_x, &biases, act, with_pre ? &pre : NULL, &out);
+        uint8_t same = 1;
+        for (size_t i = 0; i < size(&out) && same; i++){
+            same &= fabsf(out.values[i] - expected_out.values[i]) <= 1e-4f * (1.0f + fabsf(expected_out.values[i]));
+            if (with_pre)
+                same &= fabsf(pre.values[i] - expected_pre.values[i]) <= 1e-4f * (1.0f + fabsf(expected_pre.values[i]));
+        }
+        if (!same)
+            fprintf(stderr, "layer %zu x %zu, batch %zu, transpose %d, activation %d\n", rows, cols, batch, trans_x, act);
+        CHECK(same);
+    }
+
+    //layer_forward() is the untransposed one
+    if (trans_x == NO_TRANSPOSE){
+        Matrix plain = create_matrix(rows, batch);
+        layer_forward(&weights, &x, &biases, act, NULL, &plain);
+        layer_forward_trans(&weights, &x, NO_TRANSPOSE, &biases, act, NULL, &out);
+        CHECK(memcmp(plain.values, out.values, sizeof(float) * size(&out)) == 0);
+        delete_matrix(&plain);
+    }
+
+    delete_matrix(&weights);
+    delete_matrix(&biases);
+    delete_matrix(&x);
+    delete_matrix(&out);
+    delete_matrix(&pre);
+    delete_matrix(&expected_pre);
+    delete_matrix(&expected_out);
+}
+
+static void test_layers(void){
+    //(rows x cols) weights and a batch: a single data point, a small product, and blocked ones with and without threads
+    const size_t layers[][3] = { { 17, 5, 1 }, { 9, 33, 8 }, { 40, 70, 37 }, { 130, 300, 70 } };
+    Activation activations[] = { RELU, LEAKY_RELU, SIGMOID, HYPERBOLIC_TANGENT, SOFT_PLUS, SOFT_MAX, LINEAR };
+    for (size_t l = 0; l < sizeof(layers) / sizeof(layers[0]); l++){
+        for (size_t a = 0; a < sizeof(activations) / sizeof(activations[0]); a++){
+            check_layer(layers[l][0], layers[l][1], layers[l][2], NO_TRANSPOSE, activations[a]);
+            check_layer(layers[l][0], layers[l][1], layers[l][2], TRANSPOSE, activations[a]);
+        }
+    }
+}
+
+int main(void){
+    //once on this thread alone, and once split between a pool of 4, even on a machine with fewer cores
+    configure_thread_pool(4, 0);
+    test_gemm();
+    test_layers();
+    uint32_t previous = set_max_threads(4);
+    test_gemm();
+    test_layers();
+    set_max_threads(previous);
+    return test_result();
+}
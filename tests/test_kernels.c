@@ -0,0 +1,305 @@
+//
+//  test_kernels.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Activations.h"
+#include "Model/Kernels.h"
+#include "Model/Matrix.h"
+#include "Model/ThreadPool.h"
+#include "pch.h"
+#include <stdatomic.h>
+
+//big enough to be split, and not a whole number of chunks
+#define ROWS 515
+#define COLS 301
+
+static atomic_uint visits[ROWS * COLS];
+static atomic_uint num_chunks;
+
+static void count_range(size_t begin, size_t end, void* ctx){
+    (void) ctx;
+    atomic_fetch_add(&num_chunks, 1);
+    for (size_t i = begin; i < end; i++)
+        atomic_fetch_add(visits + i, 1);
+}
+
+static uint8_t visited_once(size_t n){
+    for (size_t i = 0; i < n; i++){
+        if (atomic_load(visits + i) != 1)
+            return 0;
+    }
+    return 1;
+}
+
+static void clear_visits(void){
+    for (size_t i = 0; i < ROWS * COLS; i++)
+        atomic_store(visits + i, 0);
+    atomic_store(&num_chunks, 0);
+}
+
+static void test_parallel_range(void){
+    uint32_t previous = set_max_threads(8);
+
+    //every element exactly once, in more than one chunk
+    clear_visits();
+    parallel_range(ROWS * COLS, PARALLEL_ELEMENTWISE_SIZE, count_range, NULL);
+    CHECK(visited_once(ROWS * COLS));
+    CHECK(atomic_load(&num_chunks) > 1);
+
+    //under the threshold it's one call on this thread
+    clear_visits();
+    parallel_range(1000, PARALLEL_ELEMENTWISE_SIZE, count_range, NULL);
+    CHECK(visited_once(1000) && atomic_load(&num_chunks) == 1);
+    clear_visits();
+    parallel_range(0, 0, count_range, NULL);
+    CHECK(atomic_load(&num_chunks) == 1);
+
+    set_max_threads(previous);
+}
+
+static Matrix example_matrix(float offset){
+    Matrix mat = create_matrix(ROWS, COLS);
+    for (size_t i = 0; i < size(&mat); i++)
+        mat.values[i] = sinf((float) i * 0.37f + offset) * 4.0f;
+    return mat;
+}
+
+//every element wise routine on a big matrix, which is split between threads if there are any
+static Matrix run_all(void){
+    Matrix mat = example_matrix(0.0f);
+    Matrix other = example_matrix(1.0f);
+    Matrix result = create_matrix(ROWS, COLS);
+
+    add_in_place(&mat, &other);
+    scalar_mult(&mat, 0.5f);
+    scalar_add(&mat, 0.25f);
+    sub_in_place(&mat, &other);
+    dot_in_place(&mat, &other);
+    Activation activations[] = { RELU, LEAKY_RELU, SIGMOID, HYPERBOLIC_TANGENT, SOFT_PLUS };
+    for (size_t a = 0; a < sizeof(activations) / sizeof(activations[0]); a++){
+        Matrix x = example_matrix((float) a);
+        act_func(&x, activations[a]);
+        add_in_place(&mat, &x);
+        Matrix d = example_matrix((float) a + 0.5f);
+        act_func_deriv(&d, activations[a], NULL);
+        add_in_place(&mat, &d);
+        delete_matrix(&x);
+        delete_matrix(&d);
+    }
+    matrix_square(&mat);
+    matrix_sqrt(&mat);
+    scalar_add(&mat, 1.0f);
+    reciprocal(&mat);
+
+    Matrix sum = add(&mat, &other);
+    move_matrix(&sum, &result);
+    delete_matrix(&mat);
+    delete_matrix(&other);
+    return result;
+}
+
+//each element is computed the same way whichever thread gets it, so the results are the same to the bit
+static void test_same_results(void){
+    Matrix serial = run_all();
+    uint32_t previous = set_max_threads(8);
+    Matrix parallel = run_all();
+    set_max_threads(previous);
+
+    CHECK(memcmp(serial.values, parallel.values, sizeof(float) * ROWS * COLS) == 0);
+    //and the same as the kernels called directly
+    Matrix mat = example_matrix(0.0f);
+    Matrix other = example_matrix(1.0f);
+    set_max_threads(8);
+    add_in_place(&mat, &other);
+    set_max_threads(previous);
+    Matrix direct = example_matrix(0.0f);
+    kernels.add(direct.values, other.values, size(&direct));
+    CHECK(memcmp(direct.values, mat.values, sizeof(float) * ROWS * COLS) == 0);
+
+    delete_matrix(&serial);
+    delete_matrix(&parallel);
+    delete_matrix(&mat);
+    delete_matrix(&other);
+    delete_matrix(&direct);
+}
+
+//lengths around every vector width, so each version has a tail for its scalar part, and some without one
+static const size_t lengths[] = { 0, 1, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 32, 33, 63, 64, 65, 1000, 1003 };
+#define MAX_LENGTH 1003
+#define NUM_LENGTHS (sizeof(lengths) / sizeof(lengths[0]))
+
+static const char* table_names[] = { "sse", "avx2", "avx512" };
+#define NUM_TABLES (sizeof(table_names) / sizeof(table_names[0]))
+
+static void fill(float* values, size_t n, float seed){
+    for (size_t i = 0; i < n; i++)
+        values[i] = sinf((float) i * 0.37f + seed) * 4.0f;
+}
+
+static uint8_t close_floats(const float* a, const float* b, size_t n, float tolerance){
+    for (size_t i = 0; i < n; i++){
+        if (fabsf(a[i] - b[i]) > tolerance * (1.0f + fabsf(b[i])))
+            return 0;
+    }
+    return 1;
+}
+
+//each kernel of the table on n floats, against the scalar one. Everything but the sums is one correctly rounded
+//operation per element, so it has to come out the same to the bit
+static uint8_t same_as_scalar(const ElementwiseKernels* table, size_t n){
+    const ElementwiseKernels* scalar = find_kernels("scalar");
+    float src[MAX_LENGTH], expected[MAX_LENGTH], got[MAX_LENGTH];
+    fill(src, n, 2.0f);
+    uint8_t same = 1;
+
+    void (*binary[][2])(float*, const float*, size_t) = {
+        { table->mul, scalar->mul }, { table->div, scalar->div }, { table->add, scalar->add }, { table->sub, scalar->sub },
+    };
+    for (size_t k = 0; k < sizeof(binary) / sizeof(binary[0]); k++){
+        fill(got, n, 0.0f);
+        fill(expected, n, 0.0f);
+        binary[k][0](got, src, n);
+        binary[k][1](expected, src, n);
+        same &= memcmp(got, expected, sizeof(float) * n) == 0;
+    }
+
+    void (*with_scalar[][2])(float*, float, size_t) = { { table->scale, scalar->scale }, { table->shift, scalar->shift } };
+    for (size_t k = 0; k < sizeof(with_scalar) / sizeof(with_scalar[0]); k++){
+        fill(got, n, 0.0f);
+        fill(expected, n, 0.0f);
+        with_scalar[k][0](got, -1.3f, n);
+        with_scalar[k][1](expected, -1.3f, n);
+        same &= memcmp(got, expected, sizeof(float) * n) == 0;
+    }
+
+    void (*unary[][2])(float*, size_t) = { { table->square, scalar->square }, { table->sqrt, scalar->sqrt }, { table->reciprocal, scalar->reciprocal } };
+    for (size_t k = 0; k < sizeof(unary) / sizeof(unary[0]); k++){
+        fill(got, n, 0.0f);
+        fill(expected, n, 0.0f);
+        if (unary[k][1] == scalar->sqrt){
+            for (size_t i = 0; i < n; i++){
+                got[i] = fabsf(got[i]);
+                expected[i] = fabsf(expected[i]);
+            }
+        }
+        unary[k][0](got, n);
+        unary[k][1](expected, n);
+        same &= memcmp(got, expected, sizeof(float) * n) == 0;
+    }
+
+    //the sums are added up in a different order
+    float sum = table->sum_squares(src, n), expected_sum = scalar->sum_squares(src, n);
+    same &= fabsf(sum - expected_sum) <= 1e-5f * (1.0f + expected_sum);
+    return same;
+}
+
+//the Adam update the way it was made before the fused kernel, one pass over the whole array per operation.
+//it applies the learning rate twice and has the bias corrections of the moments swapped, which the fused one keeps
+static float adam_passes(const ElementwiseKernels* table, float* params, float* moment, float* moment2, const float* grads, size_t n,
+                         float learning_rate, float momentum, float momentum2, float epsillon, uint32_t time_step){
+    float g[MAX_LENGTH], m_copy[MAX_LENGTH], v_copy[MAX_LENGTH];
+    memcpy(g, grads, sizeof(float) * n);
+
+    //Mt = B1 * Mt-1 + (1 - B1)Gt
+    table->scale(moment, momentum, n);
+    table->scale(g, 1.0f - momentum, n);
+    table->add(moment, g, n);
+    memcpy(g, grads, sizeof(float) * n);
+
+    //Vt = B2 * Vt-1 + (1 - B2)Gt^2
+    table->scale(moment2, momentum2, n);
+    table->square(g, n);
+    table->scale(g, 1.0f - momentum2, n);
+    table->add(moment2, g, n);
+
+    memcpy(m_copy, moment, sizeof(float) * n);
+    memcpy(v_copy, moment2, sizeof(float) * n);
+    table->scale(v_copy, 1.0f / (1.0f - powf(momentum, time_step)), n);
+    table->scale(m_copy, 1.0f / (1.0f - powf(momentum2, time_step)), n);
+
+    //a * Mt / (Sqrt(Vt) + Epsillon) * a
+    table->sqrt(v_copy, n);
+    table->shift(v_copy, epsillon, n);
+    table->reciprocal(v_copy, n);
+    table->scale(v_copy, learning_rate, n);
+    table->mul(v_copy, m_copy, n);
+    table->scale(v_copy, learning_rate, n);
+
+    table->sub(params, v_copy, n);
+    return table->sum_squares(v_copy, n);
+}
+
+//a few fused Adam steps from the same start against the step by step version, made with the same table
+static uint8_t adam_matches(const ElementwiseKernels* table, size_t n){
+    float learning_rate = 0.05f, momentum = 0.9f, momentum2 = 0.999f, epsillon = 1e-8f;
+    float params[MAX_LENGTH], moment[MAX_LENGTH], moment2[MAX_LENGTH];
+    float expected_params[MAX_LENGTH], expected_moment[MAX_LENGTH], expected_moment2[MAX_LENGTH], grads[MAX_LENGTH];
+    fill(params, n, 0.5f);
+    memset(moment, 0, sizeof(moment));
+    memset(moment2, 0, sizeof(moment2));
+    memcpy(expected_params, params, sizeof(params));
+    memset(expected_moment, 0, sizeof(expected_moment));
+    memset(expected_moment2, 0, sizeof(expected_moment2));
+
+    uint8_t same = 1;
+    for (uint32_t t = 1; t <= 3; t++){
+        fill(grads, n, (float) t);
+        AdamStep step = {
+            .step_size = learning_rate * learning_rate,
+            .momentum = momentum,
+            .momentum2 = momentum2,
+            .epsillon = epsillon,
+            .correction = 1.0f / (1.0f - powf(momentum2, t)),
+            .correction2 = 1.0f / (1.0f - powf(momentum, t)),
+        };
+        float mag = table->adam(params, moment, moment2, grads, n, &step);
+        float expected_mag = adam_passes(table, expected_params, expected_moment, expected_moment2, grads, n,
+                                         learning_rate, momentum, momentum2, epsillon, t);
+        same &= fabsf(mag - expected_mag) <= 1e-4f * (1e-6f + expected_mag);
+    }
+    same &= close_floats(moment, expected_moment, n, 1e-6f);
+    same &= close_floats(moment2, expected_moment2, n, 1e-6f);
+    same &= close_floats(params, expected_params, n, 1e-6f);
+    return same;
+}
+
+//every instruction set this machine has against the scalar version
+static void test_tables(void){
+    CHECK(find_kernels("scalar") != NULL && find_kernels("neon") == NULL);
+    CHECK(find_kernels(kernels.name) != NULL);
+
+    const ElementwiseKernels* tables[NUM_TABLES + 1] = { find_kernels("scalar") };
+    size_t num_tables = 1;
+    for (size_t t = 0; t < NUM_TABLES; t++){
+        const ElementwiseKernels* table = find_kernels(table_names[t]);
+        if (table != NULL)
+            tables[num_tables++] = table;
+        else
+            printf("%s kernels aren't supported here, skipping them\n", table_names[t]);
+    }
+
+    for (size_t t = 0; t < num_tables; t++){
+        uint8_t same = 1, adam_same = 1;
+        for (size_t l = 0; l < NUM_LENGTHS; l++){
+            same &= same_as_scalar(tables[t], lengths[l]);
+            adam_same &= adam_matches(tables[t], lengths[l]);
+        }
+        if (!same || !adam_same)
+            fprintf(stderr, "%s kernels don't match\n", tables[t]->name);
+        CHECK(same);
+        CHECK(adam_same);
+    }
+}
+
+int main(void){
+    //a pool of 8 threads even on a machine with fewer cores, so the ranges really are split
+    configure_thread_pool(8, 0);
+    test_tables();
+    test_parallel_range();
+    test_same_results();
+    return test_result();
+}
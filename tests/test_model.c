@@ -0,0 +1,277 @@
+//
+//  test_model.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Model.h"
+#include "Model/Training.h"
+#include "pch.h"
+
+static Model* example_model(void){
+    ModelParams params = {
+        .learning_rate = 0.01f,
+        .batch_size = 4,
+        .momentum = 0.9f,
+        .momentum2 = 0.99f,
+        .epsillon = 1e-8,
+        .num_threads = 1,
+        .seed = 3,
+    };
+    Model* m = create_model(&params, NULL);
+    add_layer(m, 3, NONE);
+    add_layer(m, 17, SIGMOID); //not a multiple of the padding
+    add_layer(m, 2, SOFT_MAX);
+    set_loss_func(m, CROSS_ENTROPY);
+    compile(m);
+    srand(2);
+    init_weights_and_biases(m, 0, 1);
+    return m;
+}
+
+static uint8_t same_model(Model* a, Model* b){
+    if (a->num_layers != b->num_layers || a->loss_func != b->loss_func || a->num_parameters != b->num_parameters ||
+        a->params.learning_rate != b->params.learning_rate || a->params.batch_size != b->params.batch_size)
+        return 0;
+    for (uint32_t i = 0; i < a->num_layers; i++){
+        if (get(&a->layer_sizes, i) != get(&b->layer_sizes, i) || (i + 1 < a->num_layers && get(&a->activations, i) != get(&b->activations, i)))
+            return 0;
+    }
+    return memcmp(a->parameters, b->parameters, sizeof(float) * a->num_parameters) == 0;
+}
+
+//the floats between the end of one matrix and the start of the next in the parameter buffer
+static uint8_t padding_is_zero(Model* m, const float* buffer){
+    const float* end = buffer + m->num_parameters;
+    for (uint32_t i = 0; i + 1 < m->num_layers; i++){
+        const float* matrices[2][2] = {
+            { buffer + (m->weights[i].values - m->parameters) + size(m->weights + i), buffer + (m->biases[i].values - m->parameters) },
+            { buffer + (m->biases[i].values - m->parameters) + size(m->biases + i), i + 2 < m->num_layers ? buffer + (m->weights[i + 1].values - m->parameters) : end },
+        };
+        for (int j = 0; j < 2; j++){
+            for (const float* p = matrices[j][0]; p < matrices[j][1]; p++){
+                if (*p != 0.0f)
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static char* read_file(const char* path, size_t* size){
+    FILE* f = fopen(path, "rb");
+    fseek(f, 0, SEEK_END);
+    *size = (size_t) ftell(f);
+    rewind(f);
+    char* bytes = (char*) malloc(*size);
+    if (fread(bytes, 1, *size, f) != *size)
+        *size = 0;
+    fclose(f);
+    return bytes;
+}
+
+static void test_round_trip(const char* path){
+    Model* m = example_model();
+    CHECK(padding_is_zero(m, m->parameters));
+    CHECK(save_model(m, path));
+
+    Model* mapped = map_model(path, 1);
+    CHECK(mapped != NULL && mapped->mapping != NULL);
+    if (mapped != NULL){
+        CHECK(same_model(m, mapped));
+
+        //the same outputs from the file's parameters
+        float inputs[6] = { 0.1f, -0.2f, 0.3f, 1.0f, 0.5f, -1.0f };
+        float expected[4], outputs[4];
+        eval_batch(m, inputs, 2, expected);
+        eval_batch(mapped, inputs, 2, outputs);
+        CHECK(memcmp(expected, outputs, sizeof(outputs)) == 0);
+
+        //the mapping is copy on write, training it leaves the file alone
+        size_t size_before, size_after;
+        char* before = read_file(path, &size_before);
+        Matrix x[4], y[4];
+        float values[4][5] = { { 0, 0, 1, 1, 0 }, { 1, 0, 0, 0, 1 }, { 0, 1, 0, 1, 0 }, { 1, 1, 1, 0, 1 } };
+        for (int i = 0; i < 4; i++){
+            x[i] = (Matrix) { .rows = 3, .cols = 1, .values = values[i] };
+            y[i] = (Matrix) { .rows = 2, .cols = 1, .values = values[i] + 3 };
+        }
+        mapped->params.num_threads = 1;
+        CHECK(train(mapped, x, y, 4, 3, NULL));
+        CHECK(padding_is_zero(mapped, mapped->parameters) && padding_is_zero(mapped, mapped->moments) && padding_is_zero(mapped, mapped->moments_squared));
+        CHECK(!same_model(m, mapped));
+        char* after = read_file(path, &size_after);
+        CHECK(size_before == size_after && memcmp(before, after, size_before) == 0);
+        free(before);
+        free(after);
+        delete_model(mapped);
+    }
+
+    //load_model() tells the formats apart, and the text one is only as precise as its 6 decimals
+    Model* loaded = load_model(path);
+    CHECK(same_model(m, loaded));
+    delete_model(loaded);
+    CHECK(export_model_text(m, path));
+    Model* text = load_model(path);
+    uint8_t close = text->num_parameters == m->num_parameters;
+    for (size_t i = 0; i < m->num_parameters && close; i++)
+        close = fabsf(text->parameters[i] - m->parameters[i]) <= 1e-6f;
+    CHECK(close);
+    delete_model(text);
+    delete_model(m);
+}
+
+//loaded and inference models only hold their parameters, until they're trained
+static void test_inference_state(const char* path){
+    Model* m = example_model();
+    MemoryReport compiled = memory_report(m);
+    CHECK(compiled.optimizer_state == 2 * compiled.parameters && compiled.workspaces != 0 && compiled.saved == 0);
+    CHECK(save_model(m, path));
+
+    Model* mapped = map_model(path, 0);
+    CHECK(mapped != NULL);
+    if (mapped != NULL){
+        MemoryReport report = memory_report(mapped);
+        CHECK(report.parameters == compiled.parameters && report.optimizer_state == 0 && report.workspaces == 0);
+        CHECK(report.saved == compiled.optimizer_state + compiled.workspaces);
+        Matrix x[4], y[4];
+        float values[4][5] = { { 0, 0, 1, 1, 0 }, { 1, 0, 0, 0, 1 }, { 0, 1, 0, 1, 0 }, { 1, 1, 1, 0, 1 } };
+        for (int i = 0; i < 4; i++){
+            x[i] = (Matrix) { .rows = 3, .cols = 1, .values = values[i] };
+            y[i] = (Matrix) { .rows = 2, .cols = 1, .values = values[i] + 3 };
+        }
+        CHECK(train(mapped, x, y, 4, 1, NULL));
+        CHECK(memory_report(mapped).optimizer_state == compiled.optimizer_state);
+        delete_model(mapped);
+    }
+
+    //the same weights give the same outputs without any of the training state
+    ModelParams params = m->params;
+    Model* inference = create_model(&params, NULL);
+    add_layer(inference, 3, NONE);
+    add_layer(inference, 17, SIGMOID);
+    add_layer(inference, 2, SOFT_MAX);
+    set_loss_func(inference, CROSS_ENTROPY);
+    CHECK(compile_for_inference(inference));
+    srand(2);
+    init_weights_and_biases(inference, 0, 1);
+    CHECK(memory_report(inference).optimizer_state == 0 && inference->workspaces == NULL);
+    float inputs[6] = { 0.1f, -0.2f, 0.3f, 1.0f, 0.5f, -1.0f };
+    float expected[4], outputs[4];
+    eval_batch(m, inputs, 2, expected);
+    eval_batch(inference, inputs, 2, outputs);
+    CHECK(memcmp(expected, outputs, sizeof(outputs)) == 0);
+    delete_model(inference);
+    delete_model(m);
+}
+
+static void write_and_check_rejected(const char* path, const char* bytes, size_t size, uint8_t verify_checksum){
+    write_test_file(path, bytes, size);
+    Model* m = map_model(path, verify_checksum);
+    CHECK(m == NULL);
+    if (m != NULL)
+        delete_model(m);
+}
+
+static void test_rejected(const char* path){
+    Model* m = example_model();
+    CHECK(save_model(m, path));
+    delete_model(m);
+    size_t size;
+    char* file = read_file(path, &size);
+    char* copy = (char*) malloc(size);
+    ModelHeader header;
+    memcpy(&header, file, sizeof(header));
+    uint32_t* sizes = (uint32_t*) (copy + sizeof(header));
+
+    //cut short, in the header or in the parameters
+    write_and_check_rejected(path, file, 20, 0);
+    write_and_check_rejected(path, file, size - 4, 0);
+
+    //a flipped bit in the parameters only shows in the checksum
+    memcpy(copy, file, size);
+    copy[size - 7] ^= 0x10;
+    write_and_check_rejected(path, copy, size, 1);
+    write_test_file(path, copy, size);
+    m = map_model(path, 0);
+    CHECK(m != NULL);
+    if (m != NULL)
+        delete_model(m);
+
+    //layers that aren't there, or can't be built
+    memcpy(copy, file, size);
+    sizes[1] = 0;
+    write_and_check_rejected(path, copy, size, 0);
+    memcpy(copy, file, size);
+    sizes[1] = 16; //fewer parameters than the file has
+    write_and_check_rejected(path, copy, size, 0);
+    memcpy(copy, file, size);
+    sizes[header.num_layers] = NONE + 1; //the first activation
+    write_and_check_rejected(path, copy, size, 0);
+    memcpy(copy, file, size);
+    ((ModelHeader*) copy)->loss_func = BINARY_CROSS_ENTROPY + 1;
+    write_and_check_rejected(path, copy, size, 0);
+
+    //layers whose parameter count only matches the file once it wraps around
+    memcpy(copy, file, size);
+    sizes[0] = 1u << 31;
+    sizes[1] = 1u << 31;
+    sizes[2] = 16;
+    write_and_check_rejected(path, copy, size, 0);
+    sizes[0] = 0xffffffffu;
+    write_and_check_rejected(path, copy, size, 0);
+
+    free(copy);
+    free(file);
+}
+
+//more columns than the biggest inference plan, which go through it a piece at a time
+static void test_wide_eval(void){
+    ModelParams params = { .batch_size = 1, .num_threads = 1 };
+    Model* m = create_model(&params, NULL);
+    add_layer(m, 3, NONE);
+    add_layer(m, 17, SIGMOID);
+    add_layer(m, 9, RELU); //two hidden layers, so both halves of the plan are used
+    add_layer(m, 2, SOFT_MAX);
+    set_loss_func(m, CROSS_ENTROPY);
+    compile_for_inference(m);
+    srand(6);
+    init_weights_and_biases(m, 0, 1);
+    size_t n = 70000;
+    Matrix x = create_matrix(3, n);
+    for (size_t i = 0; i < size(&x); i++)
+        x.values[i] = sinf((float) i * 0.01f);
+    Matrix out = eval(m, &x);
+    CHECK(out.rows == 2 && out.cols == n);
+
+    //every column comes out the same as it does by itself
+    uint8_t close = 1;
+    for (size_t c = 0; c < n && close; c += 997){
+        float column[3], expected[2];
+        for (size_t r = 0; r < 3; r++)
+            column[r] = x.values[r * n + c];
+        Matrix single = create_matrix_from_values(3, 1, column);
+        Matrix single_out = create_matrix_from_values(2, 1, expected);
+        eval_into(m, &single, &single_out);
+        for (size_t r = 0; r < 2; r++)
+            close &= fabsf(out.values[r * n + c] - expected[r]) <= 1e-6f;
+    }
+    CHECK(close);
+
+    delete_matrix(&x);
+    delete_matrix(&out);
+    delete_model(m);
+}
+
+int main(void){
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "model.bin");
+    test_round_trip(path);
+    test_inference_state(path);
+    test_rejected(path);
+    test_wide_eval();
+    remove(path);
+    return test_result();
+}
@@ -0,0 +1,140 @@
+//
+//  test_random.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "Model/Random.h"
+#include "pch.h"
+#include <pthread.h>
+
+//the reference outputs of xoshiro256** from the state { 1, 2, 3, 4 }
+static void test_reference_sequence(void){
+    Rng rng = { { 1, 2, 3, 4 } };
+    CHECK(next_random(&rng) == 11520ull);
+    CHECK(next_random(&rng) == 0ull);
+    CHECK(next_random(&rng) == 1509978240ull);
+    CHECK(next_random(&rng) == 1215971899390074240ull);
+}
+
+//a seed gives the same numbers on every platform and every run: splitmix64 of it, then xoshiro256**
+static void test_seeded_sequence(void){
+    Rng rng;
+    seed_rng(&rng, 12345);
+    CHECK(next_random(&rng) == 0xbe6a36374160d49bull);
+    CHECK(next_random(&rng) == 0x214aaa0637a688c6ull);
+    CHECK(next_random(&rng) == 0xf69d16de9954d388ull);
+    CHECK(next_random(&rng) == 0x0c60048c4e96e033ull);
+
+    //nearby seeds give unrelated sequences
+    Rng a, b;
+    seed_rng(&a, 100);
+    seed_rng(&b, 101);
+    uint32_t equal = 0;
+    for (int i = 0; i < 64; i++)
+        equal += next_random(&a) == next_random(&b);
+    CHECK(equal == 0);
+}
+
+static void test_ranges(void){
+    Rng rng;
+    seed_rng(&rng, 9);
+    uint32_t counts[7] = { 0 };
+    uint8_t in_range = 1;
+    for (int i = 0; i < 70000; i++){
+        uint32_t r = random_below(&rng, 7);
+        in_range &= r < 7;
+        counts[r < 7 ? r : 0]++;
+        float f = random_float(&rng);
+        in_range &= f >= 0.0f && f < 1.0f;
+    }
+    CHECK(in_range);
+    //10000 expected each, this is more than 10 standard deviations
+    for (int i = 0; i < 7; i++)
+        CHECK(counts[i] > 9000 && counts[i] < 11000);
+
+    CHECK(random_below(&rng, 1) == 0);
+    uint8_t big_in_range = 1;
+    for (int i = 0; i < 1000; i++)
+        big_in_range &= random_below(&rng, UINT32_MAX) < UINT32_MAX;
+    CHECK(big_in_range);
+}
+
+static uint8_t is_permutation(const uint32_t* indices, uint32_t n){
+    uint8_t* seen = (uint8_t*) calloc(n, 1);
+    uint8_t valid = 1;
+    for (uint32_t i = 0; i < n && valid; i++){
+        valid = indices[i] < n && !seen[indices[i]];
+        if (valid)
+            seen[indices[i]] = 1;
+    }
+    free(seen);
+    return valid;
+}
+
+static void test_shuffle(void){
+    enum { N = 1000 };
+    uint32_t a[N], b[N];
+    for (uint32_t i = 0; i < N; i++)
+        a[i] = b[i] = i;
+
+    Rng ra, rb;
+    seed_rng(&ra, 77);
+    seed_rng(&rb, 77);
+    shuffle_indices(&ra, a, N, N);
+    shuffle_indices(&rb, b, N, N);
+    CHECK(is_permutation(a, N));
+    CHECK(memcmp(a, b, sizeof(a)) == 0);
+    uint32_t fixed = 0;
+    for (uint32_t i = 0; i < N; i++)
+        fixed += a[i] == i;
+    CHECK(fixed < 10); //about 1 expected
+
+    //a partial shuffle makes the same first count positions a full one would
+    for (uint32_t i = 0; i < N; i++)
+        a[i] = b[i] = i;
+    seed_rng(&ra, 78);
+    seed_rng(&rb, 78);
+    shuffle_indices(&ra, a, N, 100);
+    shuffle_indices(&rb, b, N, N);
+    CHECK(is_permutation(a, N));
+    CHECK(memcmp(a, b, sizeof(uint32_t) * 100) == 0);
+
+    //nothing to do for 0 or 1 indices
+    uint32_t one = 0;
+    shuffle_indices(&ra, &one, 1, 1);
+    shuffle_indices(&ra, NULL, 0, 0);
+    CHECK(one == 0);
+}
+
+static void* seeded_thread(void* arg){
+    seed_random(555);
+    *(uint64_t*) arg = next_random(thread_rng());
+    return NULL;
+}
+
+//every thread has its own generator, so seeding one doesn't move the others
+static void test_thread_rng(void){
+    seed_random(555);
+    Rng copy = *thread_rng();
+    uint64_t first = next_random(thread_rng());
+    CHECK(first == next_random(&copy));
+
+    uint64_t other = 0;
+    pthread_t thread;
+    pthread_create(&thread, NULL, seeded_thread, &other);
+    pthread_join(thread, NULL);
+    CHECK(other == first);
+    CHECK(next_random(thread_rng()) == next_random(&copy));
+}
+
+int main(void){
+    test_reference_sequence();
+    test_seeded_sequence();
+    test_ranges();
+    test_shuffle();
+    test_thread_rng();
+    return test_result();
+}
@@ -0,0 +1,268 @@
+//
+//  test_training.c
+//  Neural Net
+//
+//
+//
+
+#include "test.h"
+#include "core/Data Loader.h"
+#include "core/Data Stream.h"
+#include "Model/Model.h"
+#include "Model/Training.h"
+#include "pch.h"
+
+#define NUM_POINTS 200
+#define EPOCHS 5
+
+static Model* example_model(uint8_t hogwild){
+    ModelParams params = {
+        .learning_rate = 0.05f,
+        .batch_size = 8,
+        .momentum = 0.9f,
+        .momentum2 = 0.99f,
+        .epsillon = 1e-8,
+        .num_threads = 1,
+        .hogwild = hogwild,
+        .seed = 7,
+    };
+    Model* m = create_model(&params, NULL);
+    add_layer(m, 2, NONE);
+    add_layer(m, 8, LEAKY_RELU);
+    add_layer(m, 1, LINEAR);
+    set_loss_func(m, LEAST_SQUARES);
+    compile(m);
+    srand(5); //the same weights for every model
+    init_weights_and_biases(m, 0, 1);
+    return m;
+}
+
+//y = x0 * x1
+static Data example_data(void){
+    Data data = create_data(NUM_POINTS, 2, 1);
+    for (uint32_t i = 0; i < NUM_POINTS; i++){
+        float* x = data_inputs(&data, i);
+        x[0] = (float) (i % 17) / 17.0f;
+        x[1] = (float) (i % 11) / 11.0f;
+        data_outputs(&data, i)[0] = x[0] * x[1];
+    }
+    return data;
+}
+
+static uint8_t same_parameters(Model* a, Model* b){
+    return a->num_parameters == b->num_parameters && memcmp(a->parameters, b->parameters, sizeof(float) * a->num_parameters) == 0;
+}
+
+//the column vectors train() takes, made the old way for comparison
+static void matrix_views(Data* data, Matrix** inputs, Matrix** outputs){
+    *inputs = (Matrix*) calloc(data->num_data_points, sizeof(Matrix));
+    *outputs = (Matrix*) calloc(data->num_data_points, sizeof(Matrix));
+    for (uint32_t i = 0; i < data->num_data_points; i++){
+        (*inputs)[i] = (Matrix) { .rows = data->num_inputs, .cols = 1, .values = data_inputs(data, i) };
+        (*outputs)[i] = (Matrix) { .rows = data->num_outputs, .cols = 1, .values = data_outputs(data, i) };
+    }
+}
+
+static void test_split(void){
+    Data data = example_data();
+    float* block = data.values;
+    DataSplit split = train_test_split(&data, 150, 3);
+    CHECK(data.values == NULL);
+    CHECK(split.train.num_data_points == 150 && split.test.num_data_points == 50);
+    CHECK(split.train.inputs == block && split.test.inputs == block); //nothing was copied
+
+    //every row shows up exactly once
+    uint8_t seen[NUM_POINTS] = { 0 };
+    for (uint32_t i = 0; i < 150; i++)
+        seen[split.train.rows[i]]++;
+    for (uint32_t i = 0; i < 50; i++)
+        seen[split.test.rows[i]]++;
+    uint8_t all_once = 1;
+    for (uint32_t i = 0; i < NUM_POINTS; i++)
+        all_once &= seen[i] == 1;
+    CHECK(all_once);
+
+    //the same seed gives the same split, and a split of a split views the same block
+    Data again = example_data();
+    DataSplit split2 = train_test_split(&again, 150, 3);
+    CHECK(memcmp(split.order, split2.order, sizeof(uint32_t) * NUM_POINTS) == 0);
+    DataSplit nested = train_test_split(&split2.train, 100, 4);
+    CHECK(nested.train.inputs == split2.whole.inputs);
+    uint8_t nested_rows = 1;
+    for (uint32_t i = 0; i < 100; i++)
+        nested_rows &= memcmp(data_inputs(&nested.train, i), data_inputs(&split2.whole, nested.train.rows[i]), sizeof(float) * 2) == 0;
+    CHECK(nested_rows);
+    delete_split_data(&nested);
+    delete_split_data(&split2);
+
+    //a view is saved in its own order
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "split.bin");
+    CHECK(save_dataset(&split.test, path));
+    Data loaded = load_dataset(path, 1);
+    uint8_t same = loaded.num_data_points == 50;
+    for (uint32_t i = 0; i < 50 && same; i++)
+        same = data_outputs(&loaded, i)[0] == data_outputs(&split.test, i)[0];
+    CHECK(same);
+    delete_data(&loaded);
+    remove(path);
+    delete_split_data(&split);
+}
+
+//training on the rows of a split has to come out the same as training on column vectors of the same data points
+static void test_rows_match_matrices(uint8_t hogwild){
+    Data data = example_data();
+    DataSplit split = train_test_split(&data, 160, 11);
+    Matrix* inputs;
+    Matrix* outputs;
+    matrix_views(&split.train, &inputs, &outputs);
+
+    Model* a = example_model(hogwild);
+    Model* b = example_model(hogwild);
+    CHECK(same_parameters(a, b));
+    DataRows rows = data_rows(&split.train);
+    CHECK(train(a, inputs, outputs, split.train.num_data_points, EPOCHS, NULL));
+    CHECK(train_rows(b, &rows, EPOCHS, NULL));
+    CHECK(same_parameters(a, b));
+    Model* untrained = example_model(hogwild);
+    CHECK(!same_parameters(a, untrained));
+    delete_model(untrained);
+
+    Matrix* test_inputs;
+    Matrix* test_outputs;
+    matrix_views(&split.test, &test_inputs, &test_outputs);
+    DataRows test_rows = data_rows(&split.test);
+    CHECK(loss_on_rows(b, &test_rows) == loss_on_dataset(b, test_inputs, test_outputs, split.test.num_data_points));
+    CHECK(accuracy_on_rows(b, &test_rows) == accuracy_on_dataset(b, test_inputs, test_outputs, split.test.num_data_points));
+
+    free(inputs);
+    free(outputs);
+    free(test_inputs);
+    free(test_outputs);
+    delete_model(a);
+    delete_model(b);
+    delete_split_data(&split);
+}
+
+static void test_distributed_rows(void){
+    Data data = example_data();
+    DataSplit split = train_test_split(&data, 160, 11);
+    Matrix* inputs;
+    Matrix* outputs;
+    matrix_views(&split.train, &inputs, &outputs);
+
+    Model* a = example_model(0);
+    Model* b = example_model(0);
+    DataRows rows = data_rows(&split.train);
+    CHECK(train_distributed(a, inputs, outputs, split.train.num_data_points, EPOCHS, 2, NULL));
+    CHECK(train_rows_distributed(b, &rows, EPOCHS, 2, NULL));
+    CHECK(same_parameters(a, b));
+
+    //rows that don't fit the model are turned down
+    rows.num_inputs = 3;
+    CHECK(!train_rows_distributed(b, &rows, EPOCHS, 2, NULL));
+
+    free(inputs);
+    free(outputs);
+    delete_model(a);
+    delete_model(b);
+    delete_split_data(&split);
+}
+
+//a stream has to have as many inputs and outputs as the model
+static void test_stream_shape(void){
+    Data data = example_data();
+    Data wider = create_data(NUM_POINTS, 3, 1);
+    char path[TEST_PATH_LENGTH], wider_path[TEST_PATH_LENGTH];
+    test_path(path, "stream.bin");
+    test_path(wider_path, "wider.bin");
+    CHECK(save_dataset(&data, path) && save_dataset(&wider, wider_path));
+
+    Model* m = example_model(0);
+    DataSource* source = open_dataset_stream(path, 64, 0);
+    DataSource* wider_source = open_dataset_stream(wider_path, 64, 0);
+    CHECK(train_stream(m, source, EPOCHS, NULL));
+    CHECK(!train_stream(m, wider_source, EPOCHS, NULL));
+    source->close(source);
+    wider_source->close(wider_source);
+
+    remove(path);
+    remove(wider_path);
+    delete_model(m);
+    delete_data(&data);
+    delete_data(&wider);
+}
+
+//gathering inline, double buffered and three deep all have to train the same model, from rows and from a stream
+static void test_prefetch_depths(void){
+    Data data = example_data();
+    char path[TEST_PATH_LENGTH];
+    test_path(path, "prefetch.bin");
+    CHECK(save_dataset(&data, path));
+    DataRows rows = data_rows(&data);
+
+    Model* inline_rows = example_model(0);
+    Model* inline_stream = example_model(0);
+    inline_rows->params.prefetch_depth = 1;
+    inline_stream->params.prefetch_depth = 1;
+    CHECK(train_rows(inline_rows, &rows, EPOCHS, NULL));
+    for (uint32_t depth = 2; depth <= 3; depth++){
+        Model* m = example_model(0);
+        m->params.prefetch_depth = depth;
+        CHECK(train_rows(m, &rows, EPOCHS, NULL));
+        CHECK(same_parameters(m, inline_rows));
+        delete_model(m);
+    }
+
+    //a shuffle buffer of 1 streams the same batches every epoch
+    DataSource* source = open_dataset_stream(path, 1, 0);
+    CHECK(train_stream(inline_stream, source, EPOCHS, NULL));
+    Model* m = example_model(0);
+    CHECK(train_stream(m, source, EPOCHS, NULL));
+    CHECK(same_parameters(m, inline_stream) && !same_parameters(m, inline_rows));
+    source->close(source);
+
+    remove(path);
+    delete_model(m);
+    delete_model(inline_rows);
+    delete_model(inline_stream);
+    delete_data(&data);
+}
+
+//a batch wider than a uint16_t still gets room for all of its columns
+static void test_wide_batch(void){
+    uint32_t n = 70000;
+    Data data = create_data(n, 2, 1);
+    for (uint32_t i = 0; i < n; i++){
+        float* x = data_inputs(&data, i);
+        x[0] = (float) (i % 17) / 17.0f;
+        x[1] = (float) (i % 11) / 11.0f;
+        data_outputs(&data, i)[0] = x[0] * x[1];
+    }
+
+    Model* m = example_model(0);
+    Model* untrained = example_model(0);
+    m->params.batch_size = n;
+    DataRows rows = data_rows(&data);
+    CHECK(train_rows(m, &rows, 1, NULL));
+    uint8_t finite = 1;
+    for (size_t i = 0; i < m->num_parameters; i++)
+        finite &= isfinite(m->parameters[i]) != 0;
+    CHECK(finite);
+    CHECK(!same_parameters(m, untrained));
+
+    delete_model(m);
+    delete_model(untrained);
+    delete_data(&data);
+}
+
+int main(void){
+    test_split();
+    test_rows_match_matrices(0);
+    test_rows_match_matrices(1);
+    test_distributed_rows();
+    test_stream_shape();
+    test_prefetch_depths();
+    test_wide_batch();
+    return test_result();
+}